@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lfp/batch.h>
+#include <lfp/lfp.h>
+
+/*
+ * Index and validate many files in parallel, and print one line per file.
+ *
+ * usage: batch-index [-t] [-r] [-j N] [-z ZERO] [-s SUFFIX] FILE...
+ *
+ *  -t          files are tape images (default if neither -t nor -r)
+ *  -r          files are rp66 visible envelopes (combine with -t for DLIS
+ *              written to tape images)
+ *  -j N        use N threads (default: all)
+ *  -z ZERO     open the files at offset ZERO, e.g. 80 to skip the DLIS SUL
+ *  -s SUFFIX   write sidecar indices to FILE + SUFFIX
+ */
+
+static void report(const lfp_batch_result* result, void* userdata) {
+    int* failures = (int*)userdata;
+
+    if (result->status == LFP_OK) {
+        printf("%s: ok, %lld records, %lld bytes\n",
+               result->path,
+               (long long)result->records,
+               (long long)result->size);
+        return;
+    }
+
+    if (result->status != LFP_PROTOCOL_TRYRECOVERY)
+        *failures += 1;
+
+    printf("%s: error %d: %s\n",
+           result->path,
+           result->status,
+           result->errmsg ? result->errmsg : "");
+}
+
+static void usage(void) {
+    fputs("usage: batch-index [-t] [-r] [-j N] [-z ZERO] [-s SUFFIX] FILE...\n",
+          stderr);
+    exit(EXIT_FAILURE);
+}
+
+int main(int args, char** argv) {
+    lfp_batch_options opts;
+    memset(&opts, 0, sizeof(opts));
+
+    int i = 1;
+    for (; i < args && argv[i][0] == '-'; ++i) {
+        const char* opt = argv[i];
+        if (strcmp(opt, "-t") == 0) {
+            opts.protocols |= LFP_BATCH_TAPEIMAGE;
+        } else if (strcmp(opt, "-r") == 0) {
+            opts.protocols |= LFP_BATCH_RP66;
+        } else if (strcmp(opt, "-j") == 0 && i + 1 < args) {
+            opts.nthreads = atoi(argv[++i]);
+        } else if (strcmp(opt, "-z") == 0 && i + 1 < args) {
+            opts.zero = atoll(argv[++i]);
+        } else if (strcmp(opt, "-s") == 0 && i + 1 < args) {
+            opts.sidecar = argv[++i];
+        } else {
+            usage();
+        }
+    }
+
+    if (i == args)
+        usage();
+
+    if (!opts.protocols)
+        opts.protocols = LFP_BATCH_TAPEIMAGE;
+
+    int failures = 0;
+    const int err = lfp_batch_index((const char* const*)(argv + i),
+                                    (size_t)(args - i),
+                                    &opts,
+                                    report,
+                                    &failures);
+    if (err != LFP_OK) {
+        fprintf(stderr, "batch-index: unable to index files (error %d)\n", err);
+        exit(EXIT_FAILURE);
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
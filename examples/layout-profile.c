@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lfp/lfp.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+/*
+ * Profile the record layout of files, and project how many calls different
+ * protocol stacks make when reading them. Only the record headers are read.
+ *
+ * usage: layout-profile [-t] [-r] [-z ZERO] [-b BYTES] [-w BYTES] FILE...
+ *
+ *  -t          files are tape images (default if neither -t nor -r)
+ *  -r          files are rp66 visible envelopes (combine with -t for DLIS
+ *              written to tape images)
+ *  -z ZERO     open the files at offset ZERO, e.g. 80 to skip the DLIS SUL
+ *  -b BYTES    size of the reads made by the application (default: 4096)
+ *  -w BYTES    readahead fill size (default: 65536)
+ *
+ * For every protocol in the stack, this prints a histogram of the record
+ * sizes, the file marks, and the memory an index of the file takes. The
+ * projected calls are the calls every protocol makes to the protocol beneath
+ * it, when reading the whole file in sequence, or when reading at random with
+ * the index already built. The stacks compared are the plain protocols, the
+ * readahead protocol on top of the stack, and the readahead protocol beneath
+ * the stack, i.e. on the file itself, with lfp_insert_below().
+ */
+
+typedef struct level {
+    const char* name;
+    /* bytes per record header */
+    int header;
+    /* bytes per record in an index with one entry per header */
+    int flat;
+    /* bytes per run in an index of runs of equally sized records */
+    int run;
+    /* the record type of file marks, or -1 if there are none */
+    int file_mark;
+    /* the furthest offset the protocol can seek to */
+    int64_t end;
+
+    lfp_record* records;
+    int64_t n;
+} level;
+
+static const level tapeimage_level = {
+    "tapeimage", 12, 8, 16, 1, UINT32_MAX, NULL, 0
+};
+
+static const level rp66_level = {
+    "rp66", 4, 16, 24, -1, INT64_MAX / 2, NULL, 0
+};
+
+typedef struct options {
+    int tapeimage;
+    int rp66;
+    int64_t zero;
+    int64_t read;
+    int64_t fill;
+} options;
+
+/*
+ * Seek past the end to index the whole file without reading any of the
+ * record bodies, then copy the index, and go back to the start. The
+ * tapeimage protocol does not support offsets past 4GB.
+ */
+static int chase(lfp_protocol* f, level* lvl) {
+    int err = lfp_seek(f, lvl->end);
+    if (err != LFP_OK && err != LFP_EOF && err != LFP_UNEXPECTED_EOF)
+        return err;
+
+    err = lfp_index_size(f, &lvl->n);
+    if (err != LFP_OK) return err;
+
+    lvl->records = malloc(sizeof(lfp_record) * (size_t)(lvl->n ? lvl->n : 1));
+    if (!lvl->records) return LFP_RUNTIME_ERROR;
+
+    err = lfp_index_records(f, 0, lvl->n, lvl->records, NULL);
+    if (err != LFP_OK) return err;
+
+    return lfp_seek(f, 0);
+}
+
+static int64_t logical_size(const level* lvl) {
+    int64_t end = 0;
+    for (int64_t i = 0; i < lvl->n; ++i) {
+        const lfp_record* rec = lvl->records + i;
+        if (rec->logical + rec->length > end)
+            end = rec->logical + rec->length;
+    }
+    return end;
+}
+
+static int64_t physical_size(const level* lvl) {
+    int64_t end = 0;
+    for (int64_t i = 0; i < lvl->n; ++i) {
+        const lfp_record* rec = lvl->records + i;
+        if (rec->base + lvl->header + rec->length > end)
+            end = rec->base + lvl->header + rec->length;
+    }
+    return end;
+}
+
+static int64_t nonempty(const level* lvl) {
+    int64_t n = 0;
+    for (int64_t i = 0; i < lvl->n; ++i)
+        n += lvl->records[i].length > 0;
+    return n;
+}
+
+static int64_t runs(const level* lvl) {
+    int64_t n = 0;
+    for (int64_t i = 0; i < lvl->n; ++i) {
+        const lfp_record* rec = lvl->records + i;
+        if (i == 0
+            || rec->type   != rec[-1].type
+            || rec->length != rec[-1].length)
+            n += 1;
+    }
+    return n;
+}
+
+/*
+ * The number of reads it takes to read the file in reads of size bytes, when
+ * every read is split at the record boundaries
+ */
+static int64_t pieces(const level* lvl, int64_t size) {
+    int64_t n = 0;
+    for (int64_t i = 0; i < lvl->n; ++i) {
+        const lfp_record* rec = lvl->records + i;
+        if (rec->length == 0) continue;
+        const int64_t last = rec->logical + rec->length - 1;
+        n += last / size - rec->logical / size + 1;
+    }
+    return n;
+}
+
+static void histogram(const level* lvl) {
+    /* bucket 0 is empty records, and bucket k is [2^(k-1), 2^k) */
+    int64_t buckets[64];
+    int64_t total = 0;
+    memset(buckets, 0, sizeof(buckets));
+
+    for (int64_t i = 0; i < lvl->n; ++i) {
+        const lfp_record* rec = lvl->records + i;
+        if (rec->type == lvl->file_mark) continue;
+
+        int k = 0;
+        while (k < 63 && rec->length >> k) ++k;
+        buckets[k] += 1;
+        total += 1;
+    }
+
+    printf("  record sizes:\n");
+    for (int k = 0; k < 64; ++k) {
+        if (!buckets[k]) continue;
+
+        const long long lo = k == 0 ? 0 : 1LL << (k - 1);
+        const long long hi = k == 0 ? 0 : (1LL << k) - 1;
+        printf("    %10lld - %-10lld %12lld (%5.1f%%)\n",
+               lo,
+               hi,
+               (long long)buckets[k],
+               100.0 * (double)buckets[k] / (double)total);
+    }
+}
+
+static void file_marks(const level* lvl) {
+    if (lvl->file_mark == -1)
+        return;
+
+    int64_t n = 0;
+    printf("  file marks:\n");
+    for (int64_t i = 0; i < lvl->n; ++i) {
+        const lfp_record* rec = lvl->records + i;
+        if (rec->type != lvl->file_mark) continue;
+
+        n += 1;
+        if (n <= 10) {
+            printf("    record %lld, logical %lld, physical %lld\n",
+                   (long long)i,
+                   (long long)rec->logical,
+                   (long long)rec->base);
+        }
+    }
+
+    if (n == 0)
+        printf("    none\n");
+    else if (n > 10)
+        printf("    ... %lld file marks in total\n", (long long)n);
+}
+
+static void index_memory(const level* lvl) {
+    const int64_t r = runs(lvl);
+    printf("  index memory:\n");
+    printf("    runs     %12lld bytes (%lld runs)\n",
+           (long long)(r * lvl->run),
+           (long long)r);
+    printf("    flat     %12lld bytes\n", (long long)(lvl->n * lvl->flat));
+    printf("    records  %12lld bytes (lfp_index_records and sidecars)\n",
+           (long long)(lvl->n * (int64_t)sizeof(lfp_record)));
+}
+
+static void sequential(const level* lvl, const options* opts) {
+    printf("  calls beneath, reading everything in %lld byte reads:\n",
+           (long long)opts->read);
+    printf("    plain              %12lld\n",
+           (long long)(lvl->n + pieces(lvl, opts->read)));
+    printf("    readahead on top   %12lld\n",
+           (long long)(lvl->n + pieces(lvl, opts->fill)));
+}
+
+/*
+ * The expected number of calls for a read of size bytes at a random offset.
+ * Every read is preceded by a seek, and spans about size / average record
+ * length record boundaries.
+ */
+static double random_read(const level* lvl, int64_t size) {
+    const int64_t total = logical_size(lvl);
+    if (total == 0) return 1.0;
+    const double boundaries = (double)(nonempty(lvl) - 1);
+    return 2.0 + boundaries * (double)size / (double)total;
+}
+
+static void recommend(const level* top,
+                      const level* bottom,
+                      const options* opts) {
+    const int64_t total = logical_size(top);
+    const int64_t physical = physical_size(bottom);
+    const int64_t records = nonempty(top);
+    const int64_t average = records ? total / records : 0;
+
+    const int64_t plain = top->n + pieces(top, opts->read);
+    const int64_t above = top->n + pieces(top, opts->fill);
+    const int64_t below = (physical + opts->fill - 1) / opts->fill;
+
+    const double random_plain = random_read(top, opts->read);
+    const double random_above = random_read(top, opts->fill);
+    /* beneath the stack, the headers in the span are read too */
+    const double stretch = total ? (double)physical / (double)total : 1.0;
+    const int64_t span = (int64_t)(stretch * (double)opts->read);
+    const double random_below =
+        1.0 + (double)((span + opts->fill - 1) / opts->fill);
+
+    printf("projected calls beneath %s:\n", top->name);
+    printf("  sequential, plain              %12lld\n", (long long)plain);
+    printf("  sequential, readahead on top   %12lld\n", (long long)above);
+    printf("  sequential, readahead beneath  %12lld\n", (long long)below);
+    printf("  per random read, plain         %12.1f\n", random_plain);
+    printf("  per random read, on top        %12.1f\n", random_above);
+    printf("  per random read, beneath       %12.1f\n", random_below);
+
+    /*
+     * A layer is only worth it if it at least halves the calls. Beneath the
+     * stack, the readahead also serves the header reads, so it wins for
+     * small records, while large records are read one by one regardless.
+     */
+    printf("recommended:\n");
+    if (below * 2 <= plain && below <= above) {
+        printf("  lfp_insert_below(%s, readahead of %lld bytes)\n",
+               bottom->name,
+               (long long)opts->fill);
+    } else if (above * 2 <= plain) {
+        printf("  lfp_readahead_open(%s, 0), adaptive\n", top->name);
+    } else {
+        printf("  no readahead, the reads are already record sized\n");
+    }
+
+    if (random_below > random_plain && random_above > random_plain)
+        printf("  readahead does not pay off for random access\n");
+
+    if (average > opts->read)
+        printf("  reads of %lld bytes or more get one record per call\n",
+               (long long)average);
+
+    const int64_t r = runs(top) + (top == bottom ? 0 : runs(bottom));
+    if (r * 4 <= top->n) {
+        printf("  lfp_index_registry_enable(1) if files are reopened, "
+               "%lld runs per file\n",
+               (long long)r);
+    }
+}
+
+static void report(const level* lvl, const options* opts) {
+    const int64_t empty = lvl->n - nonempty(lvl);
+    printf("%s: %lld records (%lld empty or file marks), "
+           "%lld logical bytes, %lld physical bytes\n",
+           lvl->name,
+           (long long)lvl->n,
+           (long long)empty,
+           (long long)logical_size(lvl),
+           (long long)physical_size(lvl));
+
+    histogram(lvl);
+    file_marks(lvl);
+    index_memory(lvl);
+    sequential(lvl, opts);
+}
+
+static int profile(const char* path, const options* opts) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    lfp_protocol* f = lfp_cfile_open_at_offset(fp, opts->zero);
+    if (!f) {
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+
+    level tif = tapeimage_level;
+    level rp = rp66_level;
+    level* top = NULL;
+    level* bottom = NULL;
+    int err = LFP_OK;
+
+    if (opts->tapeimage) {
+        lfp_protocol* outer = lfp_tapeimage_open(f);
+        err = LFP_RUNTIME_ERROR;
+        if (!outer) goto fail;
+        f = outer;
+        err = chase(f, &tif);
+        if (err != LFP_OK) goto fail;
+        top = bottom = &tif;
+    }
+
+    if (opts->rp66) {
+        lfp_protocol* outer = lfp_rp66_open(f);
+        err = LFP_RUNTIME_ERROR;
+        if (!outer) goto fail;
+        f = outer;
+        err = chase(f, &rp);
+        if (err != LFP_OK) goto fail;
+        top = &rp;
+        if (!bottom) bottom = &rp;
+    }
+
+    printf("%s\n", path);
+    if (bottom != top)
+        report(bottom, opts);
+    report(top, opts);
+    recommend(top, bottom, opts);
+
+    free(tif.records);
+    free(rp.records);
+    lfp_close(f);
+    return EXIT_SUCCESS;
+
+fail:
+    fprintf(stderr, "%s: error %d: %s\n", path, err, lfp_errormsg(f));
+    free(tif.records);
+    free(rp.records);
+    lfp_close(f);
+    return EXIT_FAILURE;
+}
+
+static void usage(void) {
+    fputs("usage: layout-profile [-t] [-r] [-z ZERO] [-b BYTES] [-w BYTES] "
+          "FILE...\n",
+          stderr);
+    exit(EXIT_FAILURE);
+}
+
+int main(int args, char** argv) {
+    options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.read = 4096;
+    opts.fill = 65536;
+
+    int i = 1;
+    for (; i < args && argv[i][0] == '-'; ++i) {
+        const char* opt = argv[i];
+        if (strcmp(opt, "-t") == 0) {
+            opts.tapeimage = 1;
+        } else if (strcmp(opt, "-r") == 0) {
+            opts.rp66 = 1;
+        } else if (strcmp(opt, "-z") == 0 && i + 1 < args) {
+            opts.zero = atoll(argv[++i]);
+        } else if (strcmp(opt, "-b") == 0 && i + 1 < args) {
+            opts.read = atoll(argv[++i]);
+        } else if (strcmp(opt, "-w") == 0 && i + 1 < args) {
+            opts.fill = atoll(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+
+    if (i == args || opts.read <= 0 || opts.fill <= 0)
+        usage();
+
+    if (!opts.tapeimage && !opts.rp66)
+        opts.tapeimage = 1;
+
+    int failures = 0;
+    for (; i < args; ++i)
+        failures += profile(argv[i], &opts) != EXIT_SUCCESS;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,558 @@
+#ifndef LFP_ASYNC_HPP
+#define LFP_ASYNC_HPP
+
+/** \file async.hpp
+ *
+ * Coroutine interface to lfp. This header is optional, and requires C++20
+ * coroutines. The library itself does not depend on it, so it can be used
+ * with an lfp built in C++11 mode.
+ */
+
+#if defined(__has_include)
+    #if not __has_include(<coroutine>)
+        #error "lfp/async.hpp requires the <coroutine> header"
+    #endif
+#endif
+
+#if not defined(__cpp_impl_coroutine)
+    #error "lfp/async.hpp requires C++20 coroutines"
+#endif
+
+#include <ciso646>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <lfp/lfp.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace async {
+
+/** Where blocking lfp operations run
+ *
+ * None of the leaf protocols in lfp are asynchronous, so an operation that
+ * suspends always runs the blocking call on an executor, and resumes the
+ * awaiting coroutine from there. Operations that are given no executor run
+ * the call immediately and do not suspend at all, which is the right choice
+ * for memfiles and for files that are known to be in the page cache, since it
+ * avoids the thread hop.
+ */
+class executor {
+public:
+    virtual ~executor() = default;
+
+    /** Schedule fn to run, possibly on another thread */
+    virtual void post(std::function< void() > fn) = 0;
+};
+
+/** Executor backed by a fixed number of threads
+ *
+ * Coroutines suspended on operations scheduled on the pool are resumed on one
+ * of its threads. The destructor waits for all posted work to finish.
+ */
+class thread_pool : public executor {
+public:
+    explicit thread_pool(int nthreads = 1) {
+        if (nthreads < 1)
+            nthreads = 1;
+
+        for (int i = 0; i < nthreads; ++i)
+            this->threads.emplace_back([this] { this->work(); });
+    }
+
+    ~thread_pool() override {
+        {
+            std::lock_guard< std::mutex > lock(this->mtx);
+            this->done = true;
+        }
+        this->cv.notify_all();
+        for (auto& t : this->threads)
+            t.join();
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator = (const thread_pool&) = delete;
+
+    void post(std::function< void() > fn) override {
+        {
+            std::lock_guard< std::mutex > lock(this->mtx);
+            this->queue.push_back(std::move(fn));
+        }
+        this->cv.notify_one();
+    }
+
+private:
+    void work() {
+        for (;;) {
+            std::function< void() > fn;
+            {
+                std::unique_lock< std::mutex > lock(this->mtx);
+                this->cv.wait(lock, [this] {
+                    return this->done or not this->queue.empty();
+                });
+
+                if (this->queue.empty())
+                    return;
+
+                fn = std::move(this->queue.front());
+                this->queue.pop_front();
+            }
+            fn();
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque< std::function< void() > > queue;
+    bool done = false;
+    std::vector< std::thread > threads;
+};
+
+namespace detail {
+
+/*
+ * Awaitable that runs fn on the executor, or immediately without suspending
+ * when there is no executor. fn must not throw.
+ */
+template < typename Result, typename Fn >
+class operation {
+public:
+    operation(executor* ex, Fn fn) : ex(ex), fn(std::move(fn)) {}
+
+    bool await_ready() const noexcept (true) {
+        return this->ex == nullptr;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        this->ex->post([this, h] {
+            this->result = this->fn();
+            h.resume();
+        });
+    }
+
+    Result await_resume() {
+        if (not this->ex)
+            return this->fn();
+        return std::move(this->result);
+    }
+
+private:
+    executor* ex;
+    Fn fn;
+    Result result {};
+};
+
+/*
+ * Resume whoever awaits the coroutine when it suspends, or return to the
+ * caller of resume() if there is no-one.
+ */
+struct transfer {
+    bool await_ready() const noexcept (true) { return false; }
+
+    template < typename Promise >
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle< Promise > h) noexcept (true) {
+        auto next = h.promise().continuation;
+        if (next) return next;
+        return std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept (true) {}
+};
+
+struct promise_base {
+    std::suspend_always initial_suspend() const noexcept (true) {
+        return {};
+    }
+
+    transfer final_suspend() const noexcept (true) {
+        return {};
+    }
+
+    void unhandled_exception() noexcept (true) {
+        this->error = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+/*
+ * Eagerly started, self-destroying coroutine, used to bridge sync_wait() to
+ * the awaited task.
+ */
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept (true) { return {}; }
+        std::suspend_never initial_suspend() noexcept (true) { return {}; }
+        std::suspend_never final_suspend() noexcept (true) { return {}; }
+        void return_void() noexcept (true) {}
+        void unhandled_exception() noexcept (true) { std::terminate(); }
+    };
+};
+
+}
+
+/** Lazily started coroutine
+ *
+ * The task does not start running until it is awaited, and resumes the
+ * awaiting coroutine when it completes. Exceptions escaping the coroutine are
+ * re-thrown in the awaiter.
+ */
+template < typename T = void >
+class task;
+
+template < typename T >
+class task {
+public:
+    struct promise_type : detail::promise_base {
+        task get_return_object() noexcept (true) {
+            return task(handle::from_promise(*this));
+        }
+
+        void return_value(T x) {
+            this->value.emplace(std::move(x));
+        }
+
+        std::optional< T > value;
+    };
+
+    using handle = std::coroutine_handle< promise_type >;
+
+    task(task&& other) noexcept (true) :
+        h(std::exchange(other.h, nullptr))
+    {}
+
+    ~task() {
+        if (this->h) this->h.destroy();
+    }
+
+    bool await_ready() const noexcept (true) {
+        return false;
+    }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiter) noexcept (true) {
+        this->h.promise().continuation = awaiter;
+        return this->h;
+    }
+
+    T await_resume() {
+        auto& p = this->h.promise();
+        if (p.error) std::rethrow_exception(p.error);
+        return std::move(*p.value);
+    }
+
+private:
+    explicit task(handle h) : h(h) {}
+    handle h;
+};
+
+template <>
+class task< void > {
+public:
+    struct promise_type : detail::promise_base {
+        task get_return_object() noexcept (true) {
+            return task(handle::from_promise(*this));
+        }
+
+        void return_void() noexcept (true) {}
+    };
+
+    using handle = std::coroutine_handle< promise_type >;
+
+    task(task&& other) noexcept (true) :
+        h(std::exchange(other.h, nullptr))
+    {}
+
+    ~task() {
+        if (this->h) this->h.destroy();
+    }
+
+    bool await_ready() const noexcept (true) {
+        return false;
+    }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiter) noexcept (true) {
+        this->h.promise().continuation = awaiter;
+        return this->h;
+    }
+
+    void await_resume() {
+        auto& p = this->h.promise();
+        if (p.error) std::rethrow_exception(p.error);
+    }
+
+private:
+    explicit task(handle h) : h(h) {}
+    handle h;
+};
+
+/** Run the task to completion, and block the calling thread until it is done
+ *
+ * This is the bridge from synchronous code, and must not be called from a
+ * thread in the pool the task runs its operations on.
+ */
+template < typename T >
+T sync_wait(task< T > t) {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error;
+
+    using value_type = std::conditional_t<
+        std::is_void< T >::value, bool, std::optional< T >
+    >;
+    value_type value {};
+
+    auto run = [&]() -> detail::detached {
+        try {
+            if constexpr (std::is_void< T >::value)
+                co_await std::move(t);
+            else
+                value.emplace(co_await std::move(t));
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        /*
+         * Notify with the lock held, so that sync_wait() cannot return and
+         * destroy the condition variable before notify is done with it
+         */
+        std::lock_guard< std::mutex > lock(mtx);
+        done = true;
+        cv.notify_all();
+    };
+    run();
+
+    std::unique_lock< std::mutex > lock(mtx);
+    cv.wait(lock, [&] { return done; });
+
+    if (error) std::rethrow_exception(error);
+    if constexpr (not std::is_void< T >::value)
+        return std::move(*value);
+}
+
+/** Coroutine that both awaits and yields values
+ *
+ * The consumer awaits `next()`, which resumes the generator and produces a
+ * pointer to the yielded value, or `nullptr` when the generator is exhausted.
+ * The value is owned by the generator and only valid until the next call to
+ * `next()`. Exceptions escaping the generator are re-thrown from `next()`.
+ */
+template < typename T >
+class generator {
+public:
+    struct promise_type : detail::promise_base {
+        generator get_return_object() noexcept (true) {
+            return generator(handle::from_promise(*this));
+        }
+
+        detail::transfer yield_value(T& x) noexcept (true) {
+            this->current = std::addressof(x);
+            return {};
+        }
+
+        detail::transfer yield_value(T&& x) noexcept (true) {
+            this->current = std::addressof(x);
+            return {};
+        }
+
+        void return_void() noexcept (true) {
+            this->current = nullptr;
+        }
+
+        T* current = nullptr;
+    };
+
+    using handle = std::coroutine_handle< promise_type >;
+
+    class next_value {
+    public:
+        explicit next_value(handle h) : h(h) {}
+
+        bool await_ready() const noexcept (true) {
+            return this->h.done();
+        }
+
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<> awaiter) noexcept (true) {
+            this->h.promise().continuation = awaiter;
+            return this->h;
+        }
+
+        T* await_resume() {
+            auto& p = this->h.promise();
+            if (p.error) std::rethrow_exception(std::exchange(p.error, nullptr));
+            if (this->h.done()) return nullptr;
+            return p.current;
+        }
+
+    private:
+        handle h;
+    };
+
+    generator(generator&& other) noexcept (true) :
+        h(std::exchange(other.h, nullptr))
+    {}
+
+    ~generator() {
+        if (this->h) this->h.destroy();
+    }
+
+    next_value next() noexcept (true) {
+        return next_value(this->h);
+    }
+
+private:
+    explicit generator(handle h) : h(h) {}
+    handle h;
+};
+
+/** Result of an asynchronous read, see `lfp_readinto()` */
+struct read_result {
+    int status;
+    std::int64_t nread;
+};
+
+/** Awaitable `lfp_readinto()`
+ *
+ * The read runs on ex, or immediately if ex is `nullptr`. The awaiting
+ * coroutine is resumed with the status and number of bytes read. f and dst
+ * must be kept alive until the read completes.
+ */
+inline auto read(lfp_protocol* f,
+                 void* dst,
+                 std::int64_t len,
+                 executor* ex = nullptr) {
+    auto fn = [f, dst, len] {
+        read_result r { LFP_OK, 0 };
+        r.status = lfp_readinto(f, dst, len, &r.nread);
+        return r;
+    };
+    return detail::operation< read_result, decltype(fn) >(ex, std::move(fn));
+}
+
+/** Awaitable `lfp_seek()`
+ *
+ * The seek runs on ex, or immediately if ex is `nullptr`, and the awaiting
+ * coroutine is resumed with the lfp_status of the seek.
+ */
+inline auto seek(lfp_protocol* f, std::int64_t n, executor* ex = nullptr) {
+    auto fn = [f, n] { return lfp_seek(f, n); };
+    return detail::operation< int, decltype(fn) >(ex, std::move(fn));
+}
+
+/** A record yielded by `records()` */
+struct record {
+    lfp_record info;
+    /** The record body, `info.length` bytes */
+    const unsigned char* data;
+};
+
+/** Asynchronously iterate over all records of f
+ *
+ * f must be a protocol with an index, i.e. tapeimage or rp66, see
+ * `lfp_index_records()`. The file is read from the start in chunks of (at
+ * least) chunksize bytes, and all complete records in a chunk are yielded
+ * without suspending, so the cost of moving to the executor is paid once per
+ * chunk rather than once per record. Records larger than chunksize are
+ * accumulated until complete.
+ *
+ * The record data is only valid until the next record is requested. Errors
+ * are thrown as lfp::error. Inconsistencies that the protocol could recover
+ * from (`LFP_PROTOCOL_TRYRECOVERY`) are not errors.
+ *
+ * f is not owned by the generator, and must outlive it.
+ */
+inline generator< record > records(lfp_protocol* f,
+                                   executor* ex = nullptr,
+                                   std::int64_t chunksize = 1 << 20) {
+    const auto check = [f](int err) {
+        switch (err) {
+            case LFP_OK:
+            case LFP_OKINCOMPLETE:
+            case LFP_EOF:
+            case LFP_PROTOCOL_TRYRECOVERY:
+                return;
+
+            default:
+                throw lfp::error(lfp_status(err), lfp_errormsg(f));
+        }
+    };
+
+    check(co_await seek(f, 0, ex));
+
+    /* buffer holds the logical bytes [base, base + buffer.size()) */
+    std::vector< unsigned char > buffer;
+    std::int64_t base = 0;
+    std::int64_t next = 0;
+    std::vector< lfp_record > recs;
+
+    for (;;) {
+        const auto prev = std::int64_t(buffer.size());
+        buffer.resize(prev + chunksize);
+        const auto r = co_await read(f, buffer.data() + prev, chunksize, ex);
+        check(r.status);
+        buffer.resize(prev + r.nread);
+        const bool eof = lfp_eof(f);
+
+        std::int64_t indexed = 0;
+        check(lfp_index_size(f, &indexed));
+        if (indexed > next) {
+            recs.resize(indexed - next);
+            std::int64_t n = 0;
+            check(lfp_index_records(f, next, indexed - next, recs.data(), &n));
+            recs.resize(n);
+        } else {
+            recs.clear();
+        }
+
+        const auto end = base + std::int64_t(buffer.size());
+        for (const auto& info : recs) {
+            if (info.logical + info.length > end)
+                break;
+
+            co_yield record { info, buffer.data() + (info.logical - base) };
+            next += 1;
+        }
+
+        if (eof)
+            co_return;
+
+        if (r.nread == 0) {
+            const auto msg = "records: no progress reading file, but not at EOF";
+            throw lfp::error(LFP_RUNTIME_ERROR, msg);
+        }
+
+        /*
+         * Drop the bytes of the records already yielded. The start of the
+         * first record that has not been yielded is known only if its header
+         * is read, otherwise everything is consumed.
+         */
+        std::int64_t consumed = end - base;
+        for (const auto& info : recs) {
+            if (info.logical + info.length > end) {
+                consumed = info.logical - base;
+                break;
+            }
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + consumed);
+        base += consumed;
+    }
+}
+
+} }
+
+#endif // LFP_ASYNC_HPP
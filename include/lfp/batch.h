@@ -0,0 +1,106 @@
+#ifndef LFP_BATCH_H
+#define LFP_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lfp/lfp.h>
+
+/** \file batch.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Protocols to stack on top of the file in `lfp_batch_index()`
+ *
+ * The flags can be combined. When both tapeimage and rp66 are requested, the
+ * rp66 protocol is opened on top of the tapeimage protocol, which is the
+ * common layout of DLIS files written to tape images.
+ */
+enum lfp_batch_protocol {
+    LFP_BATCH_TAPEIMAGE = 1 << 0,
+    LFP_BATCH_RP66      = 1 << 1,
+};
+
+/** Options for `lfp_batch_index()` */
+typedef struct lfp_batch_options {
+    /** Combination of lfp_batch_protocol flags */
+    int protocols;
+    /**
+     * Offset in the files to open the protocols at, for example 80 to skip
+     * the Storage Unit Label of a DLIS file
+     */
+    int64_t zero;
+    /** Number of worker threads. If 0, use the number of hardware threads */
+    int nthreads;
+    /**
+     * If not `NULL`, write a sidecar index of the outermost protocol to the
+     * path of the file with this suffix appended
+     */
+    const char* sidecar;
+} lfp_batch_options;
+
+/** Result of indexing a single file with `lfp_batch_index()` */
+typedef struct lfp_batch_result {
+    /** Position of the file in the paths argument */
+    size_t index;
+    const char* path;
+    /**
+     * lfp_status of indexing the file. `LFP_PROTOCOL_TRYRECOVERY` means the
+     * file was indexed, but inconsistencies were found.
+     */
+    int status;
+    /**
+     * Human-readable description of the error, or `NULL`. Only valid for the
+     * duration of the callback.
+     */
+    const char* errmsg;
+    /** Number of records indexed by the outermost protocol */
+    int64_t records;
+    /** Logical size of the outermost protocol */
+    int64_t size;
+} lfp_batch_result;
+
+typedef void (*lfp_batch_callback)(const lfp_batch_result*, void* userdata);
+
+/** Index and validate many files in parallel
+ *
+ * Open every file in paths, stack the protocols described by opts on top of
+ * it, and chase all record headers to build the complete index. This
+ * structurally validates the file without reading any of the record bodies.
+ *
+ * The files are processed on a pool of work-stealing threads, and each thread
+ * reuses its protocol stacks and buffers for all the files it processes, see
+ * `lfp_reopen()`.
+ *
+ * The callback is invoked once for every file, in no particular order, from
+ * the worker threads. Calls to the callback are serialized, so it does not
+ * need to be thread safe. userdata is passed to the callback as-is.
+ *
+ * If `opts->sidecar` is set, the index is written next to each successfully
+ * indexed file. The sidecar file starts with the 8-byte magic `lfpindex`,
+ * followed by a little-endian int64 number of records, and for every record
+ * the little-endian int64 logical, length, base, and type fields of
+ * `lfp_record`.
+ *
+ * \retval LFP_OK All files were processed, see the callback for per-file
+ *                results
+ * \retval LFP_INVALID_ARGS No protocols requested, or negative zero or
+ *                          nthreads
+ * \retval LFP_RUNTIME_ERROR Unable to set up the workers, or some files
+ *                           could not be processed. These files are reported
+ *                           to the callback with this status.
+ */
+LFP_API
+int lfp_batch_index(const char* const* paths,
+                    size_t n,
+                    const lfp_batch_options* opts,
+                    lfp_batch_callback callback,
+                    void* userdata);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_BATCH_H
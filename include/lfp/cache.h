@@ -0,0 +1,54 @@
+#ifndef LFP_CACHE_H
+#define LFP_CACHE_H
+
+#include <lfp/lfp.h>
+
+/** \file cache.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Hot-file cache of logical streams
+ *
+ * Serve frequently read files from a flat copy of their logical stream, i.e.
+ * the bytes as read through f, with all framing (tape marks, visible record
+ * headers) already removed.
+ *
+ * If the cache directory dir holds a copy of the stream of f, f is closed and
+ * the copy is opened through a read-only memory map, which does no header
+ * translation or record hopping at all. Otherwise, a cache layer is returned,
+ * which reads through f as usual. When the cache layer is closed, f is handed
+ * over to a background thread, which materialises the stream in dir in the
+ * batch I/O class, and then closes f. The copy is written to a temporary file,
+ * and only renamed into place when the full stream is read, so other handles
+ * and processes never see a partial copy. If reading f fails or needs
+ * recovery, or the background thread is busy with many other streams, the copy
+ * is abandoned, and made by a later handle instead.
+ *
+ * The memory-mapped copy reports offsets in the original file from
+ * `lfp_ptell()` and `lfp_translate()`, just like f would.
+ *
+ * The copy is identified by the file and the protocols stacked on top of it,
+ * see `lfp_index_registry_enable()`, and a copy of a file that has since been
+ * modified is never used. Stale copies are not removed.
+ *
+ * The memory-mapped copy is a leaf protocol, and has no record index.
+ *
+ * The cache is only available on POSIX systems, and only for files opened
+ * with the cfile protocols. If f can not be identified, or on other systems,
+ * f itself is returned.
+ *
+ * \param f Protocol stack to cache, usually tapeimage or rp66
+ * \param dir Existing directory on fast local storage, e.g. tmpfs or SSD
+ *
+ * \return A protocol that reads the same logical stream as f, or `NULL` if f
+ *         or dir is `NULL`
+ */
+lfp_protocol* lfp_cache_open(lfp_protocol* f, const char* dir);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_CACHE_H
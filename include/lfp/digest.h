@@ -0,0 +1,94 @@
+#ifndef LFP_DIGEST_H
+#define LFP_DIGEST_H
+
+#include <lfp/lfp.h>
+
+/** \file digest.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Checksum the bytes read through a protocol
+ *
+ * The digest protocol is a transparent layer that computes the CRC32C
+ * (Castagnoli) checksum of the bytes read through it, as they are read, so
+ * that content hashes of a file come for free with reading it, rather than
+ * with a separate pass. The checksum is computed with the SSE4.2 or ARMv8 CRC
+ * instructions when the CPU has them, and with tables otherwise.
+ *
+ * Like any other protocol, the digest layer can be stacked at any level. On
+ * top of tapeimage or rp66 it checksums the logical file, and below them it
+ * checksums the file as stored on disk.
+ *
+ * The digest covers the stream from the position of f when the digest
+ * protocol is opened, or from zero if f does not support `lfp_tell()`, up to
+ * the first byte that has not been read yet, so the digest protocol can be
+ * put in with `lfp_insert_below()` partway through a file. Reads past a seek
+ * forward are not checksummed, until the gap is read, and bytes that are read
+ * again are not checksummed twice. In addition to the digest of the stream,
+ * the digest of every block of block bytes is recorded, so that ranges of
+ * files can be compared and deduplicated.
+ *
+ * \param f Underlying protocol
+ * \param block Size of the blocks to record digests for, or 0 to only compute
+ *              the digest of the full stream
+ *
+ * \return The digest protocol, or `NULL` if f is `NULL` or block is negative
+ *
+ * \see lfp_digest_file
+ * \see lfp_digest_blocks
+ */
+lfp_protocol* lfp_digest_open(lfp_protocol* f, int64_t block);
+
+/** Get the digest of the stream read so far
+ *
+ * Get the CRC32C of the first len bytes of the outermost digest protocol in
+ * f, which is either f itself or a protocol below it, counted from where the
+ * digest protocol was opened. The digest is complete when the stream has been
+ * read to the end without gaps.
+ *
+ * The CRC32C is the one used by iSCSI and ext4, and the digest of
+ * "123456789" is 0xE3069283.
+ *
+ * \param f Protocol with a digest protocol in its stack
+ * \param crc Output, the CRC32C of the bytes read so far
+ * \param len Output, the number of bytes checksummed, can be `NULL`
+ *
+ * \retval LFP_OK The digest reaches the end of the stream
+ * \retval LFP_OKINCOMPLETE The digest is of the first len bytes, and the rest
+ *                          of the stream is not read yet
+ * \retval LFP_NOTIMPLEMENTED There is no digest protocol in the stack
+ */
+int lfp_digest_file(lfp_protocol* f, uint32_t* crc, int64_t* len);
+
+/** Copy block digests
+ *
+ * Copy the digests of up to len blocks, starting at block first, into dst.
+ * Block k is the bytes [k * block, (k + 1) * block) counted from where the
+ * digest protocol was opened, where block is the size given to
+ * `lfp_digest_open()`. Only blocks that have been read in full are copied,
+ * except for the last block of a complete stream, which may be shorter. The
+ * number of digests copied is written to n, which can be `NULL`.
+ *
+ * \param f Protocol with a digest protocol in its stack
+ * \param first First block
+ * \param len Number of blocks
+ * \param dst Output, at least len digests
+ * \param n Output, the number of digests copied
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS first or len is negative
+ * \retval LFP_NOTIMPLEMENTED There is no digest protocol in the stack
+ */
+int lfp_digest_blocks(lfp_protocol* f,
+                      int64_t first,
+                      int64_t len,
+                      uint32_t* dst,
+                      int64_t* n);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_DIGEST_H
@@ -163,6 +163,23 @@ enum lfp_status {
     LFP_UNEXPECTED_EOF,
 };
 
+/** Description of an indexed record
+ *
+ * Protocols that segment the underlying handle into records, such as
+ * tapeimage and rp66, describe the records they have indexed with this
+ * struct. See `lfp_index_records()`.
+ */
+typedef struct lfp_record {
+    /** Logical offset of the first byte in the record */
+    int64_t logical;
+    /** Number of (logical) bytes in the record */
+    int64_t length;
+    /** Offset of the record header, as told by the underlying protocol */
+    int64_t base;
+    /** Protocol-specific record type, e.g. the tapemark type for tapeimage */
+    int type;
+} lfp_record;
+
 /** \defgroup public-functions Functions */
 /** \addtogroup public-functions
  * @{
@@ -215,6 +232,33 @@ int lfp_readinto(lfp_protocol*, void* dst, int64_t len, int64_t* nread);
 LFP_API
 int lfp_seek(lfp_protocol*, int64_t n);
 
+/** Seek in bounded steps
+ *
+ * Make progress towards `lfp_seek(f, n)`, but read at most max_headers headers
+ * from the underlying file. A seek past the end of the index of the tapeimage
+ * or rp66 protocols must read every header between the end of the index and
+ * n, which can take seconds on large files. Cooperative schedulers and event
+ * loops can instead call this repeatedly with the same n, and do other work
+ * between the steps, until it returns `LFP_OK`. The headers read are added to
+ * the index, so no work is repeated.
+ *
+ * When `LFP_OKINCOMPLETE` is returned, the position is valid, but unspecified
+ * and at or before n. Seeking inside the index is done in one step, and
+ * protocols without headers always complete the seek in one step.
+ *
+ * \param n byte offset to seek to, must not be negative
+ * \param max_headers Maximum number of headers to read, >= 1
+ *
+ * \retval LFP_OK The seek is complete
+ * \retval LFP_OKINCOMPLETE More steps are needed
+ * \retval LFP_INVALID_ARGS n is negative, or max_headers < 1
+ * \retval LFP_NOTIMPLEMENTED Layer does not support seek
+ *
+ * \see lfp_seek
+ */
+LFP_API
+int lfp_seek_step(lfp_protocol*, int64_t n, int64_t max_headers);
+
 /** Get current position
  *
  * Obtain the current logical value of the file position. The value is
@@ -274,6 +318,234 @@ int lfp_peel(lfp_protocol* outer, lfp_protocol** inner);
 LFP_API
 int lfp_peek(lfp_protocol* outer, lfp_protocol** inner);
 
+/** Reuse the protocol for a different underlying protocol
+ *
+ * Replace the underlying protocol of outer with inner, and reset outer to the
+ * state it would have if it was just opened on inner. The previous underlying
+ * protocol is closed. This is similar to closing outer and opening a new
+ * protocol on inner, but memory allocated by outer, such as indices, is kept
+ * and reused.
+ *
+ * On success, outer takes ownership of inner. If `lfp_reopen()` fails,
+ * ownership of inner is *not* taken, and inner must still be closed by the
+ * caller. Like `lfp_peel()`, reopen is not supported for leaf protocols.
+ *
+ * \param outer Protocol to reuse
+ * \param inner New underlying protocol
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_LEAF_PROTOCOL Leaf protocols does not support reopen
+ * \retval LFP_NOTIMPLEMENTED Layer does not support reopen
+ */
+LFP_API
+int lfp_reopen(lfp_protocol* outer, lfp_protocol* inner);
+
+/** Restore a consistent state after a read or seek error
+ *
+ * When an operation fails because the underlying file failed, e.g. with a
+ * transient `LFP_IOERROR` from a network file system, the protocol stack is
+ * left in an unreliable state. Recover puts every layer back at the last good
+ * position, which is the position after the bytes that were successfully
+ * read, so that the failed operation can be retried. Unlike re-opening the
+ * file, indices already built are kept.
+ *
+ * After a failed seek, the position is wherever the seek got to before the
+ * error, and the seek should be retried. Recover does not repair corrupt
+ * files, and operations that failed because of a protocol error will fail
+ * again.
+ *
+ * \retval LFP_OK Success, the protocol is at lfp_tell()
+ * \retval LFP_NOTIMPLEMENTED Layer does not support recover
+ * \return Errors from restoring the underlying protocol
+ */
+LFP_API
+int lfp_recover(lfp_protocol*);
+
+/** Layer constructor for `lfp_insert_below()`
+ *
+ * Called with the protocol to put the new layer on, and the userdata passed
+ * to `lfp_insert_below()`. On success, the returned layer owns inner. Return
+ * `NULL` on failure, in which case ownership of inner must not be taken.
+ */
+typedef lfp_protocol* (*lfp_layer_factory)(lfp_protocol* inner,
+                                           void* userdata);
+
+/** Insert a new layer beneath an open protocol
+ *
+ * Put a new layer, such as the readahead, retry or digest protocol, between
+ * outer and its underlying protocol, without closing or resetting outer. The
+ * layer is made by calling factory on the underlying protocol, and replaces
+ * it as the underlying protocol of outer. Everything else in outer is kept as
+ * is, so tapeimage and rp66 keep their index and position, and reading
+ * continues where it left off.
+ *
+ * The layer must present the same stream as the protocol it is put on, and
+ * start at its current position. The pass-through protocols in lfp all do.
+ * Like `lfp_peel()`, this is not supported for leaf protocols, which have
+ * nothing beneath them.
+ *
+ * \param outer Protocol to insert the layer beneath
+ * \param factory Makes the new layer from the underlying protocol of outer
+ * \param userdata Passed as-is to factory
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS factory is `NULL`
+ * \retval LFP_LEAF_PROTOCOL Leaf protocols does not support insert_below
+ * \retval LFP_NOTIMPLEMENTED Layer does not support insert_below
+ * \retval LFP_RUNTIME_ERROR factory returned `NULL`. outer is unchanged.
+ */
+LFP_API
+int lfp_insert_below(lfp_protocol* outer,
+                     lfp_layer_factory factory,
+                     void* userdata);
+
+/** Get the number of indexed records
+ *
+ * Protocols that segment the file into records build an index of the records
+ * as they are read or seeked past. This function reports the number of
+ * records indexed so far, which is not necessarily all records in the file.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_NOTIMPLEMENTED Layer does not have a record index
+ */
+LFP_API
+int lfp_index_size(lfp_protocol*, int64_t* n);
+
+/** Copy records from the index
+ *
+ * Copy up to len records, starting at record first, from the index into dst.
+ * The number of records copied is written to n. n can be `NULL`. Copying
+ * records past the end of the index is not an error, but copies fewer (or
+ * zero) records.
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS first or len is negative
+ * \retval LFP_NOTIMPLEMENTED Layer does not have a record index
+ */
+LFP_API
+int lfp_index_records(lfp_protocol*,
+                      int64_t first,
+                      int64_t len,
+                      lfp_record* dst,
+                      int64_t* n);
+
+/** Translate logical offsets to physical offsets
+ *
+ * Write the physical offset of every logical offset in logical to physical,
+ * i.e. the offset in the file of the byte at that logical offset. This is what
+ * `lfp_ptell()` reports after `lfp_seek()` to an offset that is already
+ * indexed, while a seek to the start of a record that is not yet indexed may
+ * stop before the record header. Translating is much faster than seeking to
+ * every offset, as it only uses the record indices and address maps of the
+ * protocols, and does not touch the file for offsets that are already
+ * indexed. The offsets must be sorted in ascending order, which makes the
+ * translation a single walk through the index.
+ *
+ * Offsets past the index are indexed first, by reading the headers up to the
+ * last offset. The position of the protocol is the same after the function
+ * returns, also when it fails. The end of the file translates to the end of
+ * the last record with data, but offsets past it can not be translated.
+ *
+ * logical and physical can be the same array.
+ *
+ * \param logical Sorted logical offsets
+ * \param physical Output, the physical offsets
+ * \param n Number of offsets
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS The offsets are negative, not sorted, or past the
+ *                          end of the file
+ * \retval LFP_NOTIMPLEMENTED A layer in the stack does not support translate
+ * \return Errors from reading the headers of records not yet indexed
+ */
+LFP_API
+int lfp_translate(lfp_protocol*,
+                  const int64_t* logical,
+                  int64_t* physical,
+                  size_t n);
+
+/** Share record indices between handles of the same file
+ *
+ * When enabled, the tapeimage and rp66 protocols publish their record index
+ * to a process-wide registry. The index is identified by the device, inode,
+ * size and modification time of the underlying file, the protocols in the
+ * stack, and the offsets they were opened at. A protocol opened on a file
+ * with a published index starts with a copy of it, and consults the registry
+ * again before chasing headers past the end of its own index, so that headers
+ * are only read from disk once per process.
+ *
+ * Indices are published when a protocol is closed, and when it has indexed
+ * the whole file. Handles do not share a live index, but a handle picks up
+ * indices published after it was opened the next time it seeks past the end
+ * of its own index.
+ *
+ * Only files opened with the cfile protocols can be identified, and the
+ * registry is not used for other leaf protocols, or on Windows. Indices with
+ * inconsistencies that the tapeimage protocol recovered from are never
+ * published. The registry holds the 64 most recently published indices, and
+ * is disabled by default.
+ *
+ * This does not return a status code.
+ *
+ * \param enable Non-zero to enable the registry, zero to disable it
+ */
+LFP_API
+void lfp_index_registry_enable(int enable);
+
+/** Drop all indices published to the registry
+ *
+ * \see lfp_index_registry_enable
+ */
+LFP_API
+void lfp_index_registry_clear(void);
+
+/** Record visitor for `lfp_foreach_record()`
+ *
+ * Called with the record description, a pointer to the length bytes of the
+ * record, and the userdata passed to `lfp_foreach_record()`. The data is owned
+ * by lfp, and must not be used after the visitor (or, if set, the completion
+ * callback of the same record) returns.
+ *
+ * Return 0 to continue, and non-zero to stop the iteration.
+ */
+typedef int (*lfp_record_visitor)(const lfp_record* record,
+                                  const void* data,
+                                  void* userdata);
+
+/** Visit every record in parallel
+ *
+ * Read the file from the start, sequentially and in large blocks, and call
+ * visit for every record with a pointer to its data in lfp's read buffer. With
+ * nthreads > 0, visit is called concurrently from a pool of nthreads worker
+ * threads while the calling thread keeps reading, and records can be visited
+ * in any order. With nthreads == 0, all records are visited in order on the
+ * calling thread.
+ *
+ * If complete is not `NULL`, it is called for every record after visit, in
+ * record order, and never concurrently. This is useful when the result of the
+ * (parallel) processing in visit must be consumed in order.
+ *
+ * The protocol must not be used by anything else until this function returns,
+ * and is left at end-of-file.
+ *
+ * \param visit Visitor, called for every record
+ * \param complete Visitor called in record order, or `NULL`
+ * \param userdata Passed as-is to visit and complete
+ * \param nthreads Number of worker threads, or 0 to visit on calling thread
+ *
+ * \retval LFP_OK All records were visited
+ * \retval LFP_NOTIMPLEMENTED Layer does not have a record index
+ * \retval LFP_INVALID_ARGS nthreads is negative
+ * \return If a visitor returns non-zero, the iteration is stopped and that
+ *         value is returned. Otherwise, errors from reading the file.
+ */
+LFP_API
+int lfp_foreach_record(lfp_protocol*,
+                       lfp_record_visitor visit,
+                       lfp_record_visitor complete,
+                       void* userdata,
+                       int nthreads);
+
 /** Checks if the end of file is reached
  *
  * This does not return a `lfp_status` code.
@@ -338,6 +610,42 @@ lfp_protocol* lfp_cfile(FILE*);
 LFP_API
 lfp_protocol* lfp_cfile_open_at_offset(FILE*, int64_t zero);
 
+/** Lazy C FILE protocol
+ *
+ * This protocol behaves like `lfp_cfile_open_at_offset()`, but opens the file
+ * at path itself, and does not hold on to the `FILE`. Open files are kept in a
+ * process-wide cache of descriptors, and when the cache is full the least
+ * recently used file is closed. The next operation on the evicted handle
+ * transparently re-opens the file and restores its position.
+ *
+ * This is useful when a process needs to keep more handles (and the indices
+ * of the protocols stacked on top of them) alive than it is allowed to have
+ * open files. The file is assumed not to change while the handle is alive.
+ *
+ * The cache is thread safe, but like any other handle, a single lazy cfile
+ * must not be used from multiple threads at the same time.
+ *
+ * \param path Path of the file to open
+ * \param zero Absolute offset to be considered as zero
+ *
+ * \return `NULL` if the file can not be opened
+ *
+ * \see lfp_cfile_lazy_capacity
+ */
+LFP_API
+lfp_protocol* lfp_cfile_open_lazy(const char* path, int64_t zero);
+
+/** Set the number of files kept open by lazy cfiles
+ *
+ * Set the capacity of the process-wide descriptor cache used by
+ * `lfp_cfile_open_lazy()`. Shrinking the cache closes the least recently used
+ * files immediately. The capacity is always at least 1, and defaults to 128.
+ *
+ * This does not return a status code.
+ */
+LFP_API
+void lfp_cfile_lazy_capacity(size_t n);
+
 #if (__cplusplus)
 } // extern "C"
 #endif
@@ -0,0 +1,72 @@
+#ifndef LFP_MAP_H
+#define LFP_MAP_H
+
+#include <lfp/lfp.h>
+
+/** \file map.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Map the logical stream into memory
+ *
+ * \warning This function is experimental, and only available on Linux.
+ *
+ * Reserve a contiguous, read-only range of virtual memory for the full
+ * logical stream of f, so that the stream can be accessed at random through a
+ * plain pointer. No bytes are read up front. Instead, pages are populated on
+ * first access through userfaultfd(2), by a thread that seeks and reads f, so
+ * the record index of tapeimage and rp66 is used to find the payload bytes.
+ * Accessing one byte populates the 64 KiB from the start of its page and
+ * onwards, so sequential access faults once per window.
+ *
+ * The length of the stream is found by chasing all the headers of f, the same
+ * way as `lfp_batch_index()` does, so f must have a record index, i.e. be a
+ * tapeimage or rp66 protocol, or a protocol on top of one.
+ *
+ * f is owned by the mapping until it is unmapped, and must not be used or
+ * closed in the meantime. Errors when reading f can not be reported on access;
+ * the affected pages read as zero instead, and the error is reported by
+ * `lfp_unmap_logical()`.
+ *
+ * The kernel can not populate pages on behalf of system calls, so passing a
+ * range of the mapping that has not been accessed yet to e.g. write(2) may
+ * fail with EFAULT.
+ *
+ * If the stream is empty, ptr is set to `NULL` and len to zero.
+ *
+ * \param f Protocol to map
+ * \param ptr Output, the start of the mapping
+ * \param len Output, the length of the stream
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_NOTSUPPORTED Not on Linux, or userfaultfd is not available
+ * \retval LFP_NOTIMPLEMENTED f does not have a record index
+ *
+ * \see lfp_unmap_logical
+ */
+LFP_API
+int lfp_map_logical(lfp_protocol* f, void** ptr, int64_t* len);
+
+/** Unmap the logical stream
+ *
+ * Unmap a stream mapped by `lfp_map_logical()`, after which the protocol can
+ * be used again. Unmapping `NULL` does nothing.
+ *
+ * \param ptr Start of the mapping
+ *
+ * \retval LFP_OK Success
+ * \retval LFP_INVALID_ARGS ptr is not the start of a mapping
+ * \retval LFP_IOERROR (and other errors) Reading the protocol failed when
+ *                     populating a page. The message is available with
+ *                     `lfp_errormsg()` on the protocol.
+ */
+LFP_API
+int lfp_unmap_logical(void* ptr);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_MAP_H
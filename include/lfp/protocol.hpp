@@ -13,6 +13,8 @@
 
 /** \file protocol.hpp */
 
+namespace lfp { class unique_lfp; }
+
 /**
  * The functions of this class roughly correspond to the public interface in
  * lfp.h, but with C++-isms. Since it is not exposed in the ABI except through
@@ -62,6 +64,19 @@ public:
      * `LFP_NOTIMPLEMENTED`.
      */
     virtual void seek(std::int64_t) noexcept (false);
+
+    /** \copybrief lfp_seek_step
+     *
+     * Make progress towards seek(n), but read at most max_headers headers (or
+     * other framing) from the underlying protocol. Return `LFP_OK` when the
+     * seek is complete, and `LFP_OKINCOMPLETE` when the budget is spent,
+     * leaving the protocol at a valid position at or before n.
+     *
+     * If this is not implemented, it calls seek(n) and returns `LFP_OK`,
+     * which is right for protocols where seek does not read anything.
+     */
+    virtual lfp_status seek_step(std::int64_t n, std::int64_t max_headers)
+        noexcept (false);
     /** \copybrief lfp_tell
      *
      * If this is not implemented, `lfp_tell()` will always return
@@ -90,6 +105,92 @@ public:
      */
     virtual lfp_protocol* peek() const noexcept (false) = 0;
 
+    /** \copybrief lfp_reopen
+     *
+     * Replace the underlying protocol with inner, and reset all state to as if
+     * the protocol was just opened on inner. Allocated resources, such as the
+     * index, should be kept for reuse. If this throws, the protocol must not
+     * have taken ownership of inner.
+     *
+     * If this is not implemented, `lfp_reopen()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual void reopen(lfp_protocol* inner) noexcept (false);
+
+    /** \copybrief lfp_insert_below
+     *
+     * Call factory on the underlying protocol, and replace the underlying
+     * protocol with the returned layer, which owns it. All other state, such
+     * as the index and position, must be kept. If factory returns `NULL`,
+     * this must throw, and leave the protocol unchanged.
+     *
+     * If this is not implemented, `lfp_insert_below()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual void insert_below(lfp_layer_factory factory, void* userdata)
+        noexcept (false);
+
+    /** \copybrief lfp_recover
+     *
+     * Put the protocol, and all protocols under it, back at the position
+     * reported by tell(). This must not touch the index, and must not assume
+     * that the underlying protocol is at any particular position.
+     *
+     * If this is not implemented, `lfp_recover()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual void recover() noexcept (false);
+
+    /** Identity of the file and protocol stack
+     *
+     * A string that identifies both the underlying file and how this
+     * protocol, and all protocols under it, are set up. Protocols with the
+     * same identity present the same bytes, and can share caches such as
+     * indices.
+     *
+     * Leaf protocols that can identify their file should implement this, and
+     * layers should extend the identity of the underlying protocol with their
+     * own name and offsets. If this is not implemented, nothing is shared.
+     */
+    virtual std::string identity() const noexcept (false);
+
+    /** \copybrief lfp_index_size
+     *
+     * If this is not implemented, `lfp_index_size()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual std::int64_t index_size() const noexcept (false);
+
+    /** \copybrief lfp_index_records
+     *
+     * Copy the records [first, first + len) into dst, clamped to the size of
+     * the index, and return the number of records copied.
+     *
+     * If this is not implemented, `lfp_index_records()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual std::int64_t index_records(
+            std::int64_t first,
+            std::int64_t len,
+            lfp_record* dst)
+        const noexcept (false);
+
+    /** \copybrief lfp_translate
+     *
+     * Write the ptell() after seek(logical[i]) to physical[i], for the n
+     * offsets, which are sorted and non-negative. Protocols that translate
+     * to offsets in the underlying protocol should pass them on to translate()
+     * of the underlying protocol. This must not change tell().
+     *
+     * If this is not implemented, `lfp_translate()` will return
+     * `LFP_NOTIMPLEMENTED`.
+     */
+    virtual void translate(
+            const std::int64_t* logical,
+            std::int64_t* physical,
+            std::int64_t n)
+        noexcept (false);
+
     /** \copybrief lfp_errormsg */
     const char* errmsg() noexcept (true);
 
@@ -98,6 +199,19 @@ public:
 
     virtual ~lfp_protocol() = default;
 
+protected:
+    /** Common implementation of insert_below()
+     *
+     * Call factory on inner, the underlying protocol, and replace inner with
+     * the returned layer, which owns it. If factory returns `NULL`, this
+     * throws and leaves inner unchanged.
+     */
+    static void splice_below(
+            lfp::unique_lfp& inner,
+            lfp_layer_factory factory,
+            void* userdata)
+        noexcept (false);
+
 private:
     std::string error_message;
 };
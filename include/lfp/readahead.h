@@ -0,0 +1,46 @@
+#ifndef LFP_READAHEAD_H
+#define LFP_READAHEAD_H
+
+#include <lfp/lfp.h>
+
+/** \file readahead.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Buffer reads, and read ahead
+ *
+ * The readahead protocol serves small reads from a buffer, which is filled
+ * with large reads from f. It is typically put on top of tapeimage or rp66,
+ * where every read otherwise walks the full protocol stack, which dominates
+ * the cost of reading many small records. Reads larger than the buffer bypass
+ * it, and seeks within the buffer do not touch f at all.
+ *
+ * With a fixed size, every fill reads size bytes.
+ *
+ * In adaptive mode, i.e. when size is 0, the fill size is learned from how
+ * the buffer is used. It is doubled when a fill was consumed in full and the
+ * reads continue where it ended, and halved when most of a fill is discarded
+ * by seeking elsewhere, within 4 KiB to 4 MiB. When f has a record index, the
+ * fill ends at the record boundary nearest to the fill size, so that fills
+ * cover an integral number of records. The sizes of records not indexed yet
+ * are estimated from the last ones indexed. Small records are read many at a
+ * time, while fills are never grown past one record for records of 64 KiB or
+ * more, as f reads such records one at a time anyway. Records much larger
+ * than the fill size are read in parts, until a sequential streak has grown
+ * the fill size to cover them.
+ *
+ * \param f Underlying protocol
+ * \param size Bytes per fill, or 0 for adaptive readahead
+ *
+ * \return The readahead protocol, or `NULL` if f is `NULL` or size is
+ *         negative
+ */
+lfp_protocol* lfp_readahead_open(lfp_protocol* f, int64_t size);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_READAHEAD_H
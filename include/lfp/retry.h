@@ -0,0 +1,41 @@
+#ifndef LFP_RETRY_H
+#define LFP_RETRY_H
+
+#include <lfp/lfp.h>
+
+/** \file retry.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Retry transient errors
+ *
+ * The retry protocol is a transparent layer that retries reads and seeks that
+ * fail with `LFP_IOERROR`, which is what the cfile protocol reports for
+ * failing reads, and what network and custom leaf protocols typically report
+ * for timeouts and other transient errors.
+ *
+ * Before every retry, the underlying protocol is restored with
+ * `lfp_recover()`, which keeps already built indices, and the protocol waits.
+ * The first wait is delay milliseconds, and the wait is doubled for every
+ * subsequent attempt. If all attempts fail, the last error is reported as
+ * usual. Other errors, such as corrupt files, are never retried.
+ *
+ * A read that fails after some bytes were read continues from where it
+ * failed, so the underlying protocol must support `lfp_tell()`.
+ *
+ * \param f Underlying protocol
+ * \param attempts Maximum number of retries for every operation
+ * \param delay Milliseconds to wait before the first retry
+ *
+ * \return The retry protocol, or `NULL` if f is `NULL`, or attempts or delay
+ *         is negative
+ */
+lfp_protocol* lfp_retry_open(lfp_protocol* f, int attempts, int delay);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_RETRY_H
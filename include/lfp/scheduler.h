@@ -0,0 +1,81 @@
+#ifndef LFP_SCHEDULER_H
+#define LFP_SCHEDULER_H
+
+#include <lfp/lfp.h>
+
+/** \file scheduler.h */
+
+#if (__cplusplus)
+extern "C" {
+#endif
+
+/** Priority classes of the I/O scheduler
+ *
+ * \see lfp_scheduler_set_class
+ */
+enum lfp_ioclass {
+    /** Latency sensitive reads, e.g. a user's seek and read of a frame */
+    LFP_IOCLASS_INTERACTIVE = 0,
+    /** Throughput oriented reads, e.g. full-file scans and indexing jobs */
+    LFP_IOCLASS_BATCH       = 1,
+};
+
+/** Route reads from the cfile leaves through a process-wide I/O scheduler
+ *
+ * When enabled, every read from the cfile protocols in the process is queued
+ * in the scheduler, and at most slots reads are in flight at the same time.
+ * Queued reads are dispatched by start-time fair queuing: every priority class
+ * gets a share of the bandwidth proportional to its weight, and a class that
+ * has been idle goes to the front of the queue, regardless of how much the
+ * other classes have queued. Large reads are split into quanta of 256 KiB,
+ * so a full-file scan can never hold a slot for longer than it takes to read
+ * one quantum.
+ *
+ * The class of a read is the class of the thread issuing it, see
+ * `lfp_scheduler_set_class()`.
+ *
+ * The scheduler is disabled by default, and reads are issued directly.
+ *
+ * \param slots Number of reads in flight at the same time, or 0 to disable
+ *              the scheduler
+ *
+ * \retval LFP_OK
+ * \retval LFP_INVALID_ARGS slots is negative
+ */
+LFP_API
+int lfp_scheduler_enable(int slots);
+
+/** Set the bandwidth share of a priority class
+ *
+ * When both classes have reads queued, a class with weight w gets w / total
+ * of the bandwidth. The default weights are 4 for LFP_IOCLASS_INTERACTIVE and
+ * 1 for LFP_IOCLASS_BATCH.
+ *
+ * \param ioclass A lfp_ioclass
+ * \param weight Share of the bandwidth, >= 1
+ *
+ * \retval LFP_OK
+ * \retval LFP_INVALID_ARGS unknown ioclass, or weight < 1
+ */
+LFP_API
+int lfp_scheduler_share(int ioclass, int weight);
+
+/** Set the priority class of reads issued by the calling thread
+ *
+ * Threads start in LFP_IOCLASS_INTERACTIVE. The worker threads of
+ * `lfp_batch_index()` inherit the class of the calling thread, and the
+ * background copy of `lfp_cache_open()` always reads in LFP_IOCLASS_BATCH.
+ *
+ * \param ioclass A lfp_ioclass
+ *
+ * \retval LFP_OK
+ * \retval LFP_INVALID_ARGS unknown ioclass
+ */
+LFP_API
+int lfp_scheduler_set_class(int ioclass);
+
+#if (__cplusplus)
+} // extern "C"
+#endif
+
+#endif // LFP_SCHEDULER_H
@@ -0,0 +1,471 @@
+#include <algorithm>
+#include <cerrno>
+#include <ciso646>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <lfp/batch.h>
+#include <lfp/lfp.h>
+#include <lfp/protocol.hpp>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "scheduler.hpp"
+
+namespace lfp { namespace {
+
+/*
+ * Work-stealing distribution of the file indices [0, n) over a set of
+ * workers.
+ *
+ * Every worker starts out with a contiguous range of the files, and takes
+ * work from the front of its own range. When a worker runs out of work, it
+ * steals the back half of the largest remaining range of another worker.
+ * Work is never added, only moved, so when a worker finds all other ranges
+ * empty it can retire.
+ */
+class work_ranges {
+public:
+    work_ranges(std::size_t n, int workers);
+
+    /*
+     * Get the next file for worker, stealing if necessary. Returns false when
+     * there is no more work.
+     */
+    bool next(int worker, std::size_t& i) noexcept (true);
+
+private:
+    struct range {
+        std::mutex mtx;
+        std::size_t begin = 0;
+        std::size_t end   = 0;
+    };
+
+    bool steal(int worker) noexcept (true);
+
+    std::vector< std::unique_ptr< range > > ranges;
+};
+
+work_ranges::work_ranges(std::size_t n, int workers) {
+    for (int i = 0; i < workers; ++i) {
+        std::unique_ptr< range > r(new range());
+        r->begin = (n * i) / workers;
+        r->end   = (n * (i + 1)) / workers;
+        this->ranges.push_back(std::move(r));
+    }
+}
+
+bool work_ranges::next(int worker, std::size_t& i) noexcept (true) {
+    auto& own = *this->ranges[worker];
+    do {
+        std::lock_guard< std::mutex > lock(own.mtx);
+        if (own.begin < own.end) {
+            i = own.begin++;
+            return true;
+        }
+    } while (this->steal(worker));
+
+    return false;
+}
+
+bool work_ranges::steal(int worker) noexcept (true) {
+    const auto workers = int(this->ranges.size());
+
+    /*
+     * Pick the victim with the most work left. The sizes are only hints, as
+     * they are read without holding the locks for very long, and the victim
+     * is checked again when it's locked.
+     */
+    int victim = -1;
+    std::size_t most = 0;
+    for (int i = 1; i < workers; ++i) {
+        const auto candidate = (worker + i) % workers;
+        auto& r = *this->ranges[candidate];
+        std::lock_guard< std::mutex > lock(r.mtx);
+        const auto remaining = r.end - r.begin;
+        if (remaining > most) {
+            most = remaining;
+            victim = candidate;
+        }
+    }
+
+    if (victim == -1)
+        return false;
+
+    std::size_t begin, end;
+    {
+        auto& r = *this->ranges[victim];
+        std::lock_guard< std::mutex > lock(r.mtx);
+        const auto remaining = r.end - r.begin;
+        if (remaining == 0)
+            /* someone else got there first - try again */
+            return true;
+
+        const auto take = (remaining + 1) / 2;
+        end   = r.end;
+        begin = r.end - take;
+        r.end = begin;
+    }
+
+    auto& own = *this->ranges[worker];
+    std::lock_guard< std::mutex > lock(own.mtx);
+    own.begin = begin;
+    own.end   = end;
+    return true;
+}
+
+void put_int64(unsigned char* dst, std::int64_t x) noexcept (true) {
+    const auto u = std::uint64_t(x);
+    for (int i = 0; i < 8; ++i)
+        dst[i] = (u >> (8 * i)) & 0xFF;
+}
+
+/*
+ * A worker reuses its protocol stack and index buffer for all the files it
+ * processes.
+ */
+class worker {
+public:
+    explicit worker(const lfp_batch_options& opts) : opts(opts) {}
+    ~worker();
+
+    void index(const char* path, lfp_batch_result& result) noexcept (true);
+
+    /*
+     * The error message of the last failed file. Kept as a member so that it
+     * outlives the index() call and can be passed to the callback.
+     */
+    std::string errmsg;
+
+private:
+    lfp_protocol* open(const char* path) noexcept (false);
+    void chase(lfp_protocol* outer, lfp_batch_result& result) noexcept (false);
+    void sidecar(const char* path) noexcept (false);
+    void reset() noexcept (true);
+
+    const lfp_batch_options& opts;
+
+    /*
+     * The outermost protocol owns the stack. When rp66 is stacked on
+     * tapeimage, tif is borrowed from rp.
+     */
+    lfp_protocol* outer = nullptr;
+    lfp_protocol* tif = nullptr;
+    lfp_protocol* rp = nullptr;
+
+    std::vector< lfp_record > records;
+    std::vector< unsigned char > buffer;
+};
+
+worker::~worker() {
+    this->reset();
+}
+
+void worker::reset() noexcept (true) {
+    lfp_close(this->outer);
+    this->outer = nullptr;
+    this->tif = nullptr;
+    this->rp = nullptr;
+}
+
+lfp_protocol* worker::open(const char* path) noexcept (false) {
+    std::FILE* fp = std::fopen(path, "rb");
+    if (!fp) {
+        const auto msg = "unable to open {}: {}";
+        throw io_error(fmt::format(msg, path, std::strerror(errno)));
+    }
+
+    lfp_protocol* leaf = lfp_cfile_open_at_offset(fp, this->opts.zero);
+    if (!leaf) {
+        std::fclose(fp);
+        throw runtime_error("unable to create cfile protocol");
+    }
+
+    const bool use_tif = this->opts.protocols & LFP_BATCH_TAPEIMAGE;
+    const bool use_rp  = this->opts.protocols & LFP_BATCH_RP66;
+
+    if (this->outer) {
+        /*
+         * Detach the stack from the outermost protocol before reopening the
+         * inner ones, so that reopening rp66 does not close the tapeimage it
+         * is about to be reopened on.
+         */
+        bool detached = false;
+        try {
+            if (use_tif and use_rp) {
+                this->rp->peel();
+                detached = true;
+            }
+
+            if (use_tif) {
+                this->tif->reopen(leaf);
+                leaf = nullptr;
+            }
+
+            if (use_rp) {
+                this->rp->reopen(use_tif ? this->tif : leaf);
+                leaf = nullptr;
+                detached = false;
+            }
+
+            return this->outer;
+        } catch (...) {
+            /*
+             * The stack is in an unknown state, so start over with a fresh
+             * one for the next file. A failed reopen does not take ownership.
+             */
+            lfp_close(leaf);
+            if (detached)
+                lfp_close(this->tif);
+            this->reset();
+            throw;
+        }
+    }
+
+    lfp_protocol* inner = leaf;
+    if (use_tif) {
+        this->tif = lfp_tapeimage_open(inner);
+        if (!this->tif) {
+            lfp_close(inner);
+            throw runtime_error("unable to create tapeimage protocol");
+        }
+        inner = this->outer = this->tif;
+    }
+
+    if (use_rp) {
+        this->rp = lfp_rp66_open(inner);
+        if (!this->rp) {
+            lfp_close(inner);
+            this->outer = this->tif = nullptr;
+            throw runtime_error("unable to create rp66 protocol");
+        }
+        this->outer = this->rp;
+    }
+
+    return this->outer;
+}
+
+void worker::chase(lfp_protocol* f, lfp_batch_result& result)
+noexcept (false) {
+    /*
+     * Seeking far past the end chases all the headers, and builds the full
+     * index without reading any of the record bodies. The tapeimage protocol
+     * does not support offsets past 4GB.
+     */
+    const bool rp_outer = this->opts.protocols & LFP_BATCH_RP66;
+    const auto end = rp_outer
+                   ? (std::numeric_limits< std::int64_t >::max)() / 2
+                   : std::int64_t((std::numeric_limits< std::uint32_t >::max)());
+    f->seek(end);
+
+    const auto size = f->index_size();
+    this->records.resize(size);
+    f->index_records(0, size, this->records.data());
+
+    /*
+     * The cold seek does not detect truncated files, nor report when the
+     * protocol had to recover from inconsistent headers - read the last byte
+     * of the last non-empty record to get both.
+     */
+    auto last = std::find_if(this->records.rbegin(), this->records.rend(),
+        [] (const lfp_record& rec) noexcept (true) {
+            return rec.length > 0;
+        }
+    );
+
+    std::int64_t nread = 0;
+    unsigned char byte;
+    lfp_status status;
+    if (last == this->records.rend()) {
+        status = f->readinto(&byte, 0, &nread);
+        result.size = 0;
+    } else {
+        const auto logical_end = last->logical + last->length;
+        f->seek(logical_end - 1);
+        status = f->readinto(&byte, 1, &nread);
+        if (status == LFP_EOF and nread == 0) {
+            const auto msg = "file truncated: last record ends at {}";
+            throw unexpected_eof(fmt::format(msg, logical_end));
+        }
+        result.size = logical_end;
+    }
+
+    result.records = size;
+    if (status == LFP_PROTOCOL_TRYRECOVERY) {
+        result.status = status;
+        const char* msg = f->errmsg();
+        if (msg)
+            this->errmsg = msg;
+    }
+}
+
+void worker::sidecar(const char* path) noexcept (false) {
+    const auto dst = std::string(path) + this->opts.sidecar;
+
+    const auto fields = 4;
+    const auto head = 16;
+    this->buffer.resize(head + this->records.size() * fields * 8);
+    std::memcpy(this->buffer.data(), "lfpindex", 8);
+    put_int64(this->buffer.data() + 8, this->records.size());
+
+    auto* p = this->buffer.data() + head;
+    for (const auto& rec : this->records) {
+        put_int64(p + 0,  rec.logical);
+        put_int64(p + 8,  rec.length);
+        put_int64(p + 16, rec.base);
+        put_int64(p + 24, rec.type);
+        p += fields * 8;
+    }
+
+    std::FILE* fp = std::fopen(dst.c_str(), "wb");
+    if (!fp) {
+        const auto msg = "unable to open sidecar {}: {}";
+        throw io_error(fmt::format(msg, dst, std::strerror(errno)));
+    }
+
+    const auto n = std::fwrite(this->buffer.data(), 1, this->buffer.size(), fp);
+    const auto err = std::fclose(fp);
+    if (n != this->buffer.size() or err) {
+        const auto msg = "unable to write sidecar {}";
+        throw io_error(fmt::format(msg, dst));
+    }
+}
+
+void worker::index(const char* path, lfp_batch_result& result) noexcept (true) {
+    result.path    = path;
+    result.status  = LFP_OK;
+    result.errmsg  = nullptr;
+    result.records = 0;
+    result.size    = 0;
+    this->errmsg.clear();
+
+    try {
+        auto* f = this->open(path);
+        this->chase(f, result);
+        if (this->opts.sidecar)
+            this->sidecar(path);
+    } catch (const lfp::error& e) {
+        result.status = e.status();
+        this->errmsg = e.what();
+    } catch (const std::exception& e) {
+        result.status = LFP_UNHANDLED_EXCEPTION;
+        this->errmsg = e.what();
+    } catch (...) {
+        result.status = LFP_UNHANDLED_EXCEPTION;
+        this->errmsg = "Unhandled error that does not derive from std::exception";
+    }
+
+    if (not this->errmsg.empty())
+        result.errmsg = this->errmsg.c_str();
+}
+
+}
+
+}
+
+int lfp_batch_index(const char* const* paths,
+                    std::size_t n,
+                    const lfp_batch_options* opts,
+                    lfp_batch_callback callback,
+                    void* userdata) {
+    if (n == 0)
+        return LFP_OK;
+
+    if (!paths or !opts or !callback)
+        return LFP_INVALID_ARGS;
+
+    const auto known = LFP_BATCH_TAPEIMAGE | LFP_BATCH_RP66;
+    if (!(opts->protocols & known) or (opts->protocols & ~known))
+        return LFP_INVALID_ARGS;
+
+    if (opts->zero < 0 or opts->nthreads < 0)
+        return LFP_INVALID_ARGS;
+
+    auto nthreads = opts->nthreads;
+    if (nthreads == 0)
+        nthreads = (std::max)(1u, std::thread::hardware_concurrency());
+    nthreads = int((std::min)(std::size_t(nthreads), n));
+
+    try {
+        lfp::work_ranges work(n, nthreads);
+        std::mutex callback_mtx;
+        /* set when the callback has been invoked for the file */
+        std::vector< char > reported(n, 0);
+        const auto ioclass = lfp::current_ioclass();
+
+        auto run = [&] (int id) noexcept (true) {
+            lfp::set_ioclass(ioclass);
+            try {
+                lfp::worker w(*opts);
+                lfp_batch_result result;
+                std::size_t i;
+                while (work.next(id, i)) {
+                    result.index = i;
+                    w.index(paths[i], result);
+                    std::lock_guard< std::mutex > lock(callback_mtx);
+                    callback(&result, userdata);
+                    reported[i] = 1;
+                }
+            } catch (...) {
+                /*
+                 * Only allocation failures can end up here. The remaining work
+                 * is stolen by the other workers, unless they have already
+                 * retired.
+                 */
+            }
+        };
+
+        /*
+         * The calling thread is worker 0. If not all threads can be started,
+         * the work they were assigned is stolen by the others.
+         */
+        std::vector< std::thread > threads;
+        for (int id = 1; id < nthreads; ++id) {
+            try {
+                threads.emplace_back(run, id);
+            } catch (const std::system_error&) {
+                break;
+            }
+        }
+
+        run(0);
+        for (auto& t : threads)
+            t.join();
+
+        /*
+         * Report the files that no worker got to, so that the callback is
+         * still invoked once for every file
+         */
+        bool complete = true;
+        lfp_batch_result result;
+        result.status  = LFP_RUNTIME_ERROR;
+        result.errmsg  = "file not processed: worker failed";
+        result.records = 0;
+        result.size    = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (reported[i]) continue;
+            result.index = i;
+            result.path  = paths[i];
+            callback(&result, userdata);
+            complete = false;
+        }
+
+        if (not complete)
+            return LFP_RUNTIME_ERROR;
+
+    } catch (...) {
+        return LFP_RUNTIME_ERROR;
+    }
+
+    return LFP_OK;
+}
@@ -0,0 +1,799 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <ciso646>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if not defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include <lfp/cache.h>
+#include <lfp/protocol.hpp>
+#include <lfp/scheduler.h>
+
+#include "registry.hpp"
+#include "scheduler.hpp"
+
+#if defined(_WIN32)
+
+lfp_protocol* lfp_cache_open(lfp_protocol* f, const char* dir) {
+    if (not f or not dir) return nullptr;
+    return f;
+}
+
+#else
+
+namespace lfp { namespace {
+
+/*
+ * A cache file starts with a header with a magic, the identity of the stream,
+ * the length of the stream and the number of segments. The header is padded
+ * to a multiple of the page size so that the stream itself is page aligned in
+ * the map. The stream is followed by the segment table, which maps the stream
+ * back to the file it was materialised from:
+ *
+ *   "lfpcach2" | identity length | identity | stream length | segments
+ *              | padding | stream | (logical, physical) * segments
+ *
+ * All integers are LE 64-bit.
+ */
+constexpr const char magic[] = "lfpcach2";
+constexpr const std::size_t magic_size = 8;
+
+std::size_t header_size(std::size_t idlen) noexcept (true) {
+    return magic_size + 8 + idlen + 8 + 8;
+}
+
+std::size_t stream_offset(std::size_t idlen) noexcept (true) {
+    const auto page = std::size_t(::sysconf(_SC_PAGESIZE));
+    const auto header = header_size(idlen);
+    return ((header + page - 1) / page) * page;
+}
+
+void put_u64(unsigned char* dst, std::uint64_t x) noexcept (true) {
+    for (int i = 0; i < 8; ++i)
+        dst[i] = (x >> (8 * i)) & 0xFF;
+}
+
+std::uint64_t get_u64(const unsigned char* src) noexcept (true) {
+    std::uint64_t x = 0;
+    for (int i = 0; i < 8; ++i)
+        x |= std::uint64_t(src[i]) << (8 * i);
+    return x;
+}
+
+/*
+ * A run of the stream that is contiguous in the file it was materialised
+ * from, i.e. the bytes from logical onwards are at physical onwards, up to the
+ * start of the next segment.
+ */
+struct segment {
+    std::int64_t logical;
+    std::int64_t physical;
+};
+
+/*
+ * The file name of the cache must be stable between processes and builds, so
+ * std::hash is no good. The full identity is in the file, so collisions are
+ * detected.
+ */
+std::uint64_t fnv1a(const std::string& s) noexcept (true) {
+    std::uint64_t h = 14695981039346656037ULL;
+    for (const auto c : s) {
+        h ^= static_cast< unsigned char >(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+std::string cache_path(const std::string& dir, const std::string& key)
+noexcept (false) {
+    return fmt::format("{}/{:016x}.lfpcache", dir, fnv1a(key));
+}
+
+/*
+ * Read-only memory map of a materialised stream
+ *
+ * The offsets reported by ptell() and translate() are offsets in the file the
+ * stream was materialised from, not in the cache file, so that they can be
+ * used with other handles to the same file.
+ */
+class mapped : public lfp_protocol {
+public:
+    mapped(void* base,
+           std::size_t len,
+           std::size_t offset,
+           std::int64_t size,
+           std::vector< segment > segments,
+           std::string key) :
+        base(base),
+        maplen(len),
+        data(static_cast< const unsigned char* >(base) + offset),
+        size(size),
+        segments(std::move(segments)),
+        key(std::move(key))
+    {}
+
+    ~mapped() override;
+
+    void close() noexcept (true) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (true) override;
+    int eof() const noexcept (true) override;
+
+    void seek(std::int64_t) noexcept (true) override;
+    std::int64_t tell() const noexcept (true) override;
+    std::int64_t ptell() const noexcept (true) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
+
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    void reopen(lfp_protocol*) noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (true) override;
+    std::string identity() const noexcept (false) override;
+
+private:
+    void* base;
+    std::size_t maplen;
+    const unsigned char* data;
+    std::int64_t size;
+    std::int64_t pos = 0;
+    std::vector< segment > segments;
+    std::string key;
+
+    /*
+     * The offset in the original file of the byte at logical offset n
+     */
+    std::int64_t physical(std::int64_t n) const noexcept (true);
+};
+
+mapped::~mapped() {
+    this->close();
+}
+
+void mapped::close() noexcept (true) {
+    if (not this->base) return;
+    ::munmap(this->base, this->maplen);
+    this->base = nullptr;
+}
+
+lfp_status mapped::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (true) {
+    const auto n = (std::max)(std::int64_t(0),
+                              (std::min)(len, this->size - this->pos));
+    std::memcpy(dst, this->data + this->pos, n);
+    this->pos += n;
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == len)
+        return LFP_OK;
+    return LFP_EOF;
+}
+
+int mapped::eof() const noexcept (true) {
+    return this->pos >= this->size;
+}
+
+void mapped::seek(std::int64_t n) noexcept (true) {
+    assert(n >= 0);
+    this->pos = n;
+}
+
+std::int64_t mapped::tell() const noexcept (true) {
+    return this->pos;
+}
+
+std::int64_t mapped::physical(std::int64_t n) const noexcept (true) {
+    /* the first segment always starts at zero, so itr is never begin() */
+    const auto after = [](std::int64_t x, const segment& seg) {
+        return x < seg.logical;
+    };
+    auto itr = std::upper_bound(this->segments.begin(),
+                                this->segments.end(),
+                                n,
+                                after);
+    --itr;
+    return itr->physical + (n - itr->logical);
+}
+
+std::int64_t mapped::ptell() const noexcept (true) {
+    return this->physical(this->pos);
+}
+
+void mapped::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    if (logical[n - 1] > this->size) {
+        const auto msg = "translate: offset (= {}) is past end-of-file";
+        throw invalid_args(fmt::format(msg, logical[n - 1]));
+    }
+
+    for (std::int64_t i = 0; i < n; ++i)
+        physical[i] = this->physical(logical[i]);
+}
+
+lfp_protocol* mapped::peel() noexcept (false) {
+    throw lfp::leaf_protocol("peel: not supported for leaf protocol");
+}
+
+lfp_protocol* mapped::peek() const noexcept (false) {
+    throw lfp::leaf_protocol("peek: not supported for leaf protocol");
+}
+
+void mapped::reopen(lfp_protocol*) noexcept (false) {
+    throw lfp::leaf_protocol("reopen: not supported for leaf protocol");
+}
+
+void mapped::insert_below(lfp_layer_factory, void*) noexcept (false) {
+    throw lfp::leaf_protocol("insert_below: not supported for leaf protocol");
+}
+
+void mapped::recover() noexcept (true) {
+    /* reading memory can't fail, so there is nothing to recover from */
+}
+
+std::string mapped::identity() const noexcept (false) {
+    /* the stream is the same as the one it was materialised from */
+    return this->key;
+}
+
+/*
+ * Map the cache file at path, if it exists and is the materialised stream of
+ * key, or return nullptr.
+ */
+lfp_protocol* open_mapped(const std::string& path, const std::string& key)
+noexcept (true) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat st;
+    const auto offset = stream_offset(key.size());
+    if (::fstat(fd, &st) != 0 or std::size_t(st.st_size) < offset) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    const auto len = std::size_t(st.st_size);
+    void* base = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+        return nullptr;
+
+    const auto* p = static_cast< const unsigned char* >(base);
+    const auto idlen = get_u64(p + magic_size);
+
+    auto valid = std::memcmp(p, magic, magic_size) == 0
+             and idlen == key.size()
+             and std::memcmp(p + magic_size + 8, key.data(), idlen) == 0
+             ;
+
+    /*
+     * The stream length and segment count are only written when the copy is
+     * complete, so the file size must match exactly
+     */
+    std::uint64_t size = 0;
+    std::uint64_t count = 0;
+    if (valid) {
+        size  = get_u64(p + magic_size + 8 + idlen);
+        count = get_u64(p + magic_size + 8 + idlen + 8);
+        const auto available = len - offset;
+        valid = count > 0
+            and size <= available
+            and count <= (available - size) / 16
+            and offset + size + 16 * count == len
+            ;
+    }
+
+    if (not valid) {
+        ::munmap(base, len);
+        return nullptr;
+    }
+
+    try {
+        std::vector< segment > segments(count);
+        const auto* table = p + offset + size;
+        for (std::size_t i = 0; i < segments.size(); ++i) {
+            segments[i].logical  = std::int64_t(get_u64(table + 16 * i));
+            segments[i].physical = std::int64_t(get_u64(table + 16 * i + 8));
+        }
+
+        if (segments.front().logical != 0) {
+            ::munmap(base, len);
+            return nullptr;
+        }
+
+        return new mapped(base,
+                          len,
+                          offset,
+                          std::int64_t(size),
+                          std::move(segments),
+                          key);
+    } catch (...) {
+        ::munmap(base, len);
+        return nullptr;
+    }
+}
+
+/*
+ * Find the segments of the stream of f, which is size bytes long. Physical
+ * offsets increase with the logical offsets, so [a, b] is contiguous in the
+ * file if and only if b and a are b - a bytes apart in the file, and ranges
+ * that are not are split in two until they are. The records of the index are
+ * a good first guess, which only needs splitting if the records span records
+ * in the protocols below.
+ */
+std::vector< segment > contiguous(lfp_protocol* f, std::int64_t size)
+noexcept (false) {
+    std::vector< segment > segments;
+    const auto append = [&segments](std::int64_t logical, std::int64_t phys) {
+        if (not segments.empty()) {
+            const auto& last = segments.back();
+            if (phys - last.physical == logical - last.logical)
+                return;
+        }
+        segments.push_back({ logical, phys });
+    };
+
+    if (size == 0) {
+        const std::int64_t zero = 0;
+        std::int64_t phys = 0;
+        f->translate(&zero, &phys, 1);
+        append(0, phys);
+        return segments;
+    }
+
+    std::vector< std::int64_t > starts(1, 0);
+    try {
+        const auto records = f->index_size();
+        std::vector< lfp_record > buffer(4096);
+        for (std::int64_t i = 0; i < records;) {
+            const auto n = f->index_records(i, buffer.size(), buffer.data());
+            if (n <= 0) break;
+            for (std::int64_t k = 0; k < n; ++k) {
+                const auto& rec = buffer[k];
+                if (rec.length > 0 and rec.logical > starts.back()
+                                   and rec.logical < size)
+                    starts.push_back(rec.logical);
+            }
+            i += n;
+        }
+    } catch (const lfp::error&) {
+        /* no index, so start with the full stream */
+    }
+
+    /* the ranges to check, last on top so they are checked in order */
+    std::vector< std::pair< std::int64_t, std::int64_t > > todo;
+    todo.emplace_back(starts.back(), size);
+    for (auto i = starts.size() - 1; i > 0; --i)
+        todo.emplace_back(starts[i - 1], starts[i]);
+
+    while (not todo.empty()) {
+        const auto lo = todo.back().first;
+        const auto hi = todo.back().second;
+        todo.pop_back();
+
+        const std::int64_t logical[] = { lo, hi - 1 };
+        std::int64_t phys[2];
+        f->translate(logical, phys, 2);
+        if (phys[1] - phys[0] == hi - 1 - lo) {
+            append(lo, phys[0]);
+            continue;
+        }
+
+        const auto mid = lo + (hi - lo) / 2;
+        todo.emplace_back(mid, hi);
+        todo.emplace_back(lo, mid);
+    }
+
+    return segments;
+}
+
+/*
+ * Process-wide materialiser of logical streams
+ *
+ * Cache layers hand over their protocol stack when they are closed, and the
+ * streams are copied one at a time by a background thread in the batch I/O
+ * class. The stack is not used by anything else once it is handed over, so
+ * the copy never waits for, or holds up, reads of other handles.
+ *
+ * At most max_queued stacks wait for the copy, and streams that are already
+ * queued are not queued again. Stacks that are not taken are closed right
+ * away, and the next handle to the file tries again.
+ */
+class copier {
+public:
+    copier() noexcept (true);
+    ~copier();
+
+    /*
+     * Take ownership of f and materialise its stream at path, or return false
+     * if the copy can not be taken on, in which case the caller keeps f.
+     */
+    bool submit(lfp_protocol* f,
+                const std::string& key,
+                const std::string& path) noexcept (true);
+
+private:
+    struct job {
+        lfp_protocol* f;
+        std::string key;
+        std::string path;
+    };
+
+    static constexpr std::size_t max_queued = 16;
+
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::deque< job > queue;
+    /* the keys that are queued or being copied */
+    std::set< std::string > pending;
+    std::atomic< bool > stopped { false };
+    std::thread worker;
+
+    void run() noexcept (true);
+    void materialise(const job&) noexcept (true);
+    bool copy(const job&, std::FILE* out) noexcept (false);
+};
+
+copier::copier() noexcept (true) {
+    /*
+     * The background thread reads through the cfile leaves and publishes
+     * indices when it closes the stacks, so the scheduler and registry must
+     * outlive the copier.
+     */
+    scheduler();
+    registry();
+}
+
+copier::~copier() {
+    {
+        std::lock_guard< std::mutex > lock(this->mtx);
+        this->stopped = true;
+    }
+    this->ready.notify_all();
+    if (this->worker.joinable())
+        this->worker.join();
+
+    /*
+     * The process is exiting, and the stacks that are still queued are left
+     * alone. Closing them could use other process-wide state that is already
+     * gone.
+     */
+}
+
+copier& materialiser() noexcept (true) {
+    static copier instance;
+    return instance;
+}
+
+bool copier::submit(
+        lfp_protocol* f,
+        const std::string& key,
+        const std::string& path)
+noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    if (this->stopped)
+        return false;
+    if (this->queue.size() >= max_queued)
+        return false;
+    if (this->pending.count(key))
+        return false;
+
+    try {
+        if (not this->worker.joinable())
+            this->worker = std::thread([this] { this->run(); });
+
+        this->queue.push_back(job { f, key, path });
+        try {
+            this->pending.insert(key);
+        } catch (...) {
+            this->queue.pop_back();
+            throw;
+        }
+    } catch (...) {
+        return false;
+    }
+
+    this->ready.notify_one();
+    return true;
+}
+
+void copier::run() noexcept (true) {
+    /* the copy must never compete with the reads it is meant to speed up */
+    set_ioclass(LFP_IOCLASS_BATCH);
+
+    while (true) {
+        std::unique_lock< std::mutex > lock(this->mtx);
+        this->ready.wait(lock, [this] {
+            return this->stopped or not this->queue.empty();
+        });
+        if (this->stopped)
+            return;
+
+        const auto next = this->queue.front();
+        this->queue.pop_front();
+        lock.unlock();
+
+        this->materialise(next);
+        if (this->stopped)
+            return;
+
+        lfp_close(next.f);
+        lock.lock();
+        this->pending.erase(next.key);
+    }
+}
+
+void copier::materialise(const job& j) noexcept (true) {
+    /* another process may have put a copy in place already */
+    if (::access(j.path.c_str(), F_OK) == 0)
+        return;
+
+    /*
+     * There is only one copier per process, and it does not copy the same
+     * stream twice at the same time, so the pid makes the name unique
+     */
+    std::string tmp;
+    try {
+        tmp = fmt::format("{}.tmp.{}", j.path, ::getpid());
+    } catch (...) {
+        return;
+    }
+
+    std::FILE* out = std::fopen(tmp.c_str(), "wb");
+    if (not out)
+        return;
+
+    bool ok = false;
+    try {
+        ok = this->copy(j, out);
+    } catch (...) {
+        ok = false;
+    }
+
+    if (std::fclose(out) != 0)
+        ok = false;
+
+    if (ok and std::rename(tmp.c_str(), j.path.c_str()) == 0)
+        return;
+
+    std::remove(tmp.c_str());
+}
+
+bool copier::copy(const job& j, std::FILE* out) noexcept (false) {
+    const auto idlen = j.key.size();
+    std::vector< unsigned char > header(stream_offset(idlen));
+    std::memcpy(header.data(), magic, magic_size);
+    put_u64(header.data() + magic_size, idlen);
+    std::memcpy(header.data() + magic_size + 8, j.key.data(), idlen);
+    if (std::fwrite(header.data(), 1, header.size(), out) != header.size())
+        return false;
+
+    j.f->seek(0);
+
+    std::vector< unsigned char > buffer(1 << 20);
+    std::int64_t size = 0;
+    while (true) {
+        if (this->stopped)
+            return false;
+
+        std::int64_t n = 0;
+        const auto err = j.f->readinto(buffer.data(), buffer.size(), &n);
+        if (std::fwrite(buffer.data(), 1, n, out) != std::size_t(n))
+            return false;
+        size += n;
+
+        if (err == LFP_EOF)
+            break;
+
+        /*
+         * Only cache streams that are read cleanly. Incomplete reads from
+         * non-blocking files, and files in need of recovery, are left alone.
+         */
+        if (err != LFP_OK)
+            return false;
+    }
+
+    /* the full stream is read, so translating does not touch the file */
+    const auto segments = contiguous(j.f, size);
+    std::vector< unsigned char > table(16 * segments.size());
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        put_u64(table.data() + 16 * i,     segments[i].logical);
+        put_u64(table.data() + 16 * i + 8, segments[i].physical);
+    }
+    if (std::fwrite(table.data(), 1, table.size(), out) != table.size())
+        return false;
+
+    unsigned char tail[16];
+    put_u64(tail,     size);
+    put_u64(tail + 8, segments.size());
+    if (std::fseek(out, long(header_size(idlen) - sizeof(tail)), SEEK_SET))
+        return false;
+    return std::fwrite(tail, 1, sizeof(tail), out) == sizeof(tail);
+}
+
+/*
+ * Pass-through layer that hands the underlying protocol over to the
+ * materialiser when it is closed.
+ *
+ * The stream is copied after the user is done with it, from the same stack,
+ * so the copy does not have to share the stack with the user, and reads the
+ * index the user already built.
+ */
+class caching : public lfp_protocol {
+public:
+    caching(lfp_protocol*, std::string key, std::string path);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+    int eof() const noexcept (false) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    lfp_status seek_step(std::int64_t, std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
+
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    std::int64_t index_size() const noexcept (false) override;
+    std::int64_t index_records(std::int64_t, std::int64_t, lfp_record*)
+        const noexcept (false) override;
+
+private:
+    unique_lfp fp;
+    std::string key;
+    std::string path;
+};
+
+caching::caching(lfp_protocol* f, std::string key, std::string path) :
+    fp(f),
+    key(std::move(key)),
+    path(std::move(path))
+{}
+
+void caching::close() noexcept (false) {
+    if (!this->fp) return;
+
+    if (materialiser().submit(this->fp.get(), this->key, this->path)) {
+        this->fp.release();
+        return;
+    }
+
+    this->fp.close();
+}
+
+lfp_status caching::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    return this->fp->readinto(dst, len, bytes_read);
+}
+
+int caching::eof() const noexcept (false) {
+    return this->fp->eof();
+}
+
+void caching::seek(std::int64_t n) noexcept (false) {
+    this->fp->seek(n);
+}
+
+lfp_status caching::seek_step(std::int64_t n, std::int64_t max_headers)
+noexcept (false) {
+    return this->fp->seek_step(n, max_headers);
+}
+
+std::int64_t caching::tell() const noexcept (false) {
+    return this->fp->tell();
+}
+
+std::int64_t caching::ptell() const noexcept (false) {
+    return this->fp->ptell();
+}
+
+void caching::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    this->fp->translate(logical, physical, n);
+}
+
+lfp_protocol* caching::peel() noexcept (false) {
+    assert(this->fp);
+    return this->fp.release();
+}
+
+lfp_protocol* caching::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+void caching::insert_below(lfp_layer_factory factory, void* userdata)
+noexcept (false) {
+    /* the layer presents the same stream, so it is materialised just the same */
+    splice_below(this->fp, factory, userdata);
+}
+
+void caching::recover() noexcept (false) {
+    this->fp->recover();
+}
+
+std::string caching::identity() const noexcept (false) {
+    return this->key;
+}
+
+std::int64_t caching::index_size() const noexcept (false) {
+    return this->fp->index_size();
+}
+
+std::int64_t caching::index_records(
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst)
+const noexcept (false) {
+    return this->fp->index_records(first, len, dst);
+}
+
+}
+
+}
+
+lfp_protocol* lfp_cache_open(lfp_protocol* f, const char* dir) {
+    if (not f or not dir) return nullptr;
+
+    std::string key;
+    std::string path;
+    try {
+        key = f->identity();
+        path = lfp::cache_path(dir, key);
+    } catch (...) {
+        return f;
+    }
+
+    auto* cached = lfp::open_mapped(path, key);
+    if (cached) {
+        lfp_close(f);
+        return cached;
+    }
+
+    try {
+        return new lfp::caching(f, key, path);
+    } catch (...) {
+        return f;
+    }
+}
+
+#endif
@@ -5,15 +5,21 @@
 #include <cstdio>
 #include <cstring>
 #include <limits>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <type_traits>
 
 #include <fmt/format.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include <lfp/protocol.hpp>
 #include <lfp/lfp.h>
 
+#include "scheduler.hpp"
+
 namespace lfp { namespace {
 
 /*
@@ -83,6 +89,41 @@ int long_seek(std::FILE* fp, std::int64_t pos) {
     return dispatch_seek< long >(fp, pos);
 }
 
+/*
+ * Identify a file by its device, inode, size and modification time, so that
+ * replacing or modifying the file changes its identity. On Windows there are
+ * no (stable) inodes, so files can not be identified.
+ */
+std::string file_identity(int fd, const std::string& path, std::int64_t zero)
+noexcept (false) {
+    #if defined(_WIN32)
+        (void)fd;
+        (void)path;
+        (void)zero;
+        throw not_supported("identity: files can not be identified on Windows");
+    #else
+        struct stat st;
+        const auto err = fd != -1 ? ::fstat(fd, &st)
+                                  : ::stat(path.c_str(), &st);
+        if (err)
+            throw io_error(std::strerror(errno));
+
+        #if defined(__linux__)
+            const long long nsec = st.st_mtim.tv_nsec;
+        #else
+            const long long nsec = 0;
+        #endif
+
+        return fmt::format("cfile:{}:{}:{}:{}.{}@{}",
+                           (unsigned long long)st.st_dev,
+                           (unsigned long long)st.st_ino,
+                           (long long)st.st_size,
+                           (long long)st.st_mtime,
+                           nsec,
+                           zero);
+    #endif
+}
+
 /*
  * This is really just an interface adaptor for the C stdlib FILE
  */
@@ -108,9 +149,15 @@ public:
     void seek(std::int64_t) noexcept (false) override;
     std::int64_t tell() const noexcept (false) override;
     std::int64_t ptell() const noexcept (false) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
 
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    void reopen(lfp_protocol*) noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
 
 private:
     struct del {
@@ -144,7 +191,7 @@ lfp_status cfile::readinto(
         std::int64_t len,
         std::int64_t* bytes_read)
 noexcept (false) {
-    const auto n = std::fread(dst, 1, len, this->fp.get());
+    const auto n = scheduled_fread(dst, len, this->fp.get());
     if (bytes_read)
         *bytes_read = n;
 
@@ -187,6 +234,18 @@ std::int64_t cfile::ptell() const noexcept (false) {
     return off;
 }
 
+void cfile::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    if (this->zero == -1)
+        throw not_supported(this->ftell_errmsg);
+
+    for (std::int64_t i = 0; i < n; ++i)
+        physical[i] = logical[i] + this->zero;
+}
+
 std::int64_t cfile::tell() const noexcept (false) {
     return this->ptell() - this->zero;
 }
@@ -199,6 +258,361 @@ lfp_protocol* cfile::peek() const noexcept (false) {
     throw lfp::leaf_protocol("peek: not supported for leaf protocol");
 }
 
+void cfile::reopen(lfp_protocol*) noexcept (false) {
+    throw lfp::leaf_protocol("reopen: not supported for leaf protocol");
+}
+
+void cfile::insert_below(lfp_layer_factory, void*) noexcept (false) {
+    throw lfp::leaf_protocol("insert_below: not supported for leaf protocol");
+}
+
+void cfile::recover() noexcept (false) {
+    /*
+     * The FILE position is only advanced by what fread() actually read, so
+     * it's already at the last good position, and only the error needs
+     * clearing.
+     */
+    std::clearerr(this->fp.get());
+}
+
+std::string cfile::identity() const noexcept (false) {
+    if (this->zero == -1)
+        throw not_supported(this->ftell_errmsg);
+
+    return file_identity(fileno(this->fp.get()), "", this->zero);
+}
+
+/*
+ * The lazy cfile is the cfile protocol, but the FILE is owned by a
+ * process-wide cache of open descriptors rather than by the handle itself.
+ * When the cache is full the least recently used FILE is closed, and its
+ * position recorded, and the next operation on that handle transparently
+ * re-opens the file and restores the position.
+ *
+ * This allows keeping a lot more lfp handles (and their indices) alive than
+ * the process is allowed to have open files.
+ */
+class lazy_cfile;
+
+class descriptor_cache {
+public:
+    /*
+     * Make sure f has an open FILE, evicting the least recently used handle if
+     * the cache is full. The caller must hold f->busy.
+     */
+    void acquire(lazy_cfile* f) noexcept (false);
+    /*
+     * Remove f from the cache. This does not close the FILE.
+     */
+    void forget(lazy_cfile* f) noexcept (true);
+    void capacity(std::size_t n) noexcept (true);
+
+private:
+    void evict(std::size_t target) noexcept (true);
+
+    std::mutex mtx;
+    /* handles with an open FILE, most recently used first */
+    std::list< lazy_cfile* > lru;
+    std::size_t cap = 128;
+};
+
+descriptor_cache& descriptors() noexcept (true) {
+    static descriptor_cache cache;
+    return cache;
+}
+
+class lazy_cfile : public lfp_protocol {
+public:
+    lazy_cfile(const char* path, std::int64_t zero) noexcept (false);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(
+            void* dst,
+            std::int64_t len,
+            std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (false) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
+
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    void reopen(lfp_protocol*) noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    ~lazy_cfile() override;
+
+private:
+    friend class descriptor_cache;
+
+    /*
+     * Open the file and restore the recorded position. Called by the
+     * descriptor cache with the cache lock held.
+     */
+    void resume() noexcept (false);
+    /*
+     * Record the current position and close the file. Called by the
+     * descriptor cache with the cache lock held. If the position can not be
+     * recorded the file is left open.
+     */
+    void suspend() noexcept (false);
+
+    std::string path;
+    std::int64_t zero;
+
+    /*
+     * Serializes operations on this handle with eviction from other threads.
+     * Eviction only ever try_lock()s, so it cannot deadlock with a handle
+     * waiting for the cache.
+     */
+    mutable std::mutex busy;
+
+    std::FILE* fp = nullptr;
+    /* only meaningful when fp == nullptr */
+    std::int64_t pos;
+    bool at_eof = false;
+
+    bool cached = false;
+    std::list< lazy_cfile* >::iterator slot;
+};
+
+void descriptor_cache::acquire(lazy_cfile* f) noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+
+    if (f->cached) {
+        this->lru.splice(this->lru.begin(), this->lru, f->slot);
+        return;
+    }
+
+    this->evict(this->cap - 1);
+    /* the file is still open if it could not be suspended */
+    if (not f->fp)
+        f->resume();
+    try {
+        this->lru.push_front(f);
+    } catch (...) {
+        f->suspend();
+        throw runtime_error("lazy cfile: unable to register open file");
+    }
+    f->slot = this->lru.begin();
+    f->cached = true;
+}
+
+void descriptor_cache::forget(lazy_cfile* f) noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    if (not f->cached) return;
+    this->lru.erase(f->slot);
+    f->cached = false;
+}
+
+void descriptor_cache::capacity(std::size_t n) noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    this->cap = (std::max)(n, std::size_t(1));
+    this->evict(this->cap);
+}
+
+void descriptor_cache::evict(std::size_t target) noexcept (true) {
+    /*
+     * Walk from the least recently used end, and skip handles that are
+     * currently in use by another thread. If all handles are busy the cache
+     * is temporarily allowed to grow past its capacity.
+     */
+    auto itr = this->lru.end();
+    while (this->lru.size() > target and itr != this->lru.begin()) {
+        --itr;
+        lazy_cfile* victim = *itr;
+        if (not victim->busy.try_lock())
+            continue;
+
+        /* a handle that can not be suspended is kept open, like busy ones */
+        try {
+            victim->suspend();
+        } catch (const lfp::error&) {
+            victim->busy.unlock();
+            continue;
+        }
+        victim->cached = false;
+        itr = this->lru.erase(itr);
+        victim->busy.unlock();
+    }
+}
+
+lazy_cfile::lazy_cfile(const char* p, std::int64_t z) noexcept (false) :
+    path(p),
+    zero(z),
+    pos(z)
+{
+    std::lock_guard< std::mutex > lock(this->busy);
+    descriptors().acquire(this);
+}
+
+lazy_cfile::~lazy_cfile() {
+    descriptors().forget(this);
+    if (this->fp) std::fclose(this->fp);
+}
+
+void lazy_cfile::resume() noexcept (false) {
+    assert(not this->fp);
+    std::FILE* f = std::fopen(this->path.c_str(), "rb");
+    if (!f) {
+        const auto msg = "lazy cfile: unable to open {}: {}";
+        throw io_error(fmt::format(msg, this->path, std::strerror(errno)));
+    }
+
+    if (long_seek(f, this->pos)) {
+        const auto msg = "lazy cfile: unable to restore position {} in {}: {}";
+        const auto err = std::strerror(errno);
+        std::fclose(f);
+        throw io_error(fmt::format(msg, this->pos, this->path, err));
+    }
+
+    /*
+     * The EOF flag of the suspended FILE is lost, but it is kept in at_eof
+     * until the next read or seek clears it.
+     */
+    this->fp = f;
+}
+
+void lazy_cfile::suspend() noexcept (false) {
+    assert(this->fp);
+    const auto pos = long_tell(this->fp);
+    if (pos == -1) {
+        const auto msg = "lazy cfile: unable to record position in {}: {}";
+        throw io_error(fmt::format(msg, this->path, std::strerror(errno)));
+    }
+
+    this->pos = pos;
+    this->at_eof = std::feof(this->fp);
+    std::fclose(this->fp);
+    this->fp = nullptr;
+}
+
+void lazy_cfile::close() noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->busy);
+    descriptors().forget(this);
+    if (!this->fp) return;
+
+    const auto err = std::fclose(this->fp);
+    this->fp = nullptr;
+    if (err)
+        throw runtime_error(std::strerror(errno));
+}
+
+lfp_status lazy_cfile::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->busy);
+    descriptors().acquire(this);
+    this->at_eof = false;
+
+    const auto n = scheduled_fread(dst, len, this->fp);
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (n == std::size_t(len))
+        return LFP_OK;
+
+    if (std::feof(this->fp))
+        return LFP_EOF;
+
+    if (std::ferror(this->fp)) {
+        auto msg = "Unable to read from file: {}";
+        throw io_error(fmt::format(msg, std::strerror(errno)));
+    }
+
+    return LFP_OKINCOMPLETE;
+}
+
+int lazy_cfile::eof() const noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->busy);
+    if (!this->fp)
+        return this->at_eof;
+    return this->at_eof or std::feof(this->fp);
+}
+
+void lazy_cfile::seek(std::int64_t n) noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->busy);
+    const auto pos = n + this->zero;
+    assert(pos >= 0);
+    this->at_eof = false;
+
+    /*
+     * Seeking a suspended file is just book keeping - there's no need to
+     * re-open it until it is actually read from.
+     */
+    if (!this->fp) {
+        this->pos = pos;
+        return;
+    }
+
+    const auto err = long_seek(this->fp, pos);
+    if (err)
+        throw io_error(std::strerror(errno));
+}
+
+std::int64_t lazy_cfile::ptell() const noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->busy);
+    if (!this->fp)
+        return this->pos;
+
+    std::int64_t off = long_tell(this->fp);
+    if (off == -1)
+        throw io_error(std::strerror(errno));
+    return off;
+}
+
+void lazy_cfile::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    for (std::int64_t i = 0; i < n; ++i)
+        physical[i] = logical[i] + this->zero;
+}
+
+std::int64_t lazy_cfile::tell() const noexcept (false) {
+    return this->ptell() - this->zero;
+}
+
+lfp_protocol* lazy_cfile::peel() noexcept (false) {
+    throw lfp::leaf_protocol("peel: not supported for leaf protocol");
+}
+
+lfp_protocol* lazy_cfile::peek() const noexcept (false) {
+    throw lfp::leaf_protocol("peek: not supported for leaf protocol");
+}
+
+void lazy_cfile::reopen(lfp_protocol*) noexcept (false) {
+    throw lfp::leaf_protocol("reopen: not supported for leaf protocol");
+}
+
+void lazy_cfile::insert_below(lfp_layer_factory, void*) noexcept (false) {
+    throw lfp::leaf_protocol("insert_below: not supported for leaf protocol");
+}
+
+void lazy_cfile::recover() noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->busy);
+    if (this->fp)
+        std::clearerr(this->fp);
+}
+
+std::string lazy_cfile::identity() const noexcept (false) {
+    /*
+     * Lazy and regular cfiles of the same file present the same bytes, and
+     * so have the same identity
+     */
+    return file_identity(-1, this->path, this->zero);
+}
+
 }
 
 }
@@ -216,3 +630,16 @@ lfp_protocol* lfp_cfile_open_at_offset(std::FILE* fp, std::int64_t zero) {
         return nullptr;
     }
 }
+
+lfp_protocol* lfp_cfile_open_lazy(const char* path, std::int64_t zero) {
+    if (!path or zero < 0) return nullptr;
+    try {
+        return new lfp::lazy_cfile(path, zero);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void lfp_cfile_lazy_capacity(std::size_t n) {
+    lfp::descriptors().capacity(n);
+}
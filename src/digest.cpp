@@ -0,0 +1,508 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if (defined(__GNUC__) or defined(__clang__)) and defined(__x86_64__)
+    #include <nmmintrin.h>
+    #define LFP_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+    #define LFP_CRC32C_ARMV8
+#endif
+
+#include <lfp/digest.h>
+#include <lfp/protocol.hpp>
+
+#include "tell.hpp"
+
+namespace lfp { namespace {
+
+/*
+ * CRC32C (Castagnoli), in the reflected form, i.e. the bit order of the
+ * SSE4.2 and ARMv8 crc32c instructions
+ */
+constexpr std::uint32_t castagnoli = 0x82F63B78;
+
+/*
+ * Tables for slicing-by-8, where table[k][b] is the CRC of byte b followed by
+ * k zero bytes
+ */
+struct crc_tables {
+    crc_tables() noexcept (true) {
+        for (std::uint32_t b = 0; b < 256; ++b) {
+            std::uint32_t crc = b;
+            for (int i = 0; i < 8; ++i)
+                crc = (crc >> 1) ^ (castagnoli & (0 - (crc & 1)));
+            this->table[0][b] = crc;
+        }
+
+        for (int k = 1; k < 8; ++k) {
+            for (int b = 0; b < 256; ++b) {
+                const auto prev = this->table[k - 1][b];
+                this->table[k][b] = (prev >> 8) ^ this->table[0][prev & 0xFF];
+            }
+        }
+    }
+
+    std::uint32_t table[8][256];
+};
+
+std::uint32_t crc32c_table(
+        std::uint32_t crc,
+        const unsigned char* p,
+        std::size_t len)
+noexcept (true) {
+    static const crc_tables tables;
+    const auto& t = tables.table;
+
+    /*
+     * The words are assembled byte by byte, so this is independent of the
+     * endianness of the host
+     */
+    while (len >= 8) {
+        crc ^= std::uint32_t(p[0])
+            | std::uint32_t(p[1]) << 8
+            | std::uint32_t(p[2]) << 16
+            | std::uint32_t(p[3]) << 24
+        ;
+        crc = t[7][ crc        & 0xFF]
+            ^ t[6][(crc >>  8) & 0xFF]
+            ^ t[5][(crc >> 16) & 0xFF]
+            ^ t[4][ crc >> 24        ]
+            ^ t[3][p[4]]
+            ^ t[2][p[5]]
+            ^ t[1][p[6]]
+            ^ t[0][p[7]]
+        ;
+        p   += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+    return crc;
+}
+
+#if defined(LFP_CRC32C_SSE42)
+
+__attribute__((target("sse4.2")))
+std::uint32_t crc32c_hw(
+        std::uint32_t crc,
+        const unsigned char* p,
+        std::size_t len)
+noexcept (true) {
+    std::uint64_t c = crc;
+    while (len >= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+        p   += 8;
+        len -= 8;
+    }
+
+    crc = std::uint32_t(c);
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+bool have_crc32c_hw() noexcept (true) {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(LFP_CRC32C_ARMV8)
+
+std::uint32_t crc32c_hw(
+        std::uint32_t crc,
+        const unsigned char* p,
+        std::size_t len)
+noexcept (true) {
+    while (len >= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p   += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+
+    return crc;
+}
+
+bool have_crc32c_hw() noexcept (true) {
+    /* the instructions are guaranteed by the target flags */
+    return true;
+}
+
+#else
+
+std::uint32_t crc32c_hw(std::uint32_t, const unsigned char*, std::size_t)
+noexcept (true) {
+    assert(false);
+    return 0;
+}
+
+bool have_crc32c_hw() noexcept (true) {
+    return false;
+}
+
+#endif
+
+/*
+ * Extend the CRC32C crc of some bytes with len more bytes. The CRC of no bytes
+ * is 0.
+ */
+std::uint32_t crc32c(std::uint32_t crc, const void* src, std::size_t len)
+noexcept (true) {
+    static const bool hw = have_crc32c_hw();
+    const auto* p = static_cast< const unsigned char* >(src);
+    crc = ~crc;
+    crc = hw ? crc32c_hw(crc, p, len) : crc32c_table(crc, p, len);
+    return ~crc;
+}
+
+/*
+ * Checksum the bytes read through this layer.
+ *
+ * Only a gap-free range of the stream, from the position of fp when the layer
+ * is opened, is checksummed, as a CRC can only be extended at the end. The
+ * layer tracks the logical position of fp, like the retry protocol, so a read
+ * is checksummed if it reaches past the end of the range without starting
+ * after it.
+ */
+class digest : public lfp_protocol {
+public:
+    digest(lfp_protocol*, std::int64_t block);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (false) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    lfp_status seek_step(std::int64_t, std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    std::int64_t index_size() const noexcept (false) override;
+    std::int64_t index_records(std::int64_t, std::int64_t, lfp_record*)
+        const noexcept (false) override;
+
+    lfp_status file_digest(std::uint32_t* crc, std::int64_t* len)
+        const noexcept (true);
+    std::int64_t block_digests(std::int64_t first,
+                               std::int64_t len,
+                               std::uint32_t* dst)
+        const noexcept (true);
+
+private:
+    unique_lfp fp;
+    std::int64_t block;
+
+    /* logical position of fp, or -1 if unknown */
+    std::int64_t pos;
+    /* logical position of fp when the layer was opened */
+    std::int64_t start;
+
+    /* end of the checksummed range, which starts at start */
+    std::int64_t hashed;
+    /* true if the range reaches the end of the stream */
+    bool complete = false;
+
+    std::uint32_t crc = 0;
+    std::uint32_t block_crc = 0;
+    std::vector< std::uint32_t > blocks;
+
+    void update(const unsigned char* src, std::int64_t len) noexcept (false);
+};
+
+digest::digest(lfp_protocol* f, std::int64_t block) :
+    fp(f),
+    block(block),
+    pos(try_tell(f))
+{
+    /* a layer that can not tell is assumed to be at the start of its stream */
+    if (this->pos == -1)
+        this->pos = 0;
+    this->start = this->hashed = this->pos;
+}
+
+void digest::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status digest::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    std::int64_t n = 0;
+    lfp_status err;
+    try {
+        err = this->fp->readinto(dst, len, &n);
+    } catch (...) {
+        /* no telling how far fp got, so stop until the next seek or recover */
+        this->pos = -1;
+        throw;
+    }
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (this->pos == -1)
+        return err;
+
+    const auto end = this->pos + n;
+    if (this->pos <= this->hashed and this->hashed < end) {
+        const auto* src = static_cast< const unsigned char* >(dst);
+        this->update(src + (this->hashed - this->pos), end - this->hashed);
+    }
+
+    this->pos = end;
+    if (err == LFP_EOF and this->pos == this->hashed)
+        this->complete = true;
+
+    return err;
+}
+
+int digest::eof() const noexcept (false) {
+    return this->fp->eof();
+}
+
+void digest::seek(std::int64_t n) noexcept (false) {
+    this->fp->seek(n);
+    this->pos = n;
+}
+
+lfp_status digest::seek_step(std::int64_t n, std::int64_t max_headers)
+noexcept (false) {
+    const auto err = this->fp->seek_step(n, max_headers);
+    this->pos = (err == LFP_OK) ? n : try_tell(this->fp);
+    return err;
+}
+
+std::int64_t digest::tell() const noexcept (false) {
+    return this->fp->tell();
+}
+
+std::int64_t digest::ptell() const noexcept (false) {
+    return this->fp->ptell();
+}
+
+void digest::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    this->fp->translate(logical, physical, n);
+}
+
+lfp_protocol* digest::peel() noexcept (false) {
+    assert(this->fp);
+    return this->fp.release();
+}
+
+lfp_protocol* digest::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+void digest::insert_below(lfp_layer_factory factory, void* userdata)
+noexcept (false) {
+    /* the digests are of what this layer reads, and are not affected */
+    splice_below(this->fp, factory, userdata);
+}
+
+void digest::recover() noexcept (false) {
+    this->fp->recover();
+    this->pos = try_tell(this->fp);
+}
+
+std::string digest::identity() const noexcept (false) {
+    /* checksumming does not change what is read */
+    return this->fp->identity();
+}
+
+std::int64_t digest::index_size() const noexcept (false) {
+    return this->fp->index_size();
+}
+
+std::int64_t digest::index_records(
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst)
+const noexcept (false) {
+    return this->fp->index_records(first, len, dst);
+}
+
+lfp_status digest::file_digest(std::uint32_t* crc, std::int64_t* len)
+const noexcept (true) {
+    *crc = this->crc;
+    if (len)
+        *len = this->hashed - this->start;
+    return this->complete ? LFP_OK : LFP_OKINCOMPLETE;
+}
+
+std::int64_t digest::block_digests(
+        std::int64_t first,
+        std::int64_t len,
+        std::uint32_t* dst)
+const noexcept (true) {
+    auto available = std::int64_t(this->blocks.size());
+    const auto partial = this->block > 0
+                     and (this->hashed - this->start) % this->block != 0;
+    if (this->complete and partial)
+        available += 1;
+
+    if (first >= available)
+        return 0;
+
+    const auto n = (std::min)(len, available - first);
+    for (std::int64_t i = 0; i < n; ++i) {
+        const auto k = std::size_t(first + i);
+        dst[i] = k < this->blocks.size() ? this->blocks[k] : this->block_crc;
+    }
+    return n;
+}
+
+void digest::update(const unsigned char* src, std::int64_t len)
+noexcept (false) {
+    this->crc = crc32c(this->crc, src, std::size_t(len));
+
+    if (this->block == 0) {
+        this->hashed += len;
+        return;
+    }
+
+    while (len > 0) {
+        const auto left = this->block
+                        - (this->hashed - this->start) % this->block;
+        const auto n = (std::min)(len, left);
+        this->block_crc = crc32c(this->block_crc, src, std::size_t(n));
+        this->hashed += n;
+        src += n;
+        len -= n;
+
+        if (n == left) {
+            this->blocks.push_back(this->block_crc);
+            this->block_crc = 0;
+        }
+    }
+}
+
+/*
+ * The outermost digest layer in the stack of f, or nullptr
+ */
+const digest* find_digest(lfp_protocol* f) noexcept (true) {
+    while (f) {
+        const auto* d = dynamic_cast< const digest* >(f);
+        if (d)
+            return d;
+
+        try {
+            f = f->peek();
+        } catch (const lfp::error&) {
+            /* leaf protocol, or already peeled */
+            return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+}
+
+}
+
+lfp_protocol* lfp_digest_open(lfp_protocol* f, std::int64_t block) {
+    if (not f) return nullptr;
+    if (block < 0) return nullptr;
+
+    try {
+        return new lfp::digest(f, block);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+int lfp_digest_file(lfp_protocol* f, std::uint32_t* crc, std::int64_t* len)
+try {
+    assert(f);
+    assert(crc);
+
+    const auto* d = lfp::find_digest(f);
+    if (not d) {
+        f->errmsg("digest: no digest protocol in the stack");
+        return LFP_NOTIMPLEMENTED;
+    }
+
+    return d->file_digest(crc, len);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_digest_blocks(lfp_protocol* f,
+        std::int64_t first,
+        std::int64_t len,
+        std::uint32_t* dst,
+        std::int64_t* n) try {
+    assert(f);
+    assert(dst or len == 0);
+
+    if (first < 0 or len < 0) {
+        const auto msg = "expected first (which is {}) and len (which is {}) "
+                         ">= 0";
+        f->errmsg(fmt::format(msg, first, len));
+        return LFP_INVALID_ARGS;
+    }
+
+    const auto* d = lfp::find_digest(f);
+    if (not d) {
+        f->errmsg("digest: no digest protocol in the stack");
+        return LFP_NOTIMPLEMENTED;
+    }
+
+    const auto copied = d->block_digests(first, len, dst);
+    if (n)
+        *n = copied;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
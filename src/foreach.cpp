@@ -0,0 +1,498 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <ciso646>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <lfp/lfp.h>
+#include <lfp/protocol.hpp>
+
+namespace lfp { namespace {
+
+using buffer = std::vector< unsigned char >;
+
+/*
+ * The read buffers handed out to the visitors.
+ *
+ * The number of outstanding blocks is bounded, so that slow visitors apply
+ * back-pressure on the reader, rather than the whole file being read into
+ * memory. Released blocks are kept for reuse.
+ */
+class block_pool {
+public:
+    block_pool(std::size_t blocksize, std::size_t blocks) :
+        blocksize(blocksize),
+        limit(blocks)
+    {}
+
+    /*
+     * Get a block, and wait for one to be released if all are in use
+     */
+    std::shared_ptr< buffer > block() noexcept (false);
+
+    /*
+     * Get a buffer of size n. Spans are not counted against the limit, as
+     * there can never be more of them than there are blocks.
+     */
+    std::shared_ptr< buffer > span(std::size_t n) noexcept (false);
+
+    std::size_t size() const noexcept (true) {
+        return this->blocksize;
+    }
+
+private:
+    void release(buffer*) noexcept (true);
+
+    std::size_t blocksize;
+    std::size_t limit;
+    std::size_t outstanding = 0;
+
+    std::mutex mtx;
+    std::condition_variable released;
+    std::vector< std::unique_ptr< buffer > > free;
+};
+
+std::shared_ptr< buffer > block_pool::block() noexcept (false) {
+    std::unique_lock< std::mutex > lock(this->mtx);
+    this->released.wait(lock, [this] () noexcept (true) {
+        return this->outstanding < this->limit;
+    });
+
+    std::unique_ptr< buffer > b;
+    if (this->free.empty()) {
+        b.reset(new buffer(this->blocksize));
+    } else {
+        b = std::move(this->free.back());
+        this->free.pop_back();
+    }
+
+    this->outstanding += 1;
+    auto* p = b.release();
+    return std::shared_ptr< buffer >(p, [this] (buffer* x) noexcept (true) {
+        this->release(x);
+    });
+}
+
+std::shared_ptr< buffer > block_pool::span(std::size_t n) noexcept (false) {
+    return std::make_shared< buffer >(n);
+}
+
+void block_pool::release(buffer* b) noexcept (true) {
+    std::unique_ptr< buffer > x(b);
+    {
+        std::lock_guard< std::mutex > lock(this->mtx);
+        this->outstanding -= 1;
+        try {
+            this->free.push_back(std::move(x));
+        } catch (...) {
+            /* not being able to keep the block for reuse is ok */
+        }
+    }
+    this->released.notify_one();
+}
+
+/*
+ * A set of consecutive records, which are all contiguous in the same buffer
+ */
+struct job {
+    std::int64_t seq;
+    std::vector< lfp_record > records;
+    const unsigned char* data;
+    std::shared_ptr< buffer > holder;
+};
+
+/*
+ * The consumer side - visit the jobs submitted by the reader, either on a
+ * pool of worker threads or inline.
+ *
+ * Once a visitor returns non-zero, or the dispatcher is cancelled, the
+ * remaining jobs are still passed through the pipeline to release their
+ * buffers, but no more visitors are called.
+ */
+class dispatcher {
+public:
+    dispatcher(lfp_record_visitor visit,
+               lfp_record_visitor complete,
+               void* userdata,
+               int nthreads) noexcept (false);
+    ~dispatcher();
+
+    void submit(job&&) noexcept (false);
+
+    /*
+     * Wait for all submitted jobs to be visited and completed, and return
+     * the status of the visitors.
+     */
+    int finish() noexcept (true);
+
+    void cancel(int status) noexcept (true);
+    bool stopped() const noexcept (true);
+
+private:
+    void work() noexcept (true);
+    void run(job&) noexcept (true);
+    void completed(job&&) noexcept (true);
+
+    lfp_record_visitor visit;
+    lfp_record_visitor complete;
+    void* userdata;
+
+    std::atomic< int > status;
+
+    std::mutex mtx;
+    std::condition_variable pending;
+    std::deque< job > queue;
+    bool done = false;
+    std::vector< std::thread > threads;
+
+    std::mutex completion_mtx;
+    std::map< std::int64_t, job > ready;
+    std::int64_t next_seq = 0;
+};
+
+dispatcher::dispatcher(lfp_record_visitor visit,
+                       lfp_record_visitor complete,
+                       void* userdata,
+                       int nthreads) noexcept (false) :
+    visit(visit),
+    complete(complete),
+    userdata(userdata),
+    status(0)
+{
+    /*
+     * If not all threads can be started, run with fewer, and if none can be
+     * started, visit the records on the calling thread
+     */
+    for (int i = 0; i < nthreads; ++i) {
+        try {
+            this->threads.emplace_back(&dispatcher::work, this);
+        } catch (const std::system_error&) {
+            break;
+        }
+    }
+}
+
+dispatcher::~dispatcher() {
+    this->finish();
+}
+
+void dispatcher::submit(job&& j) noexcept (false) {
+    if (this->threads.empty()) {
+        this->run(j);
+        return;
+    }
+
+    {
+        std::lock_guard< std::mutex > lock(this->mtx);
+        this->queue.push_back(std::move(j));
+    }
+    this->pending.notify_one();
+}
+
+int dispatcher::finish() noexcept (true) {
+    {
+        std::lock_guard< std::mutex > lock(this->mtx);
+        this->done = true;
+    }
+    this->pending.notify_all();
+
+    for (auto& t : this->threads)
+        t.join();
+    this->threads.clear();
+
+    return this->status;
+}
+
+void dispatcher::cancel(int status) noexcept (true) {
+    int expected = 0;
+    this->status.compare_exchange_strong(expected, status);
+}
+
+bool dispatcher::stopped() const noexcept (true) {
+    return this->status != 0;
+}
+
+void dispatcher::work() noexcept (true) {
+    while (true) {
+        job j;
+        {
+            std::unique_lock< std::mutex > lock(this->mtx);
+            this->pending.wait(lock, [this] () noexcept (true) {
+                return this->done or not this->queue.empty();
+            });
+
+            if (this->queue.empty())
+                return;
+
+            j = std::move(this->queue.front());
+            this->queue.pop_front();
+        }
+        this->run(j);
+    }
+}
+
+void dispatcher::run(job& j) noexcept (true) {
+    const auto begin = j.records.front().logical;
+    for (const auto& rec : j.records) {
+        if (this->stopped())
+            break;
+
+        const auto* data = j.data + (rec.logical - begin);
+        const auto err = this->visit(&rec, data, this->userdata);
+        if (err)
+            this->cancel(err);
+    }
+
+    if (this->complete)
+        this->completed(std::move(j));
+}
+
+void dispatcher::completed(job&& j) noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->completion_mtx);
+
+    /*
+     * Once stopped, no more records are completed, so release the buffers
+     * right away, rather than holding on to them while waiting for jobs that
+     * may never come.
+     */
+    if (this->stopped()) {
+        this->ready.clear();
+        return;
+    }
+
+    /*
+     * Complete the jobs in order - stash this job, and complete all the
+     * consecutive jobs that are now available.
+     */
+    try {
+        const auto seq = j.seq;
+        this->ready.emplace(seq, std::move(j));
+    } catch (...) {
+        this->cancel(LFP_RUNTIME_ERROR);
+        return;
+    }
+
+    while (not this->ready.empty()) {
+        auto itr = this->ready.begin();
+        if (itr->first != this->next_seq)
+            break;
+
+        auto& x = itr->second;
+        const auto begin = x.records.front().logical;
+        for (const auto& rec : x.records) {
+            if (this->stopped())
+                break;
+
+            const auto* data = x.data + (rec.logical - begin);
+            const auto err = this->complete(&rec, data, this->userdata);
+            if (err)
+                this->cancel(err);
+        }
+
+        this->ready.erase(itr);
+        this->next_seq += 1;
+    }
+}
+
+/*
+ * Read exactly len bytes, unless the file ends. Returns the status of the
+ * last read, and the number of bytes read in n. Protocol recovery is
+ * recorded in recovery, but the read is otherwise considered successful.
+ */
+lfp_status read_fully(lfp_protocol* f,
+                      unsigned char* dst,
+                      std::int64_t len,
+                      std::int64_t* n,
+                      lfp_status& recovery) noexcept (false) {
+    *n = 0;
+    while (true) {
+        std::int64_t nread = 0;
+        const auto err = f->readinto(dst + *n, len - *n, &nread);
+        *n += nread;
+
+        switch (err) {
+            case LFP_PROTOCOL_TRYRECOVERY:
+                /*
+                 * The tapeimage protocol reports recovery instead of EOF and
+                 * OKINCOMPLETE, so figure out which one it was
+                 */
+                recovery = err;
+                if (*n == len)    return LFP_OK;
+                if (f->eof())     return LFP_EOF;
+                if (nread == 0)   return LFP_OKINCOMPLETE;
+                continue;
+
+            case LFP_OKINCOMPLETE:
+                if (nread == 0) return err;
+                continue;
+
+            default:
+                return err;
+        }
+    }
+}
+
+/*
+ * Groups of records are dispatched as a single job, to not drown in
+ * synchronisation overhead when the records are tiny
+ */
+constexpr const std::int64_t job_bytes   = 1 << 16;
+constexpr const std::size_t  job_records = 1024;
+constexpr const std::int64_t block_size  = 1 << 20;
+
+int foreach(lfp_protocol* f,
+            lfp_record_visitor visit,
+            lfp_record_visitor complete,
+            void* userdata,
+            int nthreads) noexcept (false) {
+    /* protocols without an index can't be iterated record-by-record */
+    f->index_size();
+    f->seek(0);
+
+    block_pool pool(block_size, 2 * nthreads + 2);
+    dispatcher d(visit, complete, userdata, nthreads);
+
+    try {
+        /* logical offset of the next byte to read */
+        std::int64_t pos = 0;
+        /* indexed records not yet dispatched */
+        std::vector< lfp_record > records;
+        std::int64_t fetched = 0;
+        std::int64_t seq = 0;
+        lfp_status recovery = LFP_OK;
+
+        auto fetch = [&] () {
+            const auto size = f->index_size();
+            if (size == fetched) return;
+
+            const auto have = records.size();
+            records.resize(have + (size - fetched));
+            f->index_records(fetched, size - fetched, records.data() + have);
+            fetched = size;
+        };
+
+        bool eof = false;
+        while (not eof and not d.stopped()) {
+            auto block = pool.block();
+            std::int64_t n = 0;
+            const auto err = read_fully(f, block->data(), pool.size(), &n, recovery);
+            if (err == LFP_OKINCOMPLETE) {
+                d.cancel(err);
+                break;
+            }
+            eof = err == LFP_EOF;
+
+            const auto end = pos + n;
+            fetch();
+
+            auto rec = records.begin();
+            while (rec != records.end() and rec->logical + rec->length <= end) {
+                job j;
+                j.seq = seq++;
+                j.data = block->data() + (rec->logical - pos);
+                j.holder = block;
+
+                const auto first = rec->logical;
+                while (rec != records.end()
+                   and rec->logical + rec->length <= end
+                   and rec->logical - first < job_bytes
+                   and j.records.size() < job_records) {
+                    j.records.push_back(*rec);
+                    ++rec;
+                }
+
+                d.submit(std::move(j));
+            }
+
+            /*
+             * A record that continues past the block - copy the first part
+             * and read the rest directly into a buffer of its own
+             */
+            if (rec != records.end() and rec->logical < end) {
+                auto span = pool.span(rec->length);
+                const auto head = end - rec->logical;
+                std::memcpy(span->data(), block->data() + (rec->logical - pos), head);
+                block.reset();
+
+                std::int64_t tail = 0;
+                const auto err = read_fully(f,
+                                            span->data() + head,
+                                            rec->length - head,
+                                            &tail,
+                                            recovery);
+                if (head + tail != rec->length) {
+                    const auto msg = "foreach: record at {} ended after {} bytes, "
+                                     "expected {}";
+                    d.cancel(err == LFP_OKINCOMPLETE ? err : LFP_UNEXPECTED_EOF);
+                    f->errmsg(fmt::format(msg, rec->logical, head + tail,
+                                          rec->length));
+                    break;
+                }
+
+                eof = err == LFP_EOF;
+                pos = rec->logical + rec->length;
+
+                job j;
+                j.seq = seq++;
+                j.data = span->data();
+                j.holder = std::move(span);
+                j.records.push_back(*rec);
+                ++rec;
+                d.submit(std::move(j));
+            } else {
+                pos = end;
+            }
+
+            records.erase(records.begin(), rec);
+        }
+
+        const auto status = d.finish();
+        if (status) return status;
+        return recovery;
+    } catch (...) {
+        d.cancel(LFP_RUNTIME_ERROR);
+        throw;
+    }
+}
+
+}
+
+}
+
+int lfp_foreach_record(lfp_protocol* f,
+                       lfp_record_visitor visit,
+                       lfp_record_visitor complete,
+                       void* userdata,
+                       int nthreads) try {
+    assert(f);
+    assert(visit);
+
+    if (nthreads < 0) {
+        const auto msg = "expected nthreads (which is {}) >= 0";
+        f->errmsg(fmt::format(msg, nthreads));
+        return LFP_INVALID_ARGS;
+    }
+
+    return lfp::foreach(f, visit, complete, userdata, nthreads);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
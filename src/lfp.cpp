@@ -67,6 +67,34 @@ int lfp_seek(lfp_protocol* f, std::int64_t n) try {
     return LFP_UNHANDLED_EXCEPTION;
 }
 
+int lfp_seek_step(lfp_protocol* f, std::int64_t n, std::int64_t max_headers)
+try {
+    assert(f);
+
+    if (n < 0) {
+        f->errmsg(fmt::format("seek offset n < 0. Must be >= 0, was {}", n));
+        return LFP_INVALID_ARGS;
+    }
+
+    if (max_headers < 1) {
+        const auto msg = "expected max_headers (which is {}) >= 1";
+        f->errmsg(fmt::format(msg, max_headers));
+        return LFP_INVALID_ARGS;
+    }
+
+    return f->seek_step(n, max_headers);
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
 int lfp_tell(lfp_protocol* f, std::int64_t* n) try {
     assert(n);
     assert(f);
@@ -135,6 +163,155 @@ int lfp_peek(lfp_protocol* outer, lfp_protocol** inner) try {
     return e.status();
 }
 
+int lfp_reopen(lfp_protocol* outer, lfp_protocol* inner) try {
+    assert(outer);
+
+    if (!inner) {
+        outer->errmsg("reopen: inner protocol is NULL");
+        return LFP_INVALID_ARGS;
+    }
+
+    if (outer == inner) {
+        outer->errmsg("reopen: protocol can not be reopened on itself");
+        return LFP_INVALID_ARGS;
+    }
+
+    outer->reopen(inner);
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    outer->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    outer->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    outer->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_insert_below(lfp_protocol* outer,
+                     lfp_layer_factory factory,
+                     void* userdata) try {
+    assert(outer);
+
+    if (!factory) {
+        outer->errmsg("insert_below: factory is NULL");
+        return LFP_INVALID_ARGS;
+    }
+
+    outer->insert_below(factory, userdata);
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    outer->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    outer->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    outer->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_recover(lfp_protocol* f) try {
+    assert(f);
+    f->recover();
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_index_size(lfp_protocol* f, std::int64_t* n) try {
+    assert(f);
+    assert(n);
+    *n = f->index_size();
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_index_records(lfp_protocol* f,
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst,
+        std::int64_t* n) try {
+    assert(f);
+    assert(dst or len == 0);
+
+    if (first < 0 or len < 0) {
+        const auto msg = "expected first (which is {}) and len (which is {}) "
+                         ">= 0";
+        f->errmsg(fmt::format(msg, first, len));
+        return LFP_INVALID_ARGS;
+    }
+
+    const auto copied = f->index_records(first, len, dst);
+    if (n)
+        *n = copied;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_translate(lfp_protocol* f,
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::size_t n) try {
+    assert(f);
+    assert((logical and physical) or n == 0);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto prev = i == 0 ? 0 : logical[i - 1];
+        if (logical[i] < prev) {
+            const auto msg = "translate: expected sorted offsets >= 0, but "
+                             "logical[{}] (which is {}) < {}";
+            f->errmsg(fmt::format(msg, i, logical[i], prev));
+            return LFP_INVALID_ARGS;
+        }
+    }
+
+    if (n == 0)
+        return LFP_OK;
+
+    f->translate(logical, physical, std::int64_t(n));
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
 int lfp_eof(lfp_protocol* f) {
     assert(f);
     return f->eof();
@@ -151,6 +328,12 @@ void lfp_protocol::seek(std::int64_t) noexcept (false) {
     throw lfp::not_implemented("seek: not implemented for layer");
 }
 
+lfp_status lfp_protocol::seek_step(std::int64_t n, std::int64_t)
+noexcept (false) {
+    this->seek(n);
+    return LFP_OK;
+}
+
 std::int64_t lfp_protocol::tell() const noexcept (false) {
     throw lfp::not_implemented("tell: not implemented for layer");
 }
@@ -159,6 +342,50 @@ std::int64_t lfp_protocol::ptell() const noexcept (false) {
     throw lfp::not_implemented("ptell: not implemented for layer");
 }
 
+void lfp_protocol::reopen(lfp_protocol*) noexcept (false) {
+    throw lfp::not_implemented("reopen: not implemented for layer");
+}
+
+void lfp_protocol::insert_below(lfp_layer_factory, void*) noexcept (false) {
+    throw lfp::not_implemented("insert_below: not implemented for layer");
+}
+
+void lfp_protocol::splice_below(
+        lfp::unique_lfp& inner,
+        lfp_layer_factory factory,
+        void* userdata)
+noexcept (false) {
+    assert(inner);
+    auto* layer = factory(inner.get(), userdata);
+    if (not layer)
+        throw lfp::runtime_error("insert_below: unable to create layer");
+
+    inner.release();
+    inner = lfp::unique_lfp(layer);
+}
+
+void lfp_protocol::recover() noexcept (false) {
+    throw lfp::not_implemented("recover: not implemented for layer");
+}
+
+std::string lfp_protocol::identity() const noexcept (false) {
+    throw lfp::not_implemented("identity: not implemented for layer");
+}
+
+std::int64_t lfp_protocol::index_size() const noexcept (false) {
+    throw lfp::not_implemented("index_size: not implemented for layer");
+}
+
+std::int64_t lfp_protocol::index_records(std::int64_t, std::int64_t, lfp_record*)
+const noexcept (false) {
+    throw lfp::not_implemented("index_records: not implemented for layer");
+}
+
+void lfp_protocol::translate(const std::int64_t*, std::int64_t*, std::int64_t)
+noexcept (false) {
+    throw lfp::not_implemented("translate: not implemented for layer");
+}
+
 const char* lfp_protocol::errmsg() noexcept (true) {
     if (this->error_message.empty())
         return nullptr;
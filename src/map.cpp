@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <linux/userfaultfd.h>
+    #include <poll.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#include <lfp/map.h>
+#include <lfp/protocol.hpp>
+
+#if not defined(__linux__) or not defined(SYS_userfaultfd)
+
+int lfp_map_logical(lfp_protocol* f, void**, std::int64_t*) {
+    assert(f);
+    f->errmsg("map: userfaultfd is only available on Linux");
+    return LFP_NOTSUPPORTED;
+}
+
+int lfp_unmap_logical(void* ptr) {
+    return ptr ? LFP_INVALID_ARGS : LFP_OK;
+}
+
+#else
+
+/* added in Linux 5.11, and allows unprivileged processes to use userfaultfd */
+#ifndef UFFD_USER_MODE_ONLY
+    #define UFFD_USER_MODE_ONLY 1
+#endif
+
+namespace lfp { namespace {
+
+/*
+ * Bytes populated per fault, from the start of the faulting page and onwards,
+ * rounded up to whole pages. Reading a whole window amortises the seek, and
+ * the cost of the fault itself, over many pages for sequential access.
+ */
+constexpr std::size_t window_bytes = 64 * 1024;
+
+/*
+ * The length of the logical stream of f. Seeking far past the end chases all
+ * the headers without reading any of the record bodies. The tapeimage protocol
+ * does not support offsets past 4GB, so try that if the long seek fails.
+ */
+std::int64_t logical_size(lfp_protocol* f) noexcept (false) {
+    /* throws not_implemented if f has no index, before seeking anywhere */
+    f->index_size();
+
+    try {
+        f->seek((std::numeric_limits< std::int64_t >::max)() / 2);
+    } catch (const lfp::error& e) {
+        if (e.status() != LFP_INVALID_ARGS)
+            throw;
+        f->seek((std::numeric_limits< std::uint32_t >::max)());
+    }
+
+    const auto size = f->index_size();
+    auto records = std::vector< lfp_record >(size);
+    f->index_records(0, size, records.data());
+
+    std::int64_t end = 0;
+    for (const auto& rec : records)
+        end = (std::max)(end, rec.logical + rec.length);
+    return end;
+}
+
+/*
+ * An anonymous, read-only mapping registered with userfaultfd, and the thread
+ * that populates it from the protocol
+ */
+class mapping {
+public:
+    mapping(lfp_protocol* f, std::int64_t len) noexcept (false);
+    ~mapping();
+
+    void* data() const noexcept (true);
+
+    /*
+     * Stop the handler, and report the first error from reading the protocol
+     */
+    int stop() noexcept (true);
+    /*
+     * The message of the first error. Only safe to read after stop().
+     */
+    const std::string& error() const noexcept (true);
+    lfp_protocol* protocol() const noexcept (true);
+
+private:
+    lfp_protocol* fp;
+    std::int64_t len;
+    std::size_t page;
+    std::size_t size = 0;
+    void* base = MAP_FAILED;
+    int uffd = -1;
+    int wakeup[2] = { -1, -1 };
+    std::thread handler;
+    std::vector< unsigned char > buffer;
+
+    /*
+     * first error from reading fp, only written by the handler. The message
+     * is set on fp by the caller, as fp is not safe to share between threads
+     */
+    lfp_status status = LFP_OK;
+    std::string message;
+
+    void fail(lfp_status, const char* what) noexcept (true);
+    void serve() noexcept (true);
+    void populate(std::uintptr_t addr) noexcept (true);
+    void release() noexcept (true);
+};
+
+mapping::mapping(lfp_protocol* f, std::int64_t len) noexcept (false) :
+    fp(f),
+    len(len)
+{
+    this->page = std::size_t(::sysconf(_SC_PAGESIZE));
+    this->size = ((std::size_t(len) + this->page - 1) / this->page) * this->page;
+    const auto window = (window_bytes + this->page - 1) / this->page;
+    this->buffer.resize(window * this->page);
+
+    try {
+        const auto flags = O_CLOEXEC | O_NONBLOCK;
+        this->uffd = int(::syscall(SYS_userfaultfd, flags | UFFD_USER_MODE_ONLY));
+        /* kernels older than 5.11 do not know the user mode flag */
+        if (this->uffd == -1 and errno == EINVAL)
+            this->uffd = int(::syscall(SYS_userfaultfd, flags));
+        if (this->uffd == -1) {
+            const auto msg = "map: userfaultfd: {}";
+            throw not_supported(fmt::format(msg, std::strerror(errno)));
+        }
+
+        uffdio_api api;
+        std::memset(&api, 0, sizeof(api));
+        api.api = UFFD_API;
+        if (::ioctl(this->uffd, UFFDIO_API, &api) == -1) {
+            const auto msg = "map: UFFDIO_API: {}";
+            throw not_supported(fmt::format(msg, std::strerror(errno)));
+        }
+
+        this->base = ::mmap(nullptr,
+                            this->size,
+                            PROT_READ,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                            -1,
+                            0);
+        if (this->base == MAP_FAILED) {
+            const auto msg = "map: unable to reserve {} bytes: {}";
+            throw runtime_error(
+                fmt::format(msg, this->size, std::strerror(errno))
+            );
+        }
+
+        uffdio_register reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.range.start = std::uintptr_t(this->base);
+        reg.range.len   = this->size;
+        reg.mode        = UFFDIO_REGISTER_MODE_MISSING;
+        if (::ioctl(this->uffd, UFFDIO_REGISTER, &reg) == -1) {
+            const auto msg = "map: UFFDIO_REGISTER: {}";
+            throw not_supported(fmt::format(msg, std::strerror(errno)));
+        }
+
+        if (::pipe2(this->wakeup, O_CLOEXEC) == -1) {
+            const auto msg = "map: pipe: {}";
+            throw runtime_error(fmt::format(msg, std::strerror(errno)));
+        }
+
+        this->handler = std::thread(&mapping::serve, this);
+    } catch (...) {
+        this->release();
+        throw;
+    }
+}
+
+mapping::~mapping() {
+    this->stop();
+    this->release();
+}
+
+void* mapping::data() const noexcept (true) {
+    return this->base;
+}
+
+int mapping::stop() noexcept (true) {
+    if (this->handler.joinable()) {
+        const char c = 0;
+        while (::write(this->wakeup[1], &c, 1) == -1 and errno == EINTR)
+            ;
+        this->handler.join();
+    }
+
+    return this->status;
+}
+
+const std::string& mapping::error() const noexcept (true) {
+    return this->message;
+}
+
+lfp_protocol* mapping::protocol() const noexcept (true) {
+    return this->fp;
+}
+
+void mapping::fail(lfp_status err, const char* what) noexcept (true) {
+    if (this->status != LFP_OK)
+        return;
+
+    this->status = err;
+    try {
+        this->message = what;
+    } catch (...) {
+        /* the status is still reported, just without a message */
+    }
+}
+
+void mapping::release() noexcept (true) {
+    /* closing the userfaultfd unregisters the range */
+    if (this->uffd != -1) ::close(this->uffd);
+    if (this->wakeup[0] != -1) ::close(this->wakeup[0]);
+    if (this->wakeup[1] != -1) ::close(this->wakeup[1]);
+    if (this->base != MAP_FAILED) ::munmap(this->base, this->size);
+    this->uffd = this->wakeup[0] = this->wakeup[1] = -1;
+    this->base = MAP_FAILED;
+}
+
+void mapping::serve() noexcept (true) {
+    pollfd fds[2];
+    fds[0].fd = this->uffd;
+    fds[0].events = POLLIN;
+    fds[1].fd = this->wakeup[0];
+    fds[1].events = POLLIN;
+
+    while (true) {
+        fds[0].revents = fds[1].revents = 0;
+        if (::poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        if (fds[1].revents)
+            return;
+
+        uffd_msg msg;
+        const auto n = ::read(this->uffd, &msg, sizeof(msg));
+        if (n != ssize_t(sizeof(msg)))
+            continue;
+
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        this->populate(std::uintptr_t(msg.arg.pagefault.address));
+    }
+}
+
+void mapping::populate(std::uintptr_t addr) noexcept (true) {
+    const auto start = std::uintptr_t(this->base);
+    const auto offset = ((addr - start) / this->page) * this->page;
+    const auto window = (std::min)(this->buffer.size(), this->size - offset);
+    const auto available = (std::min)(
+        std::int64_t(window),
+        this->len - std::int64_t(offset)
+    );
+
+    auto* dst = this->buffer.data();
+    std::int64_t n = 0;
+    try {
+        this->fp->seek(offset);
+        const auto err = this->fp->readinto(dst, available, &n);
+        if (err != LFP_OK and err != LFP_EOF) {
+            const auto msg = "map: incomplete read of {} bytes at offset {}";
+            this->fail(err, fmt::format(msg, available, offset).c_str());
+        }
+    } catch (const lfp::error& e) {
+        this->fail(e.status(), e.what());
+    } catch (const std::exception& e) {
+        this->fail(LFP_UNHANDLED_EXCEPTION, e.what());
+    }
+
+    /* the tail of the last page, and anything that could not be read */
+    std::memset(dst + n, 0, window - std::size_t(n));
+
+    uffdio_copy copy;
+    std::memset(&copy, 0, sizeof(copy));
+    copy.dst  = start + offset;
+    copy.src  = std::uintptr_t(dst);
+    copy.len  = window;
+    copy.mode = 0;
+    if (::ioctl(this->uffd, UFFDIO_COPY, &copy) == 0)
+        return;
+
+    /*
+     * Some pages in the window are populated already. Copying stops at the
+     * first of them, so if that is the faulting page, it was populated by an
+     * earlier fault, and the thread waiting for it must be woken explicitly.
+     */
+    if (errno == EEXIST and copy.copy <= 0) {
+        uffdio_range range;
+        range.start = start + offset;
+        range.len   = this->page;
+        ::ioctl(this->uffd, UFFDIO_WAKE, &range);
+    }
+}
+
+std::mutex mappings_mtx;
+std::map< void*, std::unique_ptr< mapping > > mappings;
+
+}
+
+}
+
+int lfp_map_logical(lfp_protocol* f, void** ptr, std::int64_t* len) try {
+    assert(f);
+    assert(ptr);
+    assert(len);
+
+    const auto size = lfp::logical_size(f);
+    if (size == 0) {
+        *ptr = nullptr;
+        *len = 0;
+        return LFP_OK;
+    }
+
+    auto m = std::unique_ptr< lfp::mapping >(new lfp::mapping(f, size));
+    auto* base = m->data();
+
+    std::lock_guard< std::mutex > lock(lfp::mappings_mtx);
+    lfp::mappings.emplace(base, std::move(m));
+    *ptr = base;
+    *len = size;
+    return LFP_OK;
+} catch (const lfp::error& e) {
+    f->errmsg(e.what());
+    return e.status();
+} catch (const std::exception& e) {
+    f->errmsg(e.what());
+    return LFP_UNHANDLED_EXCEPTION;
+} catch (...) {
+    assert(false);
+    f->errmsg("Unhandled error that does not derive from std::exception");
+    return LFP_UNHANDLED_EXCEPTION;
+}
+
+int lfp_unmap_logical(void* ptr) {
+    if (not ptr)
+        return LFP_OK;
+
+    std::unique_ptr< lfp::mapping > m;
+    {
+        std::lock_guard< std::mutex > lock(lfp::mappings_mtx);
+        auto itr = lfp::mappings.find(ptr);
+        if (itr == lfp::mappings.end())
+            return LFP_INVALID_ARGS;
+        m = std::move(itr->second);
+        lfp::mappings.erase(itr);
+    }
+
+    const auto err = m->stop();
+    if (err == LFP_OK)
+        return err;
+
+    try {
+        m->protocol()->errmsg(m->error());
+    } catch (...) {
+        /* the status is still reported, just without a message */
+    }
+    return err;
+}
+
+#endif
@@ -36,9 +36,14 @@ public:
     void seek(std::int64_t) noexcept (false) override;
     std::int64_t tell() const noexcept (true) override;
     std::int64_t ptell() const noexcept (true) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
 
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    void reopen(lfp_protocol*) noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (true) override;
 
 private:
     std::vector< unsigned char > mem;
@@ -94,6 +99,16 @@ std::int64_t memfile::ptell() const noexcept (true) {
     return this->tell();
 }
 
+void memfile::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    /* like ptell, the physical offsets are the logical offsets */
+    for (std::int64_t i = 0; i < n; ++i)
+        physical[i] = logical[i];
+}
+
 lfp_protocol* memfile::peel() noexcept (false) {
     throw lfp::leaf_protocol("peel: not supported for leaf protocol");
 }
@@ -102,6 +117,18 @@ lfp_protocol* memfile::peek() const noexcept (false) {
     throw lfp::leaf_protocol("peek: not supported for leaf protocol");
 }
 
+void memfile::reopen(lfp_protocol*) noexcept (false) {
+    throw lfp::leaf_protocol("reopen: not supported for leaf protocol");
+}
+
+void memfile::insert_below(lfp_layer_factory, void*) noexcept (false) {
+    throw lfp::leaf_protocol("insert_below: not supported for leaf protocol");
+}
+
+void memfile::recover() noexcept (true) {
+    /* reading memory can't fail, so there is nothing to recover from */
+}
+
 }
 
 }
@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <lfp/protocol.hpp>
+#include <lfp/readahead.h>
+
+#include "tell.hpp"
+
+namespace lfp { namespace {
+
+/* bounds, and the starting point, of the adaptive fill size */
+constexpr std::int64_t min_fill     = 4 * 1024;
+constexpr std::int64_t initial_fill = 64 * 1024;
+constexpr std::int64_t max_fill     = 4 * 1024 * 1024;
+
+/* indexed records used to estimate the size of records not indexed yet */
+constexpr std::int64_t recent_records = 64;
+
+/*
+ * Serve reads from a buffer, filled with large reads from fp.
+ *
+ * The buffer holds the bytes [start, start + buffer.size()) of the stream of
+ * fp. Since fp is only read to fill the buffer, its position is generally not
+ * the position of this layer, so it is tracked in inner, and restored before
+ * it is used for anything else, much like in the cache protocol.
+ */
+class readahead : public lfp_protocol {
+public:
+    readahead(lfp_protocol*, std::int64_t size);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (false) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    lfp_status seek_step(std::int64_t, std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    std::int64_t index_size() const noexcept (false) override;
+    std::int64_t index_records(std::int64_t, std::int64_t, lfp_record*)
+        const noexcept (false) override;
+
+private:
+    unique_lfp fp;
+    bool adaptive;
+    std::int64_t window;
+    /* false when fp turns out to have no record index */
+    bool indexed = true;
+
+    std::vector< unsigned char > buffer;
+    std::int64_t start = 0;
+    /* the furthest the buffer has been read, for the hit rate */
+    std::int64_t served = 0;
+    /* the status of the read that filled the buffer */
+    lfp_status status = LFP_OK;
+    /* sticky recovery status, like in tapeimage and rp66 */
+    lfp_status recovery = LFP_OK;
+
+    std::int64_t pos;
+    /* position of fp, or -1 if unknown */
+    mutable std::int64_t inner;
+
+    std::int64_t end() const noexcept (true);
+    void restore() const noexcept (false);
+    void fill() noexcept (false);
+
+    /* the index size of fp, or 0 if it has no index */
+    std::int64_t indexed_records() noexcept (true);
+    lfp_record record(std::int64_t i) const noexcept (false);
+    /* the average length of the last records in the index, or 0 */
+    std::int64_t typical_record(std::int64_t records) const noexcept (false);
+
+    void adapt(std::int64_t typical) noexcept (true);
+    std::int64_t fill_size(std::int64_t records, std::int64_t typical)
+        const noexcept (false);
+};
+
+bool recovering(lfp_status err) noexcept (true) {
+    return err == LFP_PROTOCOL_TRYRECOVERY
+        or err == LFP_PROTOCOL_FAILEDRECOVERY
+    ;
+}
+
+readahead::readahead(lfp_protocol* f, std::int64_t size) :
+    fp(f),
+    adaptive(size == 0),
+    window(size == 0 ? initial_fill : size),
+    pos(try_tell(f)),
+    inner(pos)
+{
+    /* a layer that can not tell is assumed to be at the start of its stream */
+    if (this->pos == -1)
+        this->pos = this->inner = 0;
+}
+
+void readahead::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status readahead::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    auto* out = static_cast< unsigned char* >(dst);
+    std::int64_t n = 0;
+    lfp_status err = LFP_OK;
+
+    while (n < len) {
+        if (this->start <= this->pos and this->pos < this->end()) {
+            const auto count = (std::min)(len - n, this->end() - this->pos);
+            const auto* src = this->buffer.data() + (this->pos - this->start);
+            std::memcpy(out + n, src, count);
+            n += count;
+            this->pos += count;
+            this->served = (std::max)(this->served, this->pos);
+            continue;
+        }
+
+        if (this->pos == this->end() and this->status == LFP_EOF) {
+            err = LFP_EOF;
+            break;
+        }
+
+        /* large reads gain nothing from going through the buffer */
+        if (len - n >= this->window) {
+            this->restore();
+            std::int64_t m = 0;
+            try {
+                err = this->fp->readinto(out + n, len - n, &m);
+            } catch (...) {
+                this->inner = -1;
+                throw;
+            }
+            n += m;
+            this->pos += m;
+            this->inner = this->pos;
+            break;
+        }
+
+        this->fill();
+        if (this->pos == this->end()) {
+            /* nothing could be read, e.g. a non-blocking read */
+            err = this->status;
+            break;
+        }
+    }
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    if (recovering(err))
+        this->recovery = err;
+
+    if (n == len or err == LFP_OK)
+        return this->recovery ? this->recovery : LFP_OK;
+    return err;
+}
+
+int readahead::eof() const noexcept (false) {
+    if (this->start <= this->pos and this->pos < this->end())
+        return 0;
+
+    if (this->pos == this->end() and this->status == LFP_EOF)
+        return 1;
+
+    if (this->inner == this->pos)
+        return this->fp->eof();
+
+    return 0;
+}
+
+void readahead::seek(std::int64_t n) noexcept (false) {
+    if (not this->buffer.empty() and this->start <= n and n <= this->end()) {
+        this->pos = n;
+        return;
+    }
+
+    try {
+        this->fp->seek(n);
+    } catch (...) {
+        this->inner = -1;
+        throw;
+    }
+    this->pos = this->inner = n;
+}
+
+lfp_status readahead::seek_step(std::int64_t n, std::int64_t max_headers)
+noexcept (false) {
+    lfp_status err;
+    try {
+        err = this->fp->seek_step(n, max_headers);
+        this->pos = this->inner = (err == LFP_OK) ? n : this->fp->tell();
+    } catch (...) {
+        this->inner = -1;
+        throw;
+    }
+    return err;
+}
+
+std::int64_t readahead::tell() const noexcept (false) {
+    return this->pos;
+}
+
+std::int64_t readahead::ptell() const noexcept (false) {
+    this->restore();
+    return this->fp->ptell();
+}
+
+void readahead::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    this->fp->translate(logical, physical, n);
+}
+
+lfp_protocol* readahead::peel() noexcept (false) {
+    assert(this->fp);
+    this->restore();
+    return this->fp.release();
+}
+
+lfp_protocol* readahead::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+void readahead::insert_below(lfp_layer_factory factory, void* userdata)
+noexcept (false) {
+    /* the layer starts where fp is, so inner is still its position */
+    splice_below(this->fp, factory, userdata);
+}
+
+void readahead::recover() noexcept (false) {
+    this->fp->recover();
+    this->buffer.clear();
+    this->status = LFP_OK;
+    this->recovery = LFP_OK;
+    this->inner = try_tell(this->fp);
+    if (this->inner != -1)
+        this->pos = this->inner;
+}
+
+std::string readahead::identity() const noexcept (false) {
+    /* buffering does not change what is read */
+    return this->fp->identity();
+}
+
+std::int64_t readahead::index_size() const noexcept (false) {
+    return this->fp->index_size();
+}
+
+std::int64_t readahead::index_records(
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst)
+const noexcept (false) {
+    return this->fp->index_records(first, len, dst);
+}
+
+std::int64_t readahead::end() const noexcept (true) {
+    return this->start + std::int64_t(this->buffer.size());
+}
+
+void readahead::restore() const noexcept (false) {
+    if (this->inner == this->pos)
+        return;
+
+    this->inner = -1;
+    this->fp.get()->seek(this->pos);
+    this->inner = this->pos;
+}
+
+std::int64_t readahead::indexed_records() noexcept (true) {
+    if (not this->indexed)
+        return 0;
+
+    try {
+        return this->fp->index_size();
+    } catch (const lfp::error&) {
+        this->indexed = false;
+        return 0;
+    }
+}
+
+lfp_record readahead::record(std::int64_t i) const noexcept (false) {
+    lfp_record rec;
+    this->fp->index_records(i, 1, &rec);
+    return rec;
+}
+
+std::int64_t readahead::typical_record(std::int64_t records) const
+noexcept (false) {
+    if (records == 0)
+        return 0;
+
+    const auto count = (std::min)(records, recent_records);
+    const auto first = this->record(records - count);
+    const auto last  = this->record(records - 1);
+    return (last.logical + last.length - first.logical) / count;
+}
+
+void readahead::adapt(std::int64_t typical) noexcept (true) {
+    if (this->buffer.empty())
+        return;
+
+    const auto size = std::int64_t(this->buffer.size());
+    const auto used = this->served - this->start;
+    const auto streak = this->pos == this->end() and used == size;
+
+    if (streak) {
+        this->window = (std::min)(this->window * 2, max_fill);
+        /*
+         * Large records are read from fp one by one regardless, so there is
+         * nothing to gain from filling more than one at a time
+         */
+        if (typical >= initial_fill)
+            this->window = (std::min)(this->window, typical);
+    } else if (used * 2 < size) {
+        this->window = (std::max)(this->window / 2, min_fill);
+    }
+}
+
+std::int64_t readahead::fill_size(std::int64_t records, std::int64_t typical)
+const noexcept (false) {
+    if (records == 0)
+        return this->window;
+
+    /*
+     * Find the record boundaries around the target, and end the fill at the
+     * nearest one. Give up on the alignment if that is far past the target,
+     * and there is no boundary before it in this fill.
+     */
+    const auto target = this->pos + this->window;
+    std::int64_t lo = 0;
+    std::int64_t hi = records;
+    while (lo < hi) {
+        const auto mid = lo + (hi - lo) / 2;
+        const auto rec = this->record(mid);
+        if (rec.logical + rec.length >= target)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    std::int64_t before;
+    std::int64_t after;
+    if (lo < records) {
+        const auto rec = this->record(lo);
+        before = rec.logical;
+        after  = rec.logical + rec.length;
+    } else {
+        /*
+         * The target is past the index, which is the common case when reading
+         * a file for the first time. Assume the records to come are like the
+         * last ones indexed.
+         */
+        if (typical == 0)
+            return this->window;
+
+        const auto last = this->record(records - 1);
+        const auto indexed_end = last.logical + last.length;
+        const auto count = (target - indexed_end + typical - 1) / typical;
+        after  = indexed_end + count * typical;
+        before = after - typical;
+    }
+
+    if (before > this->pos and target - before <= after - target)
+        return before - this->pos;
+
+    if (after - this->pos <= 2 * this->window)
+        return (std::min)(after - this->pos, max_fill);
+
+    if (before > this->pos)
+        return before - this->pos;
+
+    return this->window;
+}
+
+void readahead::fill() noexcept (false) {
+    auto size = this->window;
+    if (this->adaptive) {
+        const auto records = this->indexed_records();
+        const auto typical = this->typical_record(records);
+        this->adapt(typical);
+        size = this->fill_size(records, typical);
+    }
+
+    this->restore();
+    this->buffer.resize(size);
+    this->start = this->served = this->pos;
+
+    std::int64_t n = 0;
+    try {
+        this->status = this->fp->readinto(this->buffer.data(), size, &n);
+    } catch (...) {
+        this->buffer.clear();
+        this->status = LFP_OK;
+        this->inner = -1;
+        throw;
+    }
+
+    this->buffer.resize(n);
+    this->inner = this->pos + n;
+}
+
+}
+
+}
+
+lfp_protocol* lfp_readahead_open(lfp_protocol* f, std::int64_t size) {
+    if (not f) return nullptr;
+    if (size < 0) return nullptr;
+
+    try {
+        return new lfp::readahead(f, size);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <ciso646>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+#include <lfp/lfp.h>
+
+#include "registry.hpp"
+
+namespace lfp {
+
+bool index_registry::enabled() const noexcept (true) {
+    return this->on.load(std::memory_order_relaxed);
+}
+
+void index_registry::enable(bool on) noexcept (true) {
+    this->on.store(on, std::memory_order_relaxed);
+}
+
+void index_registry::clear() noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    this->entries.clear();
+}
+
+index_registry::snapshot index_registry::lookup(
+        const std::string& key,
+        std::size_t* size)
+const noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    const auto itr = std::find_if(
+        this->entries.begin(),
+        this->entries.end(),
+        [&key] (const entry& e) { return e.key == key; }
+    );
+
+    if (itr == this->entries.end()) {
+        *size = 0;
+        return nullptr;
+    }
+
+    *size = itr->size;
+    return itr->index;
+}
+
+void index_registry::publish(
+        const std::string& key,
+        snapshot index,
+        std::size_t size)
+noexcept (false) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    auto itr = std::find_if(
+        this->entries.begin(),
+        this->entries.end(),
+        [&key] (const entry& e) { return e.key == key; }
+    );
+
+    if (itr != this->entries.end()) {
+        /* someone might have published a larger index while copying */
+        if (itr->size >= size)
+            return;
+        this->entries.erase(itr);
+    }
+
+    this->entries.push_front(entry { key, std::move(index), size });
+    if (this->entries.size() > this->capacity)
+        this->entries.pop_back();
+}
+
+index_registry& registry() noexcept (true) {
+    static index_registry reg;
+    return reg;
+}
+
+}
+
+void lfp_index_registry_enable(int enable) {
+    lfp::registry().enable(enable != 0);
+}
+
+void lfp_index_registry_clear() {
+    lfp::registry().clear();
+}
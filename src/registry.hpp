@@ -0,0 +1,103 @@
+#ifndef LFP_REGISTRY_HPP
+#define LFP_REGISTRY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lfp {
+
+/*
+ * Process-wide registry of record indices, keyed by lfp_protocol::identity().
+ *
+ * Protocols publish a snapshot of their index when they close, or when they
+ * have indexed the whole file, and look up published indices when they are
+ * opened, and before chasing headers past the end of their own index. Both
+ * the file and the protocol stack (including offsets) are part of the key, so
+ * a published index is valid for every protocol with the same key.
+ *
+ * The snapshots are immutable and shared, so looking up an index is cheap,
+ * but adopting it means copying the (run-length encoded) headers into the
+ * protocol's own index.
+ * Every protocol still owns its index, and no locking is needed outside the
+ * registry itself.
+ *
+ * The registry is type-erased, and the protocol name in the key guarantees
+ * that only the protocol that published an index will look it up.
+ */
+class index_registry {
+public:
+    using snapshot = std::shared_ptr< const void >;
+
+    bool enabled() const noexcept (true);
+    void enable(bool) noexcept (true);
+    void clear() noexcept (true);
+
+    /*
+     * Get the index published for key, or nullptr. The number of headers in
+     * the index is written to size.
+     */
+    snapshot lookup(const std::string& key, std::size_t* size)
+        const noexcept (false);
+
+    /*
+     * Publish the index for key, unless an index at least as large is already
+     * published. The least recently published index is dropped if the
+     * registry is full.
+     */
+    void publish(const std::string& key, snapshot, std::size_t size)
+        noexcept (false);
+
+private:
+    struct entry {
+        std::string key;
+        snapshot index;
+        std::size_t size;
+    };
+
+    std::atomic< bool > on { false };
+    mutable std::mutex mtx;
+    /* most recently published first */
+    std::list< entry > entries;
+    std::size_t capacity = 64;
+};
+
+index_registry& registry() noexcept (true);
+
+/*
+ * Get the published runs of headers for key, or nullptr. The number of
+ * headers in the index is written to size.
+ */
+template < typename Run >
+std::shared_ptr< const std::vector< Run > >
+lookup_index(const std::string& key, std::size_t* size) noexcept (false) {
+    const auto index = registry().lookup(key, size);
+    return std::static_pointer_cast< const std::vector< Run > >(index);
+}
+
+/*
+ * Publish the runs of headers, with size headers in total, for key.
+ * Publishing is best-effort, and failing to publish is not an error.
+ */
+template < typename Run >
+void publish_index(const std::string& key,
+                   const std::vector< Run >& runs,
+                   std::size_t size)
+noexcept (true) {
+    try {
+        std::size_t published = 0;
+        if (registry().lookup(key, &published) and published >= size)
+            return;
+
+        auto index = std::make_shared< const std::vector< Run > >(runs);
+        registry().publish(key, index, size);
+    } catch (...) {}
+}
+
+}
+
+#endif // LFP_REGISTRY_HPP
@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <ciso646>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <lfp/protocol.hpp>
+#include <lfp/retry.h>
+
+#include "tell.hpp"
+
+namespace lfp { namespace {
+
+/*
+ * Retry reads and seeks that fail with an io_error, after putting the
+ * underlying protocol back into a consistent state with recover().
+ *
+ * The logical position is tracked in this layer, rather than queried before
+ * every read, so that the happy path costs nothing more than a virtual call.
+ * When a read fails, the tell of the recovered protocol tells how much of the
+ * read actually made it into the buffer.
+ */
+class retry : public lfp_protocol {
+public:
+    retry(lfp_protocol*, int attempts, int delay);
+
+    void close() noexcept (false) override;
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+        noexcept (false) override;
+
+    int eof() const noexcept (false) override;
+
+    void seek(std::int64_t) noexcept (false) override;
+    lfp_status seek_step(std::int64_t, std::int64_t) noexcept (false) override;
+    std::int64_t tell() const noexcept (false) override;
+    std::int64_t ptell() const noexcept (false) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
+    lfp_protocol* peel() noexcept (false) override;
+    lfp_protocol* peek() const noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    std::int64_t index_size() const noexcept (false) override;
+    std::int64_t index_records(std::int64_t, std::int64_t, lfp_record*)
+        const noexcept (false) override;
+
+private:
+    unique_lfp fp;
+    int attempts;
+    int delay;
+
+    /* logical position of fp, or -1 if unknown */
+    std::int64_t pos;
+
+    /*
+     * Wait, and recover the underlying protocol before retry number attempt.
+     * Returns false if the operation should not be retried, i.e. it is out of
+     * attempts, or the protocol could not be recovered.
+     */
+    bool backoff(int attempt) noexcept (false);
+};
+
+bool transient(const lfp::error& e) noexcept (true) {
+    return e.status() == LFP_IOERROR;
+}
+
+retry::retry(lfp_protocol* f, int attempts, int delay) :
+    fp(f),
+    attempts(attempts),
+    delay(delay),
+    pos(try_tell(f))
+{}
+
+void retry::close() noexcept (false) {
+    if (!this->fp) return;
+    this->fp.close();
+}
+
+lfp_status retry::readinto(
+        void* dst,
+        std::int64_t len,
+        std::int64_t* bytes_read)
+noexcept (false) {
+    std::int64_t done = 0;
+    for (int attempt = 0;; ++attempt) {
+        try {
+            std::int64_t n = 0;
+            const auto err = this->fp->readinto(advance(dst, done),
+                                                len - done,
+                                                &n);
+            done += n;
+            if (bytes_read)
+                *bytes_read = done;
+            if (this->pos != -1)
+                this->pos += n;
+            return err;
+        } catch (const lfp::error& e) {
+            if (not transient(e) or this->pos == -1)
+                throw;
+
+            /*
+             * fp is somewhere in this read, or was recovered to somewhere
+             * else, so pos can no longer be trusted
+             */
+            if (not this->backoff(attempt)) {
+                this->pos = -1;
+                throw;
+            }
+
+            /*
+             * The recovered protocol is at the end of the bytes that were
+             * successfully read before the error. If it is not within this
+             * read, something is off, and the tell can't be trusted
+             */
+            const auto tell = try_tell(this->fp);
+            const auto progress = tell - this->pos;
+            if (tell == -1 or progress < done or progress > len) {
+                this->pos = -1;
+                throw;
+            }
+
+            done = progress;
+        }
+    }
+}
+
+int retry::eof() const noexcept (false) {
+    return this->fp->eof();
+}
+
+void retry::seek(std::int64_t n) noexcept (false) {
+    for (int attempt = 0;; ++attempt) {
+        try {
+            this->fp->seek(n);
+            this->pos = n;
+            return;
+        } catch (const lfp::error& e) {
+            if (transient(e) and this->backoff(attempt))
+                continue;
+
+            /* fp may have been moved, or recovered, by the failed attempts */
+            this->pos = try_tell(this->fp);
+            throw;
+        }
+    }
+}
+
+lfp_status retry::seek_step(std::int64_t n, std::int64_t max_headers)
+noexcept (false) {
+    for (int attempt = 0;; ++attempt) {
+        try {
+            const auto err = this->fp->seek_step(n, max_headers);
+            this->pos = (err == LFP_OK) ? n : this->fp->tell();
+            return err;
+        } catch (const lfp::error& e) {
+            if (transient(e) and this->backoff(attempt))
+                continue;
+
+            this->pos = try_tell(this->fp);
+            throw;
+        }
+    }
+}
+
+std::int64_t retry::tell() const noexcept (false) {
+    return this->fp->tell();
+}
+
+std::int64_t retry::ptell() const noexcept (false) {
+    return this->fp->ptell();
+}
+
+void retry::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    this->fp->translate(logical, physical, n);
+}
+
+lfp_protocol* retry::peel() noexcept (false) {
+    assert(this->fp);
+    return this->fp.release();
+}
+
+lfp_protocol* retry::peek() const noexcept (false) {
+    assert(this->fp);
+    return this->fp.get();
+}
+
+void retry::insert_below(lfp_layer_factory factory, void* userdata)
+noexcept (false) {
+    splice_below(this->fp, factory, userdata);
+}
+
+void retry::recover() noexcept (false) {
+    this->fp->recover();
+    this->pos = try_tell(this->fp);
+}
+
+std::string retry::identity() const noexcept (false) {
+    /* retrying does not change what is read, so it's not part of the identity */
+    return this->fp->identity();
+}
+
+std::int64_t retry::index_size() const noexcept (false) {
+    return this->fp->index_size();
+}
+
+std::int64_t retry::index_records(
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst)
+const noexcept (false) {
+    return this->fp->index_records(first, len, dst);
+}
+
+bool retry::backoff(int attempt) noexcept (false) {
+    if (attempt >= this->attempts)
+        return false;
+
+    /* double the wait for every attempt, but don't overflow the shift */
+    const auto wait = std::chrono::milliseconds(this->delay)
+                    * (std::int64_t(1) << (std::min)(attempt, 20));
+    std::this_thread::sleep_for(wait);
+
+    try {
+        this->fp->recover();
+    } catch (const lfp::error&) {
+        return false;
+    }
+
+    return true;
+}
+
+}
+
+}
+
+lfp_protocol* lfp_retry_open(lfp_protocol* f, int attempts, int delay) {
+    if (not f) return nullptr;
+    if (attempts < 0 or delay < 0) return nullptr;
+
+    try {
+        return new lfp::retry(f, attempts, delay);
+    } catch (...) {
+        return nullptr;
+    }
+}
@@ -1,6 +1,8 @@
 #include <cassert>
 #include <ciso646>
+#include <iterator>
 #include <limits>
+#include <string>
 #include <vector>
 #include <cstring>
 #include <cstdint>
@@ -11,6 +13,9 @@
 #include <lfp/protocol.hpp>
 #include <lfp/rp66.h>
 
+#include "registry.hpp"
+#include "tell.hpp"
+
 namespace lfp { namespace {
 
 struct header {
@@ -70,14 +75,76 @@ private:
 };
 
 /*
- * The record headers already read by rp66, stored in an order
- * (lower-address first fashion).
+ * A run of consecutive Visible Records with the same header, i.e. the same
+ * length and format version. Some files have enormous runs of empty (4-byte)
+ * or tiny Visible Records, and storing the runs rather than the records keeps
+ * the index small.
+ *
+ * The number of records in the run is implied by the first record of the
+ * next run.
  */
-class record_index : private std::vector< header > {
-    using base = std::vector< header >;
+struct run {
+    std::uint16_t  length;
+    unsigned char  format;
+    std::uint8_t   major;
+    /* the offset of the first record */
+    std::int64_t offset;
+    /* the position in the index of the first record */
+    std::int64_t first;
+};
 
+/*
+ * The record headers already read by rp66, stored in an order
+ * (lower-address first fashion), as runs of equally sized records.
+ *
+ * The iterators are positions in the index, and dereference to headers that
+ * are computed from the runs. They are not invalidated by append().
+ */
+class record_index {
 public:
-    using iterator = base::const_iterator;
+    /*
+     * Lightweight proxy so that iterator->length works, even though there is
+     * no stored header to point to
+     */
+    struct arrow {
+        header h;
+        const header* operator -> () const noexcept (true) { return &this->h; }
+    };
+
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = header;
+        using difference_type   = std::int64_t;
+        using pointer           = arrow;
+        using reference         = header;
+
+        iterator() = default;
+
+        header operator * () const noexcept (true);
+        arrow operator -> () const noexcept (true);
+
+        iterator& operator ++ () noexcept (true);
+        iterator& operator -- () noexcept (true);
+        iterator& operator += (difference_type) noexcept (true);
+        iterator operator + (difference_type) const noexcept (true);
+        difference_type operator - (const iterator&) const noexcept (true);
+
+        bool operator == (const iterator&) const noexcept (true);
+        bool operator < (const iterator&) const noexcept (true);
+
+    private:
+        friend class record_index;
+        iterator(const record_index* index, std::int64_t pos) noexcept (true) :
+            index(index),
+            pos(pos)
+        {}
+
+        const record_index* index = nullptr;
+        std::int64_t pos = 0;
+        /* the run of the last dereference, which is usually right */
+        mutable std::size_t run = 0;
+    };
 
     explicit record_index(address_map m);
     /*
@@ -94,17 +161,60 @@ public:
      */
     iterator find(std::int64_t n, iterator hint) const noexcept (false);
 
+    /*
+     * Find the first record at or after itr that is not empty, or last() if
+     * there is none. Runs of empty records are skipped in one step.
+     */
+    iterator skip_empty(iterator itr) const noexcept (true);
+
+    /*
+     * Remove all headers, and re-initialise the index for a new file. The
+     * allocated capacity is kept.
+     */
+    void reset(address_map m) noexcept (false);
+
     void append(const header& head) noexcept (false);
 
+    /*
+     * Replace the index with a copy of runs, e.g. an index published by
+     * another handle of the same file, with size records. If this throws, the
+     * index is unchanged.
+     */
+    void assign(const std::vector< run >& runs, std::size_t size)
+        noexcept (false);
+
+    const std::vector< run >& run_list() const noexcept (true);
+
     iterator last() const noexcept (true);
     std::size_t size() const noexcept (true);
     bool empty() const noexcept (true);
     iterator begin() const noexcept (true);
+    iterator end() const noexcept (true);
 
     iterator::difference_type index_of(const iterator&) const noexcept (true);
 
 private:
     address_map addr;
+    std::vector< run > runs;
+    /* number of records, including the ghost */
+    std::int64_t entries = 0;
+
+    /*
+     * Get the run of the record at pos, checking the hint first
+     */
+    std::size_t run_of(std::int64_t pos, std::size_t hint) const noexcept (true);
+    /*
+     * Position of the record after the last record in run r
+     */
+    std::int64_t run_end(std::size_t r) const noexcept (true);
+    /*
+     * The header of the record at pos in run r
+     */
+    header header_of(std::size_t r, std::int64_t pos) const noexcept (true);
+    /*
+     * Logical address of the end of the record at pos in run r
+     */
+    std::int64_t end_of(std::size_t r, std::int64_t pos) const noexcept (true);
 };
 
 /**
@@ -152,12 +262,6 @@ public:
      */
     void skip() noexcept (true);
 
-    /*
-     * Get a read head moved to the start of the next record. Behaviour is
-     * undefined if this is the last record in the file.
-     */
-    read_head next_record() const noexcept (true);
-
     /*
      * The position of the read head. This should correspond to the offset
      * reported by the underlying file.
@@ -173,9 +277,6 @@ class rp66 : public lfp_protocol {
 public:
     rp66(lfp_protocol*);
 
-    // TODO: there must be a "reset" semantic for when there's a read error to
-    // put it back into a valid state
-
     void close() noexcept (false) override;
     lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
         noexcept (false) override;
@@ -184,8 +285,19 @@ public:
     std::int64_t tell() const noexcept (true) override;
     std::int64_t ptell() const noexcept (true) override;
     void seek(std::int64_t) noexcept (false) override;
+    lfp_status seek_step(std::int64_t, std::int64_t) noexcept (false) override;
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    void reopen(lfp_protocol*) noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    std::int64_t index_size() const noexcept (true) override;
+    std::int64_t index_records(std::int64_t, std::int64_t, lfp_record*)
+        const noexcept (true) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
 
 private:
     unique_lfp fp;
@@ -195,6 +307,33 @@ private:
 
     std::int64_t readinto(void*, std::int64_t) noexcept (false);
     bool read_header_from_disk() noexcept (false);
+    /*
+     * The logical end of the last indexed record
+     */
+    std::int64_t indexed() const noexcept (true);
+    /*
+     * Read headers from disk until the index covers the logical offset n, or
+     * there are no more headers. The read head is not moved, and fp is put
+     * back at the read head afterwards.
+     */
+    void index_to(std::int64_t n) noexcept (false);
+
+    /*
+     * Key of this protocol in the index registry, or empty if the registry
+     * is disabled or the file can't be identified.
+     */
+    std::string key;
+
+    /*
+     * Look up the key in the registry, and adopt any published index.
+     */
+    void attach() noexcept (true);
+    /*
+     * Adopt the published index, if it has more headers than this index.
+     * Returns true if it was adopted, which invalidates the read head.
+     */
+    bool adopt() noexcept (true);
+    void publish() const noexcept (true);
 };
 
 std::int64_t
@@ -213,7 +352,15 @@ std::int64_t address_map::zero() const noexcept (true) {
     return this->bzero;
 }
 
-record_index::record_index(address_map m) : addr(m) {
+record_index::record_index(address_map m) {
+    this->reset(m);
+}
+
+void record_index::reset(address_map m) noexcept (false) {
+    this->runs.clear();
+    this->entries = 0;
+    this->addr = m;
+
     header ghost;
 
     /**
@@ -262,64 +409,107 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
         return hint;
     }
 
-    const auto begin = this->begin();
-    const auto end   = this->end();
-
     /**
      * Look up the record containing the logical offset n in the index.
      *
      * seek() is a pretty common operation, and experience from dlisio [1]
      * shows that a poor algorithm here significantly slows down programs.
      *
-     * The algorithm actually makes two searches:
-     *
-     * Phase 1 is an approximating binary search that pretends the logical and
-     * phyiscal offset are the same. Since phyiscal offset >= logical offset,
-     * we know that the result is always correct or before the correct one in
-     * the ordered index.
+     * The logical ends of the records in a run are equally spaced, so this is
+     * a binary search for the first run that ends after n, followed by some
+     * arithmetic to find the record within the run.
      *
-     * Phase 2 is a linear search from [cur, end) that is aware of the
-     * logical/base offset distinction. Because of the approximation, it
-     * should do fairly few hops.
-     *
-     * The main reason for the two-phase search is that an elements' index is
-     * required to compare logical addresses to base ones, and upper_bound
-     * is oblivious to the current item's position.
+     * [1] https://github.com/equinor/dlisio
      */
-
-    // phase 1
-    const auto addr = this->addr;
-    auto less = [addr] (std::int64_t n, const header& h) noexcept (true) {
-        return n < addr.logical(h.offset + h.length, 0);
+    const auto less = [this] (std::int64_t n, const run& r) noexcept (true) {
+        const auto i = std::size_t(&r - this->runs.data());
+        return n < this->end_of(i, this->run_end(i) - 1);
     };
-    const auto lower = std::upper_bound(begin, end, n, less);
 
-    // phase 2
-    /*
-     * We found the right record when record->next > n. All hits after will
-     * also be a match, but this is ok since the search is in an ordered list.
-     */
-    auto pos = this->index_of(lower);
-    auto next_larger = [addr, n, pos] (const header& rec) mutable {
-        return n < addr.logical(rec.offset + rec.length, pos++);
-    };
-
-    const auto cur = std::find_if(lower, end, next_larger);
-    if (cur >= this->end()) {
+    /* the first run is the ghost node */
+    const auto begin = std::next(this->runs.begin());
+    const auto end   = this->runs.end();
+    const auto itr = std::upper_bound(begin, end, n, less);
+    if (itr == end) {
+        const auto last = this->last();
         const auto msg = "seek: n = {} not found in index, last indexed byte {}";
         throw std::logic_error(
-                fmt::format(msg, n, this->back().offset + this->back().length));
+                fmt::format(msg, n, last->offset + last->length));
+    }
+
+    const auto r = std::size_t(std::distance(this->runs.begin(), itr));
+    const auto first = itr->first;
+    const auto first_end = this->end_of(r, first);
+
+    std::int64_t k = 0;
+    if (n >= first_end) {
+        /*
+         * n is past the first record, and before the end of the run, so the
+         * records in the run are not empty
+         */
+        const auto size = std::int64_t(itr->length) - header::size;
+        assert(size > 0);
+        k = (n - first_end) / size + 1;
     }
 
+    auto cur = iterator(this, first + k);
+    cur.run = r;
     return cur;
 }
 
+record_index::iterator
+record_index::skip_empty(iterator itr) const noexcept (true) {
+    const auto last = this->last();
+    while (itr < last) {
+        const auto r = this->run_of(itr.pos, itr.run);
+        if (this->runs[r].length != header::size)
+            return itr;
+
+        itr = (std::min)(iterator(this, this->run_end(r)), last);
+    }
+
+    return itr;
+}
+
 void record_index::append(const header& head) noexcept (false) {
+    if (not this->runs.empty()) {
+        const auto& back = this->runs.back();
+        const auto count = this->entries - back.first;
+        const auto same = head.length == back.length
+                      and head.format == back.format
+                      and head.major  == back.major
+                      and head.offset == back.offset + count * back.length
+                      ;
+
+        if (same) {
+            this->entries += 1;
+            return;
+        }
+    }
+
     try {
-        this->push_back(head);
+        this->runs.push_back(run {
+            head.length,
+            head.format,
+            head.major,
+            head.offset,
+            this->entries,
+        });
     } catch (...) {
         throw runtime_error("rp66: unable to store header");
     }
+    this->entries += 1;
+}
+
+void record_index::assign(const std::vector< run >& xs, std::size_t size)
+noexcept (false) {
+    auto copy = xs;
+    this->runs.swap(copy);
+    this->entries = std::int64_t(size) + 1;
+}
+
+const std::vector< run >& record_index::run_list() const noexcept (true) {
+    return this->runs;
 }
 
 record_index::iterator
@@ -328,7 +518,7 @@ record_index::last() const noexcept (true) {
 }
 
 std::size_t record_index::size() const noexcept (true) {
-    return this->base::size() - 1;
+    return this->entries - 1;
 }
 
 bool record_index::empty() const noexcept (true) {
@@ -336,7 +526,11 @@ bool record_index::empty() const noexcept (true) {
 }
 
 record_index::iterator record_index::begin() const noexcept (true) {
-    return this->base::begin() + 1;
+    return iterator(this, 1);
+}
+
+record_index::iterator record_index::end() const noexcept (true) {
+    return iterator(this, this->entries);
 }
 
 record_index::iterator::difference_type
@@ -344,6 +538,104 @@ record_index::index_of(const iterator& itr) const noexcept (true) {
     return std::distance(this->begin(), itr);
 }
 
+std::size_t record_index::run_of(std::int64_t pos, std::size_t hint)
+const noexcept (true) {
+    assert(pos >= 0 and pos < this->entries);
+    const auto in = [this, pos] (std::size_t r) noexcept (true) {
+        return r < this->runs.size()
+           and this->runs[r].first <= pos
+           and pos < this->run_end(r)
+        ;
+    };
+
+    /* sequential reads are in the same run, or the next */
+    if (in(hint))     return hint;
+    if (in(hint + 1)) return hint + 1;
+
+    const auto less = [] (std::int64_t pos, const run& r) noexcept (true) {
+        return pos < r.first;
+    };
+    const auto itr = std::upper_bound(this->runs.begin(),
+                                      this->runs.end(),
+                                      pos,
+                                      less);
+    return std::distance(this->runs.begin(), itr) - 1;
+}
+
+std::int64_t record_index::run_end(std::size_t r) const noexcept (true) {
+    if (r + 1 < this->runs.size())
+        return this->runs[r + 1].first;
+    return this->entries;
+}
+
+header record_index::header_of(std::size_t r, std::int64_t pos)
+const noexcept (true) {
+    const auto& x = this->runs[r];
+    header h;
+    h.length = x.length;
+    h.format = x.format;
+    h.major  = x.major;
+    h.offset = x.offset + (pos - x.first) * x.length;
+    return h;
+}
+
+std::int64_t record_index::end_of(std::size_t r, std::int64_t pos)
+const noexcept (true) {
+    const auto h = this->header_of(r, pos);
+    return this->addr.logical(h.offset + h.length, pos - 1);
+}
+
+header record_index::iterator::operator * () const noexcept (true) {
+    assert(this->index);
+    this->run = this->index->run_of(this->pos, this->run);
+    return this->index->header_of(this->run, this->pos);
+}
+
+record_index::arrow record_index::iterator::operator -> ()
+const noexcept (true) {
+    return arrow { **this };
+}
+
+record_index::iterator& record_index::iterator::operator ++ ()
+noexcept (true) {
+    this->pos += 1;
+    return *this;
+}
+
+record_index::iterator& record_index::iterator::operator -- ()
+noexcept (true) {
+    this->pos -= 1;
+    return *this;
+}
+
+record_index::iterator&
+record_index::iterator::operator += (difference_type n) noexcept (true) {
+    this->pos += n;
+    return *this;
+}
+
+record_index::iterator
+record_index::iterator::operator + (difference_type n) const noexcept (true) {
+    auto copy = *this;
+    return copy += n;
+}
+
+record_index::iterator::difference_type
+record_index::iterator::operator - (const iterator& other)
+const noexcept (true) {
+    return this->pos - other.pos;
+}
+
+bool record_index::iterator::operator == (const iterator& other)
+const noexcept (true) {
+    return this->pos == other.pos;
+}
+
+bool record_index::iterator::operator < (const iterator& other)
+const noexcept (true) {
+    return this->pos < other.pos;
+}
+
 read_head read_head::ghost(const base_type& b) noexcept (true) {
     auto x = read_head(b);
     x.remaining = 0;
@@ -386,13 +678,6 @@ void read_head::skip() noexcept (true) {
     this->remaining = 0;
 }
 
-read_head read_head::next_record() const noexcept (true) {
-    assert(this->remaining >= 0);
-    auto next = *this;
-    next.move(std::next(*this));
-    return next;
-}
-
 std::int64_t read_head::tell() const noexcept (true) {
     assert(this->remaining >= 0);
     return (*this)->offset + (*this)->length - this->remaining;
@@ -411,11 +696,13 @@ rp66::rp66(lfp_protocol* f) :
     addr(baseaddr(f)),
     index(this->addr)
 {
-    this->current = read_head::ghost(this->index.last());
+    this->attach();
+    this->current = read_head::ghost(std::prev(this->index.begin()));
 }
 
 void rp66::close() noexcept (false) {
     if(!this->fp) return;
+    this->publish();
     this->fp.close();
 }
 
@@ -429,6 +716,101 @@ lfp_protocol* rp66::peek() const noexcept (false) {
     return this->fp.get();
 }
 
+void rp66::reopen(lfp_protocol* f) noexcept (false) {
+    assert(f);
+    /*
+     * Inspect f before anything is changed, and close the old handle before
+     * taking ownership of f, like tapeimage does
+     */
+    const auto addr = address_map(baseaddr(f));
+    if (this->fp) {
+        this->fp.close();
+        this->publish();
+    }
+
+    this->index.reset(addr);
+    this->addr = addr;
+    this->errmsg("");
+    this->fp = unique_lfp(f);
+    this->attach();
+    this->current = read_head::ghost(std::prev(this->index.begin()));
+}
+
+void rp66::insert_below(lfp_layer_factory factory, void* userdata)
+noexcept (false) {
+    /*
+     * The layer presents the same stream as fp, from the same position, so
+     * the index, address map and read head are all still valid. The registry
+     * key is kept too, since the layer forwards the identity of fp.
+     */
+    splice_below(this->fp, factory, userdata);
+}
+
+void rp66::recover() noexcept (false) {
+    /*
+     * The read head is only moved after successful reads from the underlying
+     * layer, so it still points to the last good position after an error.
+     * Recover the underlying layer and move it back to the read head.
+     */
+    try {
+        this->fp->recover();
+    } catch (const lfp::error& e) {
+        if (e.status() != LFP_NOTIMPLEMENTED) throw;
+    }
+
+    const auto pos = this->current.tell();
+    if (try_tell(this->fp) != pos)
+        this->fp->seek(pos);
+}
+
+std::string rp66::identity() const noexcept (false) {
+    return fmt::format("{}/rp66@{}", this->fp->identity(), this->addr.zero());
+}
+
+void rp66::attach() noexcept (true) {
+    this->key.clear();
+    if (not registry().enabled())
+        return;
+
+    try {
+        this->key = this->identity();
+    } catch (...) {
+        this->key.clear();
+        return;
+    }
+
+    this->adopt();
+}
+
+bool rp66::adopt() noexcept (true) {
+    if (this->key.empty())
+        return false;
+
+    try {
+        std::size_t size = 0;
+        const auto published = lookup_index< run >(this->key, &size);
+        if (not published or size <= this->index.size())
+            return false;
+
+        /*
+         * The published index is of the same file and protocol stack, so it
+         * starts with the same headers as this one
+         */
+        this->index.assign(*published, size);
+        return true;
+    } catch (...) {
+        /* the index is unchanged */
+        return false;
+    }
+}
+
+void rp66::publish() const noexcept (true) {
+    if (this->key.empty())
+        return;
+
+    publish_index(this->key, this->index.run_list(), this->index.size());
+}
+
 lfp_status rp66::readinto(
         void* dst,
         std::int64_t len,
@@ -475,6 +857,102 @@ int rp66::eof() const noexcept (true) {
     return this->fp->eof();
 }
 
+std::int64_t rp66::indexed() const noexcept (true) {
+    /*
+     * index.contains() is off by one header, which is harmless for seek(),
+     * but would put the end of the file past the index in translate()
+     */
+    const auto last = this->index.last();
+    return this->addr.logical(last->offset + last->length,
+                              this->index.index_of(last));
+}
+
+void rp66::index_to(std::int64_t n) noexcept (false) {
+    const auto restore = [this] {
+        const auto head = this->current.tell();
+        if (try_tell(this->fp) != head)
+            this->fp->seek(head);
+    };
+
+    try {
+        while (n >= this->indexed()) {
+            const auto last = this->index.last();
+            const auto end = last->offset + last->length;
+            if (try_tell(this->fp) != end) {
+                try {
+                    this->fp->seek(end);
+                } catch (const error& e) {
+                    /*
+                     * Some leaves, e.g. memfile, refuse to seek to their end,
+                     * where there are no more headers anyway
+                     */
+                    if (e.status() != LFP_INVALID_ARGS)
+                        throw;
+                    break;
+                }
+            }
+
+            if (not this->read_header_from_disk())
+                break;
+        }
+    } catch (...) {
+        /*
+         * Report the error from reading the headers. If fp can not be put
+         * back either, recover() can still do it from the read head.
+         */
+        try {
+            restore();
+        } catch (...) {}
+        throw;
+    }
+
+    restore();
+}
+
+void rp66::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    /*
+     * Read the headers past the last offset, like tapeimage does. Only the
+     * headers are read, so the position is unchanged.
+     */
+    if (logical[n - 1] >= this->indexed())
+        this->index_to(logical[n - 1]);
+
+    /*
+     * Find the offsets in fp that seek() would go to, with the record of the
+     * previous offset as the hint, and let fp translate them in turn
+     */
+    const auto end = this->indexed();
+    record_index::iterator itr = this->current;
+    for (std::int64_t i = 0; i < n; ++i) {
+        const auto x = logical[i];
+        if (x < end) {
+            itr = this->index.find(x, itr);
+            physical[i] = this->addr.base(x, this->index.index_of(itr));
+            continue;
+        }
+
+        /* the end of the file, i.e. the end of the record with the last byte */
+        if (x == 0) {
+            physical[i] = this->addr.zero();
+            continue;
+        }
+
+        if (x > end) {
+            const auto msg = "translate: offset (= {}) is past end-of-file";
+            throw invalid_args(fmt::format(msg, x));
+        }
+
+        itr = this->index.find(x - 1, itr);
+        physical[i] = this->addr.base(x, this->index.index_of(itr));
+    }
+
+    this->fp->translate(physical, physical, n);
+}
+
 std::int64_t rp66::tell() const noexcept (true) {
     const auto pos = this->index.index_of(this->current);
     return this->addr.logical(this->current.tell(), pos);
@@ -484,7 +962,46 @@ std::int64_t rp66::ptell() const noexcept (true) {
     return this->fp->ptell();
 }
 
+std::int64_t rp66::index_size() const noexcept (true) {
+    return this->index.size();
+}
+
+std::int64_t rp66::index_records(
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst)
+const noexcept (true) {
+    /* first + len can overflow, so clamp len first */
+    const auto size = std::int64_t(this->index.size());
+    const auto count = (std::max)(std::int64_t(0),
+                                  (std::min)(len, size - first));
+    const auto last = first + count;
+
+    std::int64_t n = 0;
+    for (auto i = first; i < last; ++i, ++n) {
+        const auto itr = this->index.begin() + i;
+        dst[n].logical = this->addr.logical(itr->offset + header::size, i);
+        dst[n].length  = itr->length - header::size;
+        dst[n].base    = itr->offset;
+        dst[n].type    = 0;
+    }
+    return n;
+}
+
 void rp66::seek(std::int64_t n) noexcept (false) {
+    const auto unbounded = (std::numeric_limits< std::int64_t >::max)();
+    this->seek_step(n, unbounded);
+}
+
+lfp_status rp66::seek_step(std::int64_t n, std::int64_t max_headers)
+noexcept (false) {
+    /*
+     * Before chasing headers, check if another handle of the same file has
+     * already indexed further
+     */
+    if (not this->index.contains(n) and this->adopt())
+        this->current.move(this->index.last());
+
     /*
      * Have we already index'd the right section? If so, use it and seek there.
      */
@@ -497,7 +1014,7 @@ void rp66::seek(std::int64_t n) noexcept (false) {
         this->fp->seek(real_offset);
         this->current.move(next);
         this->current.move(real_offset - this->current.tell());
-        return;
+        return LFP_OK;
     }
     /*
      * target is past the already-index'd records, so follow the headers, and
@@ -513,15 +1030,23 @@ void rp66::seek(std::int64_t n) noexcept (false) {
         if (real_offset < end) {
             this->fp->seek(real_offset);
             this->current.move(real_offset - this->current.tell());
-            return;
+            return LFP_OK;
         }
 
         if (real_offset == end) {
             this->fp->seek(end);
             this->current.skip();
-            return;
+            return LFP_OK;
         }
 
+        /*
+         * Out of budget, so stop at the start of the last indexed record.
+         * The next step picks up from the end of the index.
+         */
+        if (max_headers == 0)
+            return LFP_OKINCOMPLETE;
+        max_headers -= 1;
+
         this->fp->seek(end);
         this->current.skip();
         auto updated = this->read_header_from_disk();
@@ -534,7 +1059,7 @@ void rp66::seek(std::int64_t n) noexcept (false) {
                  * somewhere in the last record. However without explicit read
                  * performed we do not know if the record was complete or not.
                  */
-                return;
+                return LFP_OK;
 
             /**
              * There was a valid header processed, but file is reported to be
@@ -547,7 +1072,7 @@ void rp66::seek(std::int64_t n) noexcept (false) {
             const auto skip = (std::min)(real_offset - this->current.tell(),
                                          this->current.bytes_left());
             this->current.move(skip);
-            return;
+            return LFP_OK;
         }
     }
 }
@@ -565,9 +1090,14 @@ std::int64_t rp66::readinto(void* dst, std::int64_t len) noexcept (false) {
             if (updated)
                 this->current.move(this->index.last());
         } else {
-            const auto next = this->current.next_record();
+            /*
+             * Skip indexed runs of empty records in one go, rather than
+             * seeking to every one of them
+             */
+            auto next = this->current;
+            next.move(this->index.skip_empty(std::next(this->current)));
             this->fp->seek(next.tell());
-            this->current.move(next);
+            this->current = next;
         }
 
         /* might be EOF, or even empty records, so re-start  */
@@ -592,7 +1122,14 @@ std::int64_t rp66::readinto(void* dst, std::int64_t len) noexcept (false) {
 }
 
 bool rp66::read_header_from_disk() noexcept (false) {
-    assert(this->current == this->index.last() and this->current.exhausted());
+    /*
+     * This method should only be called when the underlying file pointer is
+     * exactly at the end of the last indexed record, which is also where the
+     * read head is, unless translate() is indexing ahead of it
+     */
+    assert(try_tell(this->fp) == -1 or
+           try_tell(this->fp) == this->index.last()->offset
+                               + this->index.last()->length);
 
     std::int64_t n;
     unsigned char b[header::size];
@@ -612,9 +1149,11 @@ bool rp66::read_header_from_disk() noexcept (false) {
              * not recorded before someone tries to read *past* the end, its
              * perfectly fine to exhaust the last VR without EOF being set.
              */
-            if (n == 0)
+            if (n == 0) {
+                /* The whole file is indexed, so share it */
+                this->publish();
                 return false;
-            else {
+            } else {
                 const auto msg = "rp66: unexpected EOF when reading header "
                                  "- got {} bytes";
                 throw unexpected_eof(fmt::format(msg, n));
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <ciso646>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <utility>
+
+#include <lfp/lfp.h>
+#include <lfp/scheduler.h>
+
+#include "scheduler.hpp"
+
+namespace lfp {
+
+namespace {
+
+/*
+ * Upper bound on the time a single read holds a slot, so that interactive
+ * reads never queue behind a large batch read
+ */
+constexpr std::size_t quantum = 256 * 1024;
+
+thread_local int ioclass = LFP_IOCLASS_INTERACTIVE;
+
+}
+
+bool io_scheduler::enabled() const noexcept (true) {
+    return this->slots.load(std::memory_order_relaxed) > 0;
+}
+
+void io_scheduler::enable(int slots) noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    this->slots.store(slots);
+    /* queued reads are dispatched immediately when disabled */
+    this->dispatched.notify_all();
+}
+
+void io_scheduler::share(int ioclass, int weight) noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    this->weight[ioclass] = weight;
+}
+
+void io_scheduler::acquire(int ioclass, std::int64_t len) noexcept (false) {
+    std::unique_lock< std::mutex > lock(this->mtx);
+    const auto start = (std::max)(this->vtime, this->finish[ioclass]);
+    this->finish[ioclass] = start + double(len) / this->weight[ioclass];
+
+    const auto tag = std::make_pair(start, this->seq++);
+    this->queue.insert(tag);
+    this->dispatched.wait(lock, [this, &tag] {
+        const auto slots = this->slots.load();
+        return *this->queue.begin() == tag
+           and (slots == 0 or this->busy < slots)
+        ;
+    });
+
+    this->queue.erase(this->queue.begin());
+    this->vtime = start;
+    this->busy += 1;
+    /* the next in line might fit in another slot */
+    this->dispatched.notify_all();
+}
+
+void io_scheduler::release() noexcept (true) {
+    std::lock_guard< std::mutex > lock(this->mtx);
+    this->busy -= 1;
+    this->dispatched.notify_all();
+}
+
+io_scheduler& scheduler() noexcept (true) {
+    static io_scheduler sched;
+    return sched;
+}
+
+int current_ioclass() noexcept (true) {
+    return ioclass;
+}
+
+void set_ioclass(int c) noexcept (true) {
+    ioclass = c;
+}
+
+std::size_t scheduled_fread(void* dst, std::size_t len, std::FILE* fp)
+noexcept (false) {
+    auto& sched = scheduler();
+    if (not sched.enabled())
+        return std::fread(dst, 1, len, fp);
+
+    const auto c = current_ioclass();
+    auto* p = static_cast< unsigned char* >(dst);
+    std::size_t n = 0;
+    while (n < len) {
+        const auto chunk = (std::min)(len - n, quantum);
+        sched.acquire(c, chunk);
+        const auto m = std::fread(p + n, 1, chunk, fp);
+        sched.release();
+
+        n += m;
+        if (m < chunk)
+            break;
+    }
+
+    return n;
+}
+
+}
+
+int lfp_scheduler_enable(int slots) {
+    if (slots < 0)
+        return LFP_INVALID_ARGS;
+
+    lfp::scheduler().enable(slots);
+    return LFP_OK;
+}
+
+int lfp_scheduler_share(int ioclass, int weight) {
+    if (ioclass < 0 or ioclass >= lfp::io_scheduler::classes)
+        return LFP_INVALID_ARGS;
+
+    if (weight < 1)
+        return LFP_INVALID_ARGS;
+
+    lfp::scheduler().share(ioclass, weight);
+    return LFP_OK;
+}
+
+int lfp_scheduler_set_class(int ioclass) {
+    if (ioclass < 0 or ioclass >= lfp::io_scheduler::classes)
+        return LFP_INVALID_ARGS;
+
+    lfp::set_ioclass(ioclass);
+    return LFP_OK;
+}
@@ -0,0 +1,76 @@
+#ifndef LFP_SCHEDULER_HPP
+#define LFP_SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <utility>
+
+namespace lfp {
+
+/*
+ * Process-wide I/O scheduler, using start-time fair queuing (SFQ).
+ *
+ * Every read is tagged with a virtual start time on arrival, which is the
+ * later of the current virtual time and the virtual finish time of the
+ * previous read in the same class. The finish time is the start time plus
+ * the size of the read divided by the weight of the class. Queued reads are
+ * dispatched in order of start time, and the virtual time is advanced to the
+ * start time of the last dispatched read.
+ *
+ * A busy class accumulates finish times far ahead of the virtual time, while
+ * a read from an idle class is tagged with the current virtual time, and so
+ * is dispatched next.
+ */
+class io_scheduler {
+public:
+    static constexpr int classes = 2;
+
+    bool enabled() const noexcept (true);
+    void enable(int slots) noexcept (true);
+    void share(int ioclass, int weight) noexcept (true);
+
+    /*
+     * Block until a read of len bytes in ioclass may be issued. Every acquire
+     * must be paired with a release.
+     */
+    void acquire(int ioclass, std::int64_t len) noexcept (false);
+    void release() noexcept (true);
+
+private:
+    std::atomic< int > slots { 0 };
+
+    std::mutex mtx;
+    std::condition_variable dispatched;
+    int busy = 0;
+    double vtime = 0;
+    double finish[classes] = {};
+    int weight[classes] = { 4, 1 };
+    std::uint64_t seq = 0;
+    /* (start time, arrival), so reads with the same start time are FIFO */
+    std::set< std::pair< double, std::uint64_t > > queue;
+};
+
+io_scheduler& scheduler() noexcept (true);
+
+/*
+ * The priority class of the calling thread
+ */
+int current_ioclass() noexcept (true);
+void set_ioclass(int) noexcept (true);
+
+/*
+ * std::fread through the scheduler, in quanta, if it is enabled. Like fread,
+ * stops at the first short read, and leaves the error and eof indicators of
+ * fp for the caller to check.
+ */
+std::size_t scheduled_fread(void* dst, std::size_t len, std::FILE* fp)
+    noexcept (false);
+
+}
+
+#endif // LFP_SCHEDULER_HPP
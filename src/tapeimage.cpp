@@ -3,7 +3,9 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <iterator>
 #include <limits>
+#include <string>
 #include <vector>
 
 #include <fmt/format.h>
@@ -11,6 +13,9 @@
 #include <lfp/protocol.hpp>
 #include <lfp/tapeimage.h>
 
+#include "registry.hpp"
+#include "tell.hpp"
+
 namespace lfp { namespace {
 
 struct header {
@@ -54,6 +59,11 @@ public:
      * tapemarks offsets accounted for base protocol zero.
      */
     std::int64_t from_physical(std::int64_t addr) const noexcept (true);
+    /**
+     * Get the physical address from the base address, i.e. the inverse of
+     * from_physical().
+     */
+    std::int64_t to_physical(std::int64_t addr) const noexcept (true);
 
     /**
      * Offset of protocol zero according to physical level, i.e. ptell at which
@@ -61,14 +71,50 @@ public:
      */
     std::int64_t physical_zero() const noexcept (true);
 
+    /**
+     * Offset of protocol zero according to base level, i.e. tell at which
+     * protocol was opened.
+     */
+    std::int64_t zero() const noexcept (true);
+
 private:
     std::int64_t bzero = 0;
     std::int64_t pzero = 0;
 };
 
+/*
+ * A record as stored in the index. The prev pointer is not stored, as it is
+ * always the next pointer of the header two records back, which is checked
+ * (or patched, in recovery mode) when the header is read.
+ */
+struct entry {
+    std::uint32_t type;
+    std::uint32_t next;
+};
+
+/*
+ * A run of consecutive records of the same type, with equally spaced next
+ * pointers, i.e. all records but the first have the same size. Some files
+ * have enormous runs of empty or tiny records, and storing the runs rather
+ * than the records keeps the index small.
+ *
+ * The number of records in the run is implied by the first record of the
+ * next run.
+ */
+struct run {
+    /* the type of all records in the run */
+    std::uint32_t type;
+    /* the next pointer of the first record */
+    std::uint32_t next;
+    /* the distance between the next pointers, 0 if there is only one record */
+    std::uint32_t stride;
+    /* the position in the index of the first record */
+    std::uint32_t first;
+};
+
 /*
  * The record headers already read by tapeimage, stored in an order
- * (lower-address first fashion).
+ * (lower-address first fashion), as runs of equally sized records.
  *
  * Two ghost nodes are inserted first:
  *  { type: -1, prev: physical-zero, next: physical-zero }
@@ -83,12 +129,55 @@ private:
  *  Two ghosts are needed to not invoke undefined behaviour when adding the
  *  first header from the file, as prev(last) where last = ghost would then be
  *  outside the index.
+ *
+ *  The iterators are positions in the index, and dereference to entries that
+ *  are computed from the runs. They are not invalidated by append().
  */
-class record_index : private std::vector< header > {
-    using base = std::vector< header >;
-
+class record_index {
 public:
-    using iterator = base::const_iterator;
+    /*
+     * Lightweight proxy so that iterator->next works, even though there is
+     * no stored entry to point to
+     */
+    struct arrow {
+        entry e;
+        const entry* operator -> () const noexcept (true) { return &this->e; }
+    };
+
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = entry;
+        using difference_type   = std::int64_t;
+        using pointer           = arrow;
+        using reference         = entry;
+
+        iterator() = default;
+
+        entry operator * () const noexcept (true);
+        arrow operator -> () const noexcept (true);
+
+        iterator& operator ++ () noexcept (true);
+        iterator& operator -- () noexcept (true);
+        iterator& operator += (difference_type) noexcept (true);
+        iterator operator + (difference_type) const noexcept (true);
+        difference_type operator - (const iterator&) const noexcept (true);
+
+        bool operator == (const iterator&) const noexcept (true);
+        bool operator < (const iterator&) const noexcept (true);
+
+    private:
+        friend class record_index;
+        iterator(const record_index* index, std::int64_t pos) noexcept (true) :
+            index(index),
+            pos(pos)
+        {}
+
+        const record_index* index = nullptr;
+        std::int64_t pos = 0;
+        /* the run of the last dereference, which is usually right */
+        mutable std::size_t run = 0;
+    };
 
     explicit record_index(address_map m);
 
@@ -106,17 +195,61 @@ public:
      */
     iterator find(std::int64_t n, iterator hint) const noexcept (false);
 
+    /*
+     * Find the first record at or after itr that is not an empty data record,
+     * or last() if there is none. Runs of empty records are skipped in one
+     * step. File marks are never skipped.
+     */
+    iterator skip_empty(iterator itr) const noexcept (true);
+
+    /*
+     * Remove all headers, and re-initialise the index for a new file. The
+     * allocated capacity is kept.
+     */
+    void reset(address_map m) noexcept (false);
+
     void append(const header&) noexcept (false);
 
+    /*
+     * Replace the index with a copy of runs, e.g. an index published by
+     * another handle of the same file, with size records. If this throws, the
+     * index is unchanged.
+     */
+    void assign(const std::vector< run >& runs, std::size_t size)
+        noexcept (false);
+
+    const std::vector< run >& run_list() const noexcept (true);
+
     iterator last() const noexcept (true);
     std::size_t size() const noexcept (true);
     bool empty() const noexcept (true);
     iterator begin() const noexcept (true);
+    iterator end() const noexcept (true);
 
     iterator::difference_type index_of(const iterator&) const noexcept (true);
 
 private:
     address_map addr;
+    std::vector< run > runs;
+    /* number of records, including the ghosts */
+    std::int64_t entries = 0;
+
+    /*
+     * Get the run of the record at pos, checking the hint first
+     */
+    std::size_t run_of(std::int64_t pos, std::size_t hint) const noexcept (true);
+    /*
+     * Position of the record after the last record in run r
+     */
+    std::int64_t run_end(std::size_t r) const noexcept (true);
+    /*
+     * Next pointer of the record at pos in run r
+     */
+    std::uint32_t next_of(std::size_t r, std::int64_t pos) const noexcept (true);
+    /*
+     * Logical address of the end of the record at pos in run r
+     */
+    std::int64_t end_of(std::size_t r, std::int64_t pos) const noexcept (true);
 };
 
 /**
@@ -163,12 +296,6 @@ public:
      */
     void skip() noexcept (true);
 
-    /*
-     * Get a read head moved to the start of the next record. Behaviour is
-     * undefined if this is the last record in the file.
-     */
-    read_head next_record() const noexcept (true);
-
     /*
      * The absolute position of the read head. This should correspond to
      * the ptell reported by the underlying file.
@@ -185,9 +312,6 @@ class tapeimage : public lfp_protocol {
 public:
     tapeimage(lfp_protocol*);
 
-    // TODO: there must be a "reset" semantic for when there's a read error to
-    // put it back into a valid state
-
     void close() noexcept (false) override;
     lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
         noexcept (false) override;
@@ -195,10 +319,21 @@ public:
     int eof() const noexcept (true) override;
 
     void seek(std::int64_t)   noexcept (false) override;
+    lfp_status seek_step(std::int64_t, std::int64_t) noexcept (false) override;
     std::int64_t tell() const noexcept (false) override;
     std::int64_t ptell() const noexcept (false) override;
     lfp_protocol* peel() noexcept (false) override;
     lfp_protocol* peek() const noexcept (false) override;
+    void reopen(lfp_protocol*) noexcept (false) override;
+    void insert_below(lfp_layer_factory, void*) noexcept (false) override;
+    void recover() noexcept (false) override;
+    std::string identity() const noexcept (false) override;
+
+    std::int64_t index_size() const noexcept (true) override;
+    std::int64_t index_records(std::int64_t, std::int64_t, lfp_record*)
+        const noexcept (true) override;
+    void translate(const std::int64_t*, std::int64_t*, std::int64_t)
+        noexcept (false) override;
 
 private:
     static constexpr const std::uint32_t record = 0;
@@ -211,8 +346,31 @@ private:
 
     std::int64_t readinto(void* dst, std::int64_t) noexcept (false);
     bool read_header_from_disk() noexcept (false);
+    /*
+     * Read headers from disk until the index covers the logical offset n, or
+     * there are no more headers. The read head is not moved, and fp is put
+     * back at the read head afterwards.
+     */
+    void index_to(std::int64_t n) noexcept (false);
 
     lfp_status recovery = LFP_OK;
+
+    /*
+     * Key of this protocol in the index registry, or empty if the registry
+     * is disabled or the file can't be identified.
+     */
+    std::string key;
+
+    /*
+     * Look up the key in the registry, and adopt any published index.
+     */
+    void attach() noexcept (true);
+    /*
+     * Adopt the published index, if it has more headers than this index.
+     * Returns true if it was adopted, which invalidates the read head.
+     */
+    bool adopt() noexcept (true);
+    void publish() const noexcept (true);
 };
 
 std::int64_t
@@ -233,11 +391,29 @@ const noexcept (true) {
     return addr - (this->pzero - this->bzero);
 }
 
+std::int64_t
+address_map::to_physical(std::int64_t addr)
+const noexcept (true) {
+    return addr + (this->pzero - this->bzero);
+}
+
 std::int64_t address_map::physical_zero() const noexcept (true) {
     return this->pzero;
 }
 
-record_index::record_index(address_map m) : addr(m) {
+std::int64_t address_map::zero() const noexcept (true) {
+    return this->bzero;
+}
+
+record_index::record_index(address_map m) {
+    this->reset(m);
+}
+
+void record_index::reset(address_map m) noexcept (false) {
+    this->runs.clear();
+    this->entries = 0;
+    this->addr = m;
+
     header ghost;
     ghost.type = -1;
     ghost.prev = m.physical_zero();
@@ -283,72 +459,116 @@ record_index::find(std::int64_t n, iterator hint) const noexcept (false) {
         return hint;
     }
 
-    const auto begin = this->begin();
-    const auto end   = this->end();
-
     /**
      * Look up the record containing the logical offset n in the index.
      *
      * seek() is a pretty common operation, and experience from dlisio [1]
      * shows that a poor algorithm here significantly slows down programs.
      *
-     * The algorithm actually makes two searches:
-     *
-     * Phase 1 is an approximating binary search that pretends the logical and
-     * base offsets are the same. Since base offset >= logical offset,
-     * we know that the result is always correct or before the correct one in
-     * the ordered index.
-     *
-     * Phase 2 is a linear search from [cur, end) that is aware of the
-     * logical/base offset distinction. Because of the approximation, it
-     * should do fairly few hops.
-     *
-     * The main reason for the two-phase search is that an elements' index is
-     * required to compare logical addresses to base ones, and upper_bound
-     * is oblivious to the current item's position.
+     * The logical ends of the records in a run are equally spaced, so this is
+     * a binary search for the first run that ends after n, followed by some
+     * arithmetic to find the record within the run.
      *
      * [1] https://github.com/equinor/dlisio
      */
-
-    // phase 1
-    const auto addr = this->addr;
-    auto less = [addr] (std::int64_t n, const header& h) noexcept (true) {
-        return n < addr.logical(addr.from_physical(h.next), 0);
-    };
-    const auto lower = std::upper_bound(begin, end, n, less);
-
-    // phase 2
-    /*
-     * We found the right record when record->next > n. All hits after will
-     * also be a match, but this is ok since the search is in an ordered list.
-     *
-     * Using a mutable lambda to carry the header contribution is a pretty
-     * convoluted approach, but both the element *and* the header sizes need to
-     * be accounted for, and the latter is only available through the
-     * *position* in the index, which doesn't play so well with the std
-     * algorithms. The use of lambda + find-if is still valuable though, as it
-     * gives a clean error check if the offset n is somehow *not* in the index.
-     */
-    auto pos = this->index_of(lower);
-    auto next_larger = [addr, n, pos] (const header& rec) mutable {
-        return n < addr.logical(addr.from_physical(rec.next), pos++);
+    const auto less = [this] (std::int64_t n, const run& r) noexcept (true) {
+        const auto i = std::size_t(&r - this->runs.data());
+        return n < this->end_of(i, this->run_end(i) - 1);
     };
 
-    const auto cur = std::find_if(lower, end, next_larger);
-    if (cur >= this->end()) {
+    /* the first run is the ghost nodes */
+    const auto begin = std::next(this->runs.begin());
+    const auto end   = this->runs.end();
+    const auto itr = std::upper_bound(begin, end, n, less);
+    if (itr == end) {
         const auto msg = "seek: n = {} not found in index, end->next = {}";
-        throw std::logic_error(fmt::format(msg, n, this->back().next));
+        throw std::logic_error(fmt::format(msg, n, this->last()->next));
+    }
+
+    const auto r = std::size_t(std::distance(this->runs.begin(), itr));
+    const auto first = std::int64_t(itr->first);
+    const auto first_end = this->end_of(r, first);
+
+    std::int64_t k = 0;
+    if (n >= first_end) {
+        /*
+         * n is past the first record, and before the end of the run, so the
+         * rest of the records in the run are not empty
+         */
+        const auto size = std::int64_t(itr->stride) - header::size;
+        assert(size > 0);
+        k = (n - first_end) / size + 1;
     }
 
+    auto cur = iterator(this, first + k);
+    cur.run = r;
     return cur;
 }
 
+record_index::iterator
+record_index::skip_empty(iterator itr) const noexcept (true) {
+    const auto last = this->last();
+    while (itr < last) {
+        const auto rec = *itr;
+        const auto begin = std::prev(itr)->next;
+
+        /* file marks end the logical file, and must never be skipped */
+        if (rec.type != 0 or rec.next - begin != header::size)
+            return itr;
+
+        const auto r = this->run_of(itr.pos, itr.run);
+        if (this->runs[r].stride != header::size) {
+            ++itr;
+            continue;
+        }
+
+        /* the remaining records in the run are empty too */
+        itr = (std::min)(iterator(this, this->run_end(r)), last);
+    }
+
+    return itr;
+}
+
 void record_index::append(const header& h) noexcept (false) {
+    if (not this->runs.empty()) {
+        const auto r = this->runs.size() - 1;
+        auto& back = this->runs.back();
+        const auto count = this->entries - back.first;
+        /*
+         * In 64 bits, as a next pointer that is not past the last one would
+         * wrap around in 32 bits, and could then match the stride
+         */
+        const auto stride = std::int64_t(h.next)
+                          - std::int64_t(this->next_of(r, this->entries - 1));
+        const auto regular = count == 1
+                           ? stride > 0
+                           : stride == std::int64_t(back.stride);
+
+        if (h.type == back.type and regular) {
+            back.stride = std::uint32_t(stride);
+            this->entries += 1;
+            return;
+        }
+    }
+
     try {
-        this->push_back(h);
+        const auto first = std::uint32_t(this->entries);
+        this->runs.push_back(run { h.type, h.next, 0, first });
     } catch (...) {
         throw runtime_error("tapeimage: unable to store header");
     }
+    this->entries += 1;
+}
+
+void record_index::assign(const std::vector< run >& xs, std::size_t size)
+noexcept (false) {
+    auto copy = xs;
+    this->runs.swap(copy);
+    this->entries = std::int64_t(size) + 2;
+}
+
+const std::vector< run >& record_index::run_list() const noexcept (true) {
+    return this->runs;
 }
 
 record_index::iterator record_index::last() const noexcept (true) {
@@ -356,7 +576,7 @@ record_index::iterator record_index::last() const noexcept (true) {
 }
 
 std::size_t record_index::size() const noexcept (true) {
-    return this->base::size() - 2;
+    return this->entries - 2;
 }
 
 bool record_index::empty() const noexcept (true) {
@@ -365,7 +585,11 @@ bool record_index::empty() const noexcept (true) {
 
 record_index::iterator record_index::begin() const noexcept (true) {
     /* don't even consider the ghost nodes in [begin, end) */
-    return this->base::begin() + 2;
+    return iterator(this, 2);
+}
+
+record_index::iterator record_index::end() const noexcept (true) {
+    return iterator(this, this->entries);
 }
 
 record_index::iterator::difference_type
@@ -373,6 +597,104 @@ record_index::index_of(const iterator& itr) const noexcept (true) {
     return std::distance(this->begin(), itr);
 }
 
+std::size_t record_index::run_of(std::int64_t pos, std::size_t hint)
+const noexcept (true) {
+    assert(pos >= 0 and pos < this->entries);
+    const auto in = [this, pos] (std::size_t r) noexcept (true) {
+        return r < this->runs.size()
+           and this->runs[r].first <= pos
+           and pos < this->run_end(r)
+        ;
+    };
+
+    /* sequential reads are in the same run, or the next */
+    if (in(hint))     return hint;
+    if (in(hint + 1)) return hint + 1;
+
+    const auto less = [] (std::int64_t pos, const run& r) noexcept (true) {
+        return pos < std::int64_t(r.first);
+    };
+    const auto itr = std::upper_bound(this->runs.begin(),
+                                      this->runs.end(),
+                                      pos,
+                                      less);
+    return std::distance(this->runs.begin(), itr) - 1;
+}
+
+std::int64_t record_index::run_end(std::size_t r) const noexcept (true) {
+    if (r + 1 < this->runs.size())
+        return this->runs[r + 1].first;
+    return this->entries;
+}
+
+std::uint32_t record_index::next_of(std::size_t r, std::int64_t pos)
+const noexcept (true) {
+    const auto& x = this->runs[r];
+    const auto k = std::uint32_t(pos - x.first);
+    return x.next + k * x.stride;
+}
+
+std::int64_t record_index::end_of(std::size_t r, std::int64_t pos)
+const noexcept (true) {
+    const auto next = this->addr.from_physical(this->next_of(r, pos));
+    return this->addr.logical(next, pos - 2);
+}
+
+entry record_index::iterator::operator * () const noexcept (true) {
+    assert(this->index);
+    this->run = this->index->run_of(this->pos, this->run);
+
+    entry e;
+    e.type = this->index->runs[this->run].type;
+    e.next = this->index->next_of(this->run, this->pos);
+    return e;
+}
+
+record_index::arrow record_index::iterator::operator -> ()
+const noexcept (true) {
+    return arrow { **this };
+}
+
+record_index::iterator& record_index::iterator::operator ++ ()
+noexcept (true) {
+    this->pos += 1;
+    return *this;
+}
+
+record_index::iterator& record_index::iterator::operator -- ()
+noexcept (true) {
+    this->pos -= 1;
+    return *this;
+}
+
+record_index::iterator&
+record_index::iterator::operator += (difference_type n) noexcept (true) {
+    this->pos += n;
+    return *this;
+}
+
+record_index::iterator
+record_index::iterator::operator + (difference_type n) const noexcept (true) {
+    auto copy = *this;
+    return copy += n;
+}
+
+record_index::iterator::difference_type
+record_index::iterator::operator - (const iterator& other)
+const noexcept (true) {
+    return this->pos - other.pos;
+}
+
+bool record_index::iterator::operator == (const iterator& other)
+const noexcept (true) {
+    return this->pos == other.pos;
+}
+
+bool record_index::iterator::operator < (const iterator& other)
+const noexcept (true) {
+    return this->pos < other.pos;
+}
+
 read_head read_head::ghost(const base_type& b) noexcept (true) {
     auto x = read_head(b);
     x.remaining = 0;
@@ -416,13 +738,6 @@ void read_head::skip() noexcept (true) {
     this->remaining = 0;
 }
 
-read_head read_head::next_record() const noexcept (true) {
-    assert(this->remaining >= 0);
-    auto next = *this;
-    next.move(std::next(*this));
-    return next;
-}
-
 std::int64_t read_head::ptell() const noexcept (true) {
     assert(this->remaining >= 0);
     return (*this)->next - this->remaining;
@@ -455,11 +770,13 @@ tapeimage::tapeimage(lfp_protocol* f) :
     fp(f),
     index(this->addr)
 {
-    this->current = read_head::ghost(this->index.last());
+    this->attach();
+    this->current = read_head::ghost(std::prev(this->index.begin()));
 }
 
 void tapeimage::close() noexcept (false) {
     if(!this->fp) return;
+    this->publish();
     this->fp.close();
 }
 
@@ -473,6 +790,112 @@ lfp_protocol* tapeimage::peek() const noexcept (false) {
     return this->fp.get();
 }
 
+void tapeimage::reopen(lfp_protocol* f) noexcept (false) {
+    assert(f);
+    /*
+     * Inspect f before anything is changed, and close the old handle before
+     * taking ownership of f. If either fails, this protocol is left as it
+     * was, and ownership of f is not taken. unique_lfp keeps the handle if
+     * close() fails, and the index is only published once it is closed.
+     */
+    const auto addr = address_map(baseaddr(f), physicaladdr(f));
+    if (this->fp) {
+        this->fp.close();
+        this->publish();
+    }
+
+    this->index.reset(addr);
+    this->addr = addr;
+    this->recovery = LFP_OK;
+    this->errmsg("");
+    this->fp = unique_lfp(f);
+    this->attach();
+    this->current = read_head::ghost(std::prev(this->index.begin()));
+}
+
+void tapeimage::insert_below(lfp_layer_factory factory, void* userdata)
+noexcept (false) {
+    /*
+     * The layer presents the same stream as fp, from the same position, so
+     * the index, address map and read head are all still valid. The registry
+     * key is kept too, since the layer forwards the identity of fp.
+     */
+    splice_below(this->fp, factory, userdata);
+}
+
+void tapeimage::recover() noexcept (false) {
+    /*
+     * The read head is only moved after successful reads from the underlying
+     * file, so it still points to the last good position after an error. The
+     * underlying file might be anywhere (e.g. halfway through a header), so
+     * recover it and move it back to the read head.
+     */
+    try {
+        this->fp->recover();
+    } catch (const lfp::error& e) {
+        if (e.status() != LFP_NOTIMPLEMENTED) throw;
+    }
+
+    const auto pos = this->addr.from_physical(this->current.ptell());
+    if (try_tell(this->fp) != pos)
+        this->fp->seek(pos);
+}
+
+std::string tapeimage::identity() const noexcept (false) {
+    return fmt::format("{}/tapeimage@{}:{}",
+                       this->fp->identity(),
+                       this->addr.physical_zero(),
+                       this->addr.zero());
+}
+
+void tapeimage::attach() noexcept (true) {
+    this->key.clear();
+    if (not registry().enabled())
+        return;
+
+    try {
+        this->key = this->identity();
+    } catch (...) {
+        this->key.clear();
+        return;
+    }
+
+    this->adopt();
+}
+
+bool tapeimage::adopt() noexcept (true) {
+    if (this->key.empty())
+        return false;
+
+    try {
+        std::size_t size = 0;
+        const auto published = lookup_index< run >(this->key, &size);
+        if (not published or size <= this->index.size())
+            return false;
+
+        /*
+         * The published index is of the same file and protocol stack, so it
+         * starts with the same headers as this one
+         */
+        this->index.assign(*published, size);
+        return true;
+    } catch (...) {
+        /* the index is unchanged */
+        return false;
+    }
+}
+
+void tapeimage::publish() const noexcept (true) {
+    /*
+     * Headers patched in recovery mode are only consistent in this handle's
+     * memory, so never share them
+     */
+    if (this->key.empty() or this->recovery != LFP_OK)
+        return;
+
+    publish_index(this->key, this->index.run_list(), this->index.size());
+}
+
 lfp_status tapeimage::readinto(
         void* dst,
         std::int64_t len,
@@ -524,9 +947,33 @@ std::int64_t tapeimage::readinto(void* dst, std::int64_t len) noexcept (false) {
             if (updated)
                 this->current.move(this->index.last());
         } else {
-            const auto next = this->current.next_record();
-            this->fp->seek(this->addr.from_physical(next.ptell()));
-            this->current.move(next);
+            /*
+             * Skip indexed runs of empty records in one go, rather than
+             * seeking to every one of them
+             */
+            auto next = this->current;
+            next.move(this->index.skip_empty(std::next(this->current)));
+            const auto body = this->addr.from_physical(next.ptell());
+            if (next->type != tapeimage::file) {
+                this->fp->seek(body);
+            } else {
+                /*
+                 * A file mark is often the last thing in the file, where
+                 * some leaves (e.g. memfile) refuse to seek to. Seek to its
+                 * header and read past it instead, so that fp still ends up
+                 * right after the mark, and at EOF if the mark ends the file.
+                 */
+                this->fp->seek(body - header::size);
+                unsigned char b[header::size];
+                std::int64_t n = 0;
+                this->fp->readinto(b, sizeof(b), &n);
+                if (n != header::size) {
+                    const auto msg = "tapeimage: unexpected EOF when reading "
+                                     "indexed file mark - got {} bytes";
+                    throw unexpected_eof(fmt::format(msg, n));
+                }
+            }
+            this->current = next;
         }
 
         /* might be EOF, or even empty records, so re-start  */
@@ -592,14 +1039,17 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
 
         case LFP_EOF:
         {
-            if (n == 0)
+            if (n == 0) {
                 /*
                  * File is over exactly when we wanted to read a new tapemark.
                  * As some files do not have file tapemarks in the end,
                  * consider this to be an accepted situation.
+                 *
+                 * The whole file is indexed, so share it.
                  */
+                this->publish();
                 return false;
-            else {
+            } else {
                 const auto msg = "tapeimage: unexpected EOF when reading header "
                                   "- got {} bytes";
                 throw unexpected_eof(fmt::format(msg, n));
@@ -730,12 +1180,25 @@ bool tapeimage::read_header_from_disk() noexcept (false) {
 }
 
 void tapeimage::seek(std::int64_t n) noexcept (false) {
+    const auto unbounded = (std::numeric_limits< std::int64_t >::max)();
+    this->seek_step(n, unbounded);
+}
+
+lfp_status tapeimage::seek_step(std::int64_t n, std::int64_t max_headers)
+noexcept (false) {
     assert(n >= 0);
 
     if ((std::numeric_limits<std::uint32_t>::max)() < n)
         throw invalid_args("Too big seek offset. TIF protocol does not "
                            "support files larger than 4GB");
 
+    /*
+     * Before chasing headers, check if another handle of the same file has
+     * already indexed further
+     */
+    if (not this->index.contains(n) and this->adopt())
+        this->current.move(this->index.last());
+
     if (this->index.contains(n)) {
         const auto next = this->index.find(n, this->current);
         const auto pos  = this->index.index_of(next);
@@ -747,7 +1210,7 @@ void tapeimage::seek(std::int64_t n) noexcept (false) {
             this->addr.from_physical(this->current.ptell());
         assert(base_offset >= current_tell);
         this->current.move(base_offset - current_tell);
-        return;
+        return LFP_OK;
     }
 
     /*
@@ -783,6 +1246,14 @@ void tapeimage::seek(std::int64_t n) noexcept (false) {
             break;
         }
 
+        /*
+         * Out of budget, so stop at the start of the last indexed record.
+         * The next step picks up from the end of the index.
+         */
+        if (max_headers == 0)
+            return LFP_OKINCOMPLETE;
+        max_headers -= 1;
+
         this->fp->seek(last_indexed);
         // skips the whole record even if file is truncated
         this->current.skip();
@@ -796,7 +1267,7 @@ void tapeimage::seek(std::int64_t n) noexcept (false) {
                  * somewhere in the last record. However without explicit read
                  * performed we do not know if the record was complete or not.
                  */
-                return;
+                return LFP_OK;
 
             /**
              * There was a valid header processed, but file is reported to be
@@ -811,9 +1282,130 @@ void tapeimage::seek(std::int64_t n) noexcept (false) {
             const auto skip = (std::min)(base_offset - current_offset,
                                          this->current.bytes_left());
             this->current.move(skip);
-            return;
+            return LFP_OK;
         }
     }
+
+    return LFP_OK;
+}
+
+std::int64_t tapeimage::index_size() const noexcept (true) {
+    return this->index.size();
+}
+
+std::int64_t tapeimage::index_records(
+        std::int64_t first,
+        std::int64_t len,
+        lfp_record* dst)
+const noexcept (true) {
+    /* first + len can overflow, so clamp len first */
+    const auto size = std::int64_t(this->index.size());
+    const auto count = (std::max)(std::int64_t(0),
+                                  (std::min)(len, size - first));
+    const auto last = first + count;
+
+    std::int64_t n = 0;
+    for (auto i = first; i < last; ++i, ++n) {
+        const auto itr = this->index.begin() + i;
+        const auto base = this->addr.from_physical(std::prev(itr)->next);
+        dst[n].logical = this->addr.logical(base + header::size, i);
+        dst[n].length  = itr->next - (std::prev(itr)->next + header::size);
+        dst[n].base    = base;
+        dst[n].type    = itr->type;
+    }
+    return n;
+}
+
+void tapeimage::index_to(std::int64_t n) noexcept (false) {
+    const auto restore = [this] {
+        const auto head = this->addr.from_physical(this->current.ptell());
+        if (try_tell(this->fp) != head)
+            this->fp->seek(head);
+    };
+
+    try {
+        while (not this->index.contains(n)) {
+            const auto last = this->index.last();
+            if (last->type == tapeimage::file)
+                break;
+
+            const auto header_offset = this->addr.from_physical(last->next);
+            if (try_tell(this->fp) != header_offset) {
+                try {
+                    this->fp->seek(header_offset);
+                } catch (const error& e) {
+                    /*
+                     * Some leaves, e.g. memfile, refuse to seek to their end,
+                     * where there are no more headers anyway
+                     */
+                    if (e.status() != LFP_INVALID_ARGS)
+                        throw;
+                    break;
+                }
+            }
+
+            if (not this->read_header_from_disk())
+                break;
+        }
+    } catch (...) {
+        /*
+         * Report the error from reading the headers. If fp can not be put
+         * back either, recover() can still do it from the read head.
+         */
+        try {
+            restore();
+        } catch (...) {}
+        throw;
+    }
+
+    restore();
+}
+
+void tapeimage::translate(
+        const std::int64_t* logical,
+        std::int64_t* physical,
+        std::int64_t n)
+noexcept (false) {
+    /*
+     * The offsets are sorted, so the index covers all of them once it covers
+     * the last one. Only the headers are read, so the position is unchanged.
+     */
+    if (not this->index.contains(logical[n - 1]))
+        this->index_to(logical[n - 1]);
+
+    /*
+     * Walk the index alongside the offsets, like seek() would. The record of
+     * the previous offset is the hint for the next, so offsets in the same
+     * record are translated without searching the index.
+     */
+    record_index::iterator itr = this->current;
+    for (std::int64_t i = 0; i < n; ++i) {
+        const auto x = logical[i];
+        if (this->index.contains(x)) {
+            itr = this->index.find(x, itr);
+            const auto base = this->addr.base(x, this->index.index_of(itr));
+            physical[i] = this->addr.to_physical(base);
+            continue;
+        }
+
+        /*
+         * The end of the file, which is the end of the record with the last
+         * byte, and not after any empty records or file marks that follow
+         */
+        if (x == 0) {
+            physical[i] = this->addr.physical_zero();
+            continue;
+        }
+
+        if (not this->index.contains(x - 1)) {
+            const auto msg = "translate: offset (= {}) is past end-of-file";
+            throw invalid_args(fmt::format(msg, x));
+        }
+
+        itr = this->index.find(x - 1, itr);
+        const auto base = this->addr.base(x, this->index.index_of(itr));
+        physical[i] = this->addr.to_physical(base);
+    }
 }
 
 std::int64_t tapeimage::tell() const noexcept (false) {
@@ -0,0 +1,26 @@
+#ifndef LFP_TELL_HPP
+#define LFP_TELL_HPP
+
+#include <cstdint>
+
+#include <lfp/protocol.hpp>
+
+namespace lfp {
+
+/*
+ * Get the tell of f if available, or -1 if f can not tell, e.g. if it does
+ * not implement it. Layers use this to record the position of the layer below
+ * after it failed, or to avoid seeking layers that are already in the right
+ * position, as some layers (e.g. memfile) can't seek to EOF.
+ */
+inline std::int64_t try_tell(lfp_protocol* f) noexcept (false) {
+    try {
+        return f->tell();
+    } catch (const lfp::error&) {
+        return -1;
+    }
+}
+
+}
+
+#endif // LFP_TELL_HPP
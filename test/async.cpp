@@ -0,0 +1,177 @@
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/async.hpp>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+lfp::async::task< std::int64_t > sum_records(lfp_protocol* f,
+                                              lfp::async::executor* ex,
+                                              std::int64_t chunksize,
+                                              std::vector< unsigned char >& out,
+                                              std::vector< lfp_record >& recs) {
+    auto gen = lfp::async::records(f, ex, chunksize);
+    std::int64_t n = 0;
+    while (auto* rec = co_await gen.next()) {
+        out.insert(out.end(), rec->data, rec->data + rec->info.length);
+        recs.push_back(rec->info);
+        n += 1;
+    }
+    co_return n;
+}
+
+lfp::async::task< std::vector< unsigned char > >
+read_at(lfp_protocol* f, std::int64_t pos, std::int64_t len,
+        lfp::async::executor* ex) {
+    const auto err = co_await lfp::async::seek(f, pos, ex);
+    REQUIRE(err == LFP_OK);
+
+    auto out = std::vector< unsigned char >(len);
+    const auto r = co_await lfp::async::read(f, out.data(), len, ex);
+    CHECK(r.status == LFP_OK);
+    CHECK(r.nread == len);
+    co_return out;
+}
+
+}
+
+TEST_CASE(
+    "Awaitable read and seek",
+    "[async]") {
+    const auto file = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    };
+    auto mem = memopen(file);
+
+    SECTION( "inline, without an executor" ) {
+        const auto out = lfp::async::sync_wait(read_at(mem.get(), 3, 4, nullptr));
+        CHECK_THAT(out, Equals(std::vector< unsigned char > { 4, 5, 6, 7 }));
+    }
+
+    SECTION( "on a thread pool" ) {
+        lfp::async::thread_pool pool(2);
+        const auto out = lfp::async::sync_wait(read_at(mem.get(), 1, 2, &pool));
+        CHECK_THAT(out, Equals(std::vector< unsigned char > { 2, 3 }));
+    }
+}
+
+TEST_CASE(
+    "Read completes on the pool thread",
+    "[async]") {
+    const auto file = std::vector< unsigned char >(16, 0xAB);
+    auto mem = memopen(file);
+    lfp::async::thread_pool pool(1);
+
+    const auto caller = std::this_thread::get_id();
+    auto resumed_on = [&]() -> lfp::async::task< std::thread::id > {
+        unsigned char buffer[4];
+        co_await lfp::async::read(mem.get(), buffer, 4, &pool);
+        co_return std::this_thread::get_id();
+    };
+
+    CHECK(lfp::async::sync_wait(resumed_on()) != caller);
+}
+
+TEST_CASE(
+    "Async generator yields every rp66 record",
+    "[async][rp66]") {
+    std::vector< unsigned char > file;
+    std::vector< unsigned char > expected;
+    const int sizes[] = { 6, 0, 300, 1, 1000 };
+    std::uint8_t x = 0;
+    for (int i = 0; i < 50; ++i) {
+        const auto n = sizes[i % 5];
+        const std::uint16_t len = n + 4;
+        file.push_back(len >> 8);
+        file.push_back(len & 0xFF);
+        file.push_back(0xFF);
+        file.push_back(0x01);
+        for (int k = 0; k < n; ++k) {
+            file.push_back(x);
+            expected.push_back(x);
+            x += 1;
+        }
+    }
+
+    auto* rp66 = lfp_rp66_open(memopen(file).release());
+    REQUIRE(rp66);
+
+    lfp::async::thread_pool pool(2);
+    auto* ex = GENERATE_REF(as< lfp::async::executor* >{}, nullptr, &pool);
+    /* chunks both smaller and larger than the records */
+    const auto chunksize = GENERATE(std::int64_t(7), std::int64_t(512), 1 << 20);
+
+    std::vector< unsigned char > out;
+    std::vector< lfp_record > recs;
+    const auto n = lfp::async::sync_wait(
+        sum_records(rp66, ex, chunksize, out, recs)
+    );
+
+    CHECK(n == 50);
+    CHECK_THAT(out, Equals(expected));
+    REQUIRE(recs.size() == 50);
+    CHECK(recs[1].length == 0);
+    CHECK(recs[2].logical == 6);
+    CHECK(recs[2].length == 300);
+
+    lfp_close(rp66);
+}
+
+TEST_CASE(
+    "Async generator yields tapeimage file marks",
+    "[async][tapeimage]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+    };
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    std::vector< unsigned char > out;
+    std::vector< lfp_record > recs;
+    const auto n = lfp::async::sync_wait(
+        sum_records(tif, nullptr, 1 << 20, out, recs)
+    );
+
+    CHECK(n == 2);
+    CHECK(out.size() == 8);
+    REQUIRE(recs.size() == 2);
+    CHECK(recs[1].type == 1);
+    CHECK(recs[1].length == 0);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Async generator throws on protocols without index",
+    "[async]") {
+    const auto file = std::vector< unsigned char >(10, 0x01);
+    auto mem = memopen(file);
+
+    std::vector< unsigned char > out;
+    std::vector< lfp_record > recs;
+    auto t = sum_records(mem.get(), nullptr, 4, out, recs);
+    CHECK_THROWS_AS(lfp::async::sync_wait(std::move(t)), lfp::error);
+}
@@ -0,0 +1,236 @@
+#include <ciso646>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/batch.h>
+#include <lfp/lfp.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * lfp_batch_index() opens files by path, so the files must be written to disk
+ */
+struct batch_files {
+    ~batch_files() {
+        for (const auto& file : this->files)
+            std::remove((file->path + ".idx").c_str());
+    }
+
+    void add(const std::vector< unsigned char >& contents) {
+        this->files.emplace_back(new disk_file("lfp-batch"));
+        this->files.back()->write(contents);
+    }
+
+    std::vector< const char* > cpaths() const {
+        std::vector< const char* > xs;
+        for (const auto& file : this->files)
+            xs.push_back(file->path.c_str());
+        return xs;
+    }
+
+    std::vector< std::unique_ptr< disk_file > > files;
+};
+
+struct collected {
+    int status = -1;
+    std::int64_t records = -1;
+    std::int64_t size = -1;
+    std::string errmsg;
+    int calls = 0;
+};
+
+void collect(const lfp_batch_result* result, void* userdata) {
+    auto& results = *static_cast< std::vector< collected >* >(userdata);
+    auto& x = results.at(result->index);
+    x.status  = result->status;
+    x.records = result->records;
+    x.size    = result->size;
+    x.calls  += 1;
+    if (result->errmsg)
+        x.errmsg = result->errmsg;
+}
+
+const auto valid_tif = std::vector< unsigned char > {
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x14, 0x00, 0x00, 0x00,
+
+    0x01, 0x02, 0x03, 0x04,
+    0x05, 0x06, 0x07, 0x08,
+
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x24, 0x00, 0x00, 0x00,
+
+    0x09, 0x0A, 0x0B, 0x0C,
+
+    0x01, 0x00, 0x00, 0x00,
+    0x14, 0x00, 0x00, 0x00,
+    0x30, 0x00, 0x00, 0x00,
+};
+
+const auto truncated_tif = std::vector< unsigned char > {
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x14, 0x00, 0x00, 0x00,
+
+    0x01, 0x02, 0x03, 0x04,
+};
+
+const auto broken_tif = std::vector< unsigned char > {
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x14, 0x00, 0x00, 0x00,
+
+    0x01, 0x02, 0x03, 0x04,
+    0x05, 0x06, 0x07, 0x08,
+
+    /* next <= prev */
+    0x00, 0x00, 0x00, 0x00,
+    0x30, 0x00, 0x00, 0x00,
+    0x24, 0x00, 0x00, 0x00,
+};
+
+}
+
+TEST_CASE_METHOD(
+    batch_files,
+    "Batch index reports per-file results",
+    "[batch]") {
+    add(valid_tif);
+    add(truncated_tif);
+    add(broken_tif);
+    add(valid_tif);
+    auto paths = cpaths();
+    const auto missing = files.front()->path + ".no-such-file";
+    paths.push_back(missing.c_str());
+
+    lfp_batch_options opts {};
+    opts.protocols = LFP_BATCH_TAPEIMAGE;
+    opts.nthreads = GENERATE(1, 2, 3);
+    opts.sidecar = ".idx";
+
+    std::vector< collected > results(paths.size());
+    const auto err = lfp_batch_index(paths.data(), paths.size(), &opts,
+                                     collect, &results);
+    CHECK(err == LFP_OK);
+
+    for (const auto& result : results)
+        CHECK(result.calls == 1);
+
+    CHECK(results[0].status == LFP_OK);
+    CHECK(results[0].records == 3);
+    CHECK(results[0].size == 12);
+    CHECK(results[3].status == LFP_OK);
+
+    CHECK(results[1].status == LFP_UNEXPECTED_EOF);
+    CHECK(results[2].status == LFP_PROTOCOL_FATAL_ERROR);
+    CHECK(results[4].status == LFP_IOERROR);
+    CHECK_THAT(results[4].errmsg, Contains("no-such-file"));
+
+    SECTION( "sidecar is written for valid files" ) {
+        std::FILE* fp = std::fopen((paths[0] + std::string(".idx")).c_str(), "rb");
+        REQUIRE(fp);
+        std::vector< unsigned char > sidecar(200);
+        const auto n = std::fread(sidecar.data(), 1, sidecar.size(), fp);
+        std::fclose(fp);
+
+        CHECK(n == 16 + 3 * 32);
+        CHECK(std::string(sidecar.begin(), sidecar.begin() + 8) == "lfpindex");
+        CHECK(sidecar[8] == 3);
+        /* the second record starts at logical offset 8, with length 4 */
+        CHECK(sidecar[16 + 32] == 8);
+        CHECK(sidecar[16 + 32 + 8] == 4);
+    }
+}
+
+TEST_CASE_METHOD(
+    batch_files,
+    "Batch index visits every file exactly once",
+    "[batch]") {
+    for (int i = 0; i < 37; ++i)
+        add(valid_tif);
+    auto paths = cpaths();
+
+    lfp_batch_options opts {};
+    opts.protocols = LFP_BATCH_TAPEIMAGE;
+    opts.nthreads = 4;
+
+    std::vector< collected > results(paths.size());
+    const auto err = lfp_batch_index(paths.data(), paths.size(), &opts,
+                                     collect, &results);
+    CHECK(err == LFP_OK);
+
+    for (const auto& result : results) {
+        CHECK(result.calls == 1);
+        CHECK(result.status == LFP_OK);
+        CHECK(result.records == 3);
+    }
+}
+
+TEST_CASE_METHOD(
+    batch_files,
+    "Batch index of rp66 on tapeimage",
+    "[batch][rp66]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+
+        0x00, 0x0A,
+        0xFF, 0x01,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+        0x00, 0x0A,
+        0xFF, 0x01,
+        0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x2C, 0x00, 0x00, 0x00,
+    };
+    add(file);
+    add(file);
+    auto paths = cpaths();
+
+    lfp_batch_options opts {};
+    opts.protocols = LFP_BATCH_TAPEIMAGE | LFP_BATCH_RP66;
+    opts.nthreads = 1;
+
+    std::vector< collected > results(paths.size());
+    const auto err = lfp_batch_index(paths.data(), paths.size(), &opts,
+                                     collect, &results);
+    CHECK(err == LFP_OK);
+
+    for (const auto& result : results) {
+        CHECK(result.status == LFP_OK);
+        CHECK(result.records == 2);
+        CHECK(result.size == 12);
+    }
+}
+
+TEST_CASE(
+    "Batch index rejects invalid options",
+    "[batch]") {
+    const char* paths[] = { "lfp-batch-test-no-such-file" };
+    std::vector< collected > results(1);
+
+    lfp_batch_options opts {};
+    opts.protocols = 0;
+    auto err = lfp_batch_index(paths, 1, &opts, collect, &results);
+    CHECK(err == LFP_INVALID_ARGS);
+
+    opts.protocols = LFP_BATCH_RP66;
+    opts.nthreads = -1;
+    err = lfp_batch_index(paths, 1, &opts, collect, &results);
+    CHECK(err == LFP_INVALID_ARGS);
+
+    CHECK(results[0].calls == 0);
+}
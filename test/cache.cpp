@@ -0,0 +1,297 @@
+#include <chrono>
+#include <ciso646>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/cache.h>
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/readahead.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+#if not defined(_WIN32)
+    #include <dirent.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace Catch::Matchers;
+
+#if not defined(_WIN32)
+
+namespace {
+
+const auto tif = std::vector< unsigned char > {
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00,
+
+    0x01, 0x02, 0x03, 0x04,
+
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x20, 0x00, 0x00, 0x00,
+
+    0x05, 0x06, 0x07, 0x08,
+
+    0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00,
+    0x34, 0x00, 0x00, 0x00,
+
+    0x09, 0x0A, 0x0B, 0x0C,
+    0x0D, 0x0E, 0x0F, 0x10,
+
+    0x01, 0x00, 0x00, 0x00,
+    0x20, 0x00, 0x00, 0x00,
+    0x40, 0x00, 0x00, 0x00,
+};
+
+const auto logical = std::vector< unsigned char > {
+    0x01, 0x02, 0x03, 0x04,
+    0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0A, 0x0B, 0x0C,
+    0x0D, 0x0E, 0x0F, 0x10,
+};
+
+/*
+ * The cache identifies files by inode, so the file must be on disk, and the
+ * cache needs a directory of its own
+ */
+struct cache_dir : disk_file {
+    cache_dir() : disk_file("lfp-cache"), dir(this->path + ".d") {
+        ::mkdir(this->dir.c_str(), 0755);
+        this->clean();
+        this->write(tif);
+    }
+
+    ~cache_dir() {
+        this->clean();
+        ::rmdir(this->dir.c_str());
+    }
+
+    lfp_protocol* open() {
+        std::FILE* fp = std::fopen(this->path.c_str(), "rb");
+        REQUIRE(fp);
+        auto* f = lfp_cache_open(lfp_tapeimage_open(lfp_cfile(fp)),
+                                 this->dir.c_str());
+        REQUIRE(f);
+        return f;
+    }
+
+    std::vector< std::string > entries() const {
+        std::vector< std::string > xs;
+        DIR* d = ::opendir(this->dir.c_str());
+        if (not d) return xs;
+        while (const auto* e = ::readdir(d)) {
+            const auto name = std::string(e->d_name);
+            if (name != "." and name != "..")
+                xs.push_back(name);
+        }
+        ::closedir(d);
+        return xs;
+    }
+
+    /*
+     * Wait for the background thread to put the copy in place, after the
+     * handle is closed
+     */
+    bool materialised() const {
+        for (int i = 0; i < 500; ++i) {
+            const auto xs = this->entries();
+            if (xs.size() == 1 and xs.front().find(".tmp.") == std::string::npos)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    void clean() const {
+        for (const auto& name : this->entries())
+            std::remove((this->dir + "/" + name).c_str());
+    }
+
+    /* next to the file, so that it is just as unique */
+    std::string dir;
+};
+
+std::vector< unsigned char > readall(lfp_protocol* f) {
+    auto out = std::vector< unsigned char >(100);
+    std::int64_t bytes_read = -1;
+    const auto err = lfp_readinto(f, out.data(), out.size(), &bytes_read);
+    CHECK(err == LFP_EOF);
+    out.resize(bytes_read);
+    return out;
+}
+
+}
+
+TEST_CASE_METHOD(
+    cache_dir,
+    "Reopened files are served from the cache",
+    "[cache][tapeimage]") {
+    auto* first = open();
+    CHECK_THAT(readall(first), Equals(logical));
+    lfp_close(first);
+    REQUIRE(materialised());
+
+    auto* second = open();
+    lfp_protocol* inner = nullptr;
+    auto err = lfp_peel(second, &inner);
+    CHECK(err == LFP_LEAF_PROTOCOL);
+    CHECK_THAT(readall(second), Equals(logical));
+    CHECK(lfp_eof(second));
+
+    err = lfp_seek(second, 6);
+    CHECK(err == LFP_OK);
+    std::int64_t tell = -1;
+    lfp_tell(second, &tell);
+    CHECK(tell == 6);
+
+    unsigned char x[2];
+    err = lfp_readinto(second, x, 2, nullptr);
+    CHECK(err == LFP_OK);
+    CHECK(x[0] == 0x07);
+    CHECK(x[1] == 0x08);
+
+    lfp_close(second);
+}
+
+TEST_CASE_METHOD(
+    cache_dir,
+    "The stream is copied when the handle is closed",
+    "[cache][tapeimage]") {
+    auto* f = open();
+
+    unsigned char x[3];
+    for (int i = 0; i < 5; ++i) {
+        std::int64_t bytes_read = -1;
+        const auto err = lfp_readinto(f, x, 3, &bytes_read);
+        CHECK(err == LFP_OK);
+        CHECK(bytes_read == 3);
+        CHECK(x[0] == logical[3 * i]);
+        CHECK(x[2] == logical[3 * i + 2]);
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == 3 * (i + 1));
+    }
+
+    CHECK(entries().empty());
+    lfp_close(f);
+    REQUIRE(materialised());
+}
+
+TEST_CASE_METHOD(
+    cache_dir,
+    "The cached stream reports offsets in the original file",
+    "[cache][tapeimage]") {
+    auto* first = open();
+    const std::int64_t offsets[] = { 0, 3, 4, 6, 8, 15, 16 };
+    std::int64_t expected[7];
+    auto err = lfp_translate(first, offsets, expected, 7);
+    CHECK(err == LFP_OK);
+    CHECK(expected[0] == 12);
+    CHECK(expected[3] == 30);
+    CHECK(expected[5] == 51);
+    readall(first);
+    lfp_close(first);
+    REQUIRE(materialised());
+
+    auto* second = open();
+    lfp_protocol* inner = nullptr;
+    CHECK(lfp_peel(second, &inner) == LFP_LEAF_PROTOCOL);
+
+    std::int64_t physical[7];
+    err = lfp_translate(second, offsets, physical, 7);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(std::vector< std::int64_t >(physical, physical + 7),
+               Equals(std::vector< std::int64_t >(expected, expected + 7)));
+
+    const std::int64_t past = 17;
+    err = lfp_translate(second, &past, physical, 1);
+    CHECK(err == LFP_INVALID_ARGS);
+
+    err = lfp_seek(second, 5);
+    CHECK(err == LFP_OK);
+    std::int64_t ptell = -1;
+    lfp_ptell(second, &ptell);
+    CHECK(ptell == 29);
+
+    lfp_close(second);
+}
+
+TEST_CASE_METHOD(
+    cache_dir,
+    "Modified files are not served from the cache",
+    "[cache][tapeimage]") {
+    auto* first = open();
+    lfp_close(first);
+    REQUIRE(materialised());
+
+    auto modified = tif;
+    modified[12] = 0xFF;
+    /* make sure the modification time changes on coarse file systems */
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    write(modified);
+
+    auto* second = open();
+    unsigned char x = 0;
+    const auto err = lfp_readinto(second, &x, 1, nullptr);
+    CHECK(err == LFP_OK);
+    CHECK(x == 0xFF);
+
+    lfp_protocol* inner = nullptr;
+    CHECK(lfp_peek(second, &inner) == LFP_OK);
+    lfp_close(second);
+}
+
+TEST_CASE_METHOD(
+    cache_dir,
+    "Layers can be inserted below the cache layer",
+    "[cache][tapeimage][insert_below]") {
+    auto* f = open();
+    unsigned char x[2];
+    auto err = lfp_readinto(f, x, 2, nullptr);
+    CHECK(err == LFP_OK);
+
+    lfp_protocol* before = nullptr;
+    lfp_peek(f, &before);
+
+    const auto factory = [] (lfp_protocol* inner, void*) {
+        return lfp_readahead_open(inner, 64);
+    };
+    err = lfp_insert_below(f, factory, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    lfp_protocol* after = nullptr;
+    CHECK(lfp_peek(f, &after) == LFP_OK);
+    CHECK(after != before);
+
+    std::int64_t bytes_read = -1;
+    err = lfp_readinto(f, x, 2, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(x[0] == 0x03);
+    CHECK(x[1] == 0x04);
+
+    lfp_close(f);
+    REQUIRE(materialised());
+}
+
+TEST_CASE(
+    "Files without identity are not cached",
+    "[cache]") {
+    auto* mem = lfp_memfile_openwith(tif.data(), tif.size());
+    auto* f = lfp_cache_open(mem, ".");
+    CHECK(f == mem);
+    CHECK(lfp_cache_open(nullptr, ".") == nullptr);
+    CHECK(lfp_cache_open(f, nullptr) == nullptr);
+    lfp_close(f);
+}
+
+#endif
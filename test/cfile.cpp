@@ -460,3 +460,150 @@ TEST_CASE(
         CHECK(err == LFP_OK);
     }
 }
+
+namespace {
+
+/*
+ * The lazy cfile opens files by path, so the contents must be written to an
+ * actual file system entry rather than a tmpfile()
+ */
+struct lazy_file : disk_file {
+    lazy_file() : disk_file("lfp-lazy-cfile") {
+        for (int i = 0; i < 256; ++i)
+            contents.push_back(i);
+
+        this->write(contents);
+    }
+
+    ~lazy_file() {
+        lfp_cfile_lazy_capacity(128);
+    }
+
+    std::vector< unsigned char > contents;
+};
+
+}
+
+TEST_CASE_METHOD(
+    lazy_file,
+    "Lazy cfile of non-existing file is a no-op",
+    "[cfile][lazy]") {
+    auto* cfile = lfp_cfile_open_lazy((path + ".no-such-file").c_str(), 0);
+    CHECK(!cfile);
+}
+
+TEST_CASE_METHOD(
+    lazy_file,
+    "Lazy cfiles survive eviction",
+    "[cfile][lazy]") {
+    lfp_cfile_lazy_capacity(1);
+
+    auto* a = lfp_cfile_open_lazy(path.c_str(), 0);
+    auto* b = lfp_cfile_open_lazy(path.c_str(), 8);
+    REQUIRE(a);
+    REQUIRE(b);
+
+    auto out = std::vector< unsigned char >(4, 0xFF);
+    std::int64_t nread = -1;
+
+    SECTION( "interleaved reads resume at the right position" ) {
+        for (int i = 0; i < 4; ++i) {
+            auto err = lfp_readinto(a, out.data(), 4, &nread);
+            CHECK(err == LFP_OK);
+            CHECK(nread == 4);
+            CHECK(out[0] == 4 * i);
+
+            err = lfp_readinto(b, out.data(), 4, &nread);
+            CHECK(err == LFP_OK);
+            CHECK(nread == 4);
+            CHECK(out[0] == 8 + 4 * i);
+        }
+
+        std::int64_t tell;
+        auto err = lfp_tell(a, &tell);
+        CHECK(err == LFP_OK);
+        CHECK(tell == 16);
+
+        std::int64_t ptell;
+        err = lfp_ptell(b, &ptell);
+        CHECK(err == LFP_OK);
+        CHECK(ptell == 24);
+    }
+
+    SECTION( "seek on evicted handle" ) {
+        auto err = lfp_readinto(b, out.data(), 4, &nread);
+        CHECK(err == LFP_OK);
+
+        err = lfp_seek(a, 100);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(b, out.data(), 4, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(out[0] == 12);
+
+        err = lfp_readinto(a, out.data(), 4, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(out[0] == 100);
+    }
+
+    SECTION( "eof is preserved through eviction" ) {
+        auto err = lfp_seek(a, 254);
+        CHECK(err == LFP_OK);
+        err = lfp_readinto(a, out.data(), 4, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 2);
+        CHECK(lfp_eof(a));
+
+        err = lfp_readinto(b, out.data(), 4, &nread);
+        CHECK(err == LFP_OK);
+        CHECK(lfp_eof(a));
+
+        err = lfp_readinto(a, out.data(), 4, &nread);
+        CHECK(err == LFP_EOF);
+        CHECK(nread == 0);
+    }
+
+    CHECK(lfp_close(a) == LFP_OK);
+    CHECK(lfp_close(b) == LFP_OK);
+}
+
+TEST_CASE_METHOD(
+    lazy_file,
+    "Protocols can be layered on lazy cfile",
+    "[cfile][lazy]") {
+    const auto tif = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+    };
+    write(tif);
+
+    lfp_cfile_lazy_capacity(1);
+    auto* outer1 = lfp_tapeimage_open(lfp_cfile_open_lazy(path.c_str(), 0));
+    auto* outer2 = lfp_tapeimage_open(lfp_cfile_open_lazy(path.c_str(), 0));
+    REQUIRE(outer1);
+    REQUIRE(outer2);
+
+    auto out = std::vector< unsigned char >(8, 0xFF);
+    std::int64_t nread = -1;
+    auto err = lfp_readinto(outer1, out.data(), 3, &nread);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(outer2, out.data(), 8, &nread);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(outer1, out.data() + 3, 5, &nread);
+    CHECK(err == LFP_OK);
+
+    const auto expected = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    };
+    CHECK_THAT(out, Equals(expected));
+
+    CHECK(lfp_close(outer1) == LFP_OK);
+    CHECK(lfp_close(outer2) == LFP_OK);
+}
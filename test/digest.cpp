@@ -0,0 +1,372 @@
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/digest.h>
+#include <lfp/lfp.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * Bit-by-bit reference CRC32C, to check both the table and the hardware
+ * implementations against
+ */
+std::uint32_t reference_crc32c(const unsigned char* p, std::size_t len) {
+    std::uint32_t crc = 0xFFFFFFFF;
+    for (std::size_t i = 0; i < len; ++i) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+std::uint32_t reference_crc32c(const std::vector< unsigned char >& v) {
+    return reference_crc32c(v.data(), v.size());
+}
+
+std::vector< unsigned char > sequence(std::size_t len) {
+    auto v = std::vector< unsigned char >(len);
+    std::uint8_t x = 1;
+    for (auto& c : v) {
+        c = x;
+        x = x * 13 + 7;
+    }
+    return v;
+}
+
+}
+
+TEST_CASE(
+    "Digest of the check string",
+    "[digest]") {
+    const char* check = "123456789";
+    const auto* p = reinterpret_cast< const unsigned char* >(check);
+    auto* f = lfp_digest_open(memopen(p, 9).release(), 0);
+    REQUIRE(f);
+
+    std::uint32_t crc = 0;
+    std::int64_t len = -1;
+    auto err = lfp_digest_file(f, &crc, &len);
+    CHECK(err == LFP_OKINCOMPLETE);
+    CHECK(crc == 0);
+    CHECK(len == 0);
+
+    unsigned char out[16];
+    err = lfp_readinto(f, out, sizeof(out), nullptr);
+    CHECK(err == LFP_EOF);
+
+    err = lfp_digest_file(f, &crc, &len);
+    CHECK(err == LFP_OK);
+    CHECK(crc == 0xE3069283);
+    CHECK(len == 9);
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Digest open rejects invalid arguments",
+    "[digest]") {
+    CHECK(not lfp_digest_open(nullptr, 0));
+
+    auto mem = memopen();
+    CHECK(not lfp_digest_open(mem.get(), -1));
+}
+
+TEST_CASE(
+    "Digest is not available without a digest protocol",
+    "[digest]") {
+    auto mem = memopen();
+
+    std::uint32_t crc;
+    std::uint32_t blocks[1];
+    CHECK(lfp_digest_file(mem.get(), &crc, nullptr) == LFP_NOTIMPLEMENTED);
+    CHECK(lfp_digest_blocks(mem.get(), 0, 1, blocks, nullptr)
+          == LFP_NOTIMPLEMENTED);
+}
+
+TEST_CASE(
+    "Digest of reads in arbitrary chunks",
+    "[digest]") {
+    /* long enough for the 8-byte loops, not a multiple of 8 or the block */
+    const auto contents = sequence(1000 + 5);
+    const std::int64_t block = 64;
+    auto* f = lfp_digest_open(memopen(contents).release(), block);
+    REQUIRE(f);
+
+    const auto chunk = GENERATE(1, 7, 64, 100, 2000);
+    auto out = std::vector< unsigned char >(contents.size());
+    std::int64_t pos = 0;
+    while (true) {
+        std::int64_t n = 0;
+        const auto err = lfp_readinto(f, out.data() + pos, chunk, &n);
+        pos += n;
+        if (err == LFP_EOF)
+            break;
+        REQUIRE(err == LFP_OK);
+    }
+    CHECK(pos == std::int64_t(contents.size()));
+
+    std::uint32_t crc = 0;
+    std::int64_t len = -1;
+    auto err = lfp_digest_file(f, &crc, &len);
+    CHECK(err == LFP_OK);
+    CHECK(len == std::int64_t(contents.size()));
+    CHECK(crc == reference_crc32c(contents));
+
+    auto expected = std::vector< std::uint32_t >();
+    for (std::size_t i = 0; i < contents.size(); i += block) {
+        const auto n = (std::min)(std::size_t(block), contents.size() - i);
+        expected.push_back(reference_crc32c(contents.data() + i, n));
+    }
+
+    auto blocks = std::vector< std::uint32_t >(expected.size() + 5);
+    std::int64_t n = -1;
+    err = lfp_digest_blocks(f, 0, blocks.size(), blocks.data(), &n);
+    CHECK(err == LFP_OK);
+    CHECK(n == std::int64_t(expected.size()));
+    blocks.resize(n);
+    CHECK_THAT(blocks, Equals(expected));
+
+    err = lfp_digest_blocks(f, 3, 2, blocks.data(), &n);
+    CHECK(err == LFP_OK);
+    CHECK(n == 2);
+    CHECK(blocks[0] == expected[3]);
+    CHECK(blocks[1] == expected[4]);
+
+    err = lfp_digest_blocks(f, -1, 2, blocks.data(), &n);
+    CHECK(err == LFP_INVALID_ARGS);
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Digest covers the prefix read without gaps",
+    "[digest]") {
+    const auto contents = sequence(300);
+    auto* f = lfp_digest_open(memopen(contents).release(), 100);
+    REQUIRE(f);
+
+    unsigned char out[300];
+    std::uint32_t crc = 0;
+    std::int64_t len = -1;
+    std::uint32_t blocks[3];
+    std::int64_t n = -1;
+
+    auto err = lfp_readinto(f, out, 50, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    SECTION("reads past a seek forward are not checksummed") {
+        lfp_seek(f, 200);
+        err = lfp_readinto(f, out, 100, nullptr);
+        CHECK(err == LFP_OK);
+
+        err = lfp_digest_file(f, &crc, &len);
+        CHECK(err == LFP_OKINCOMPLETE);
+        CHECK(len == 50);
+        CHECK(crc == reference_crc32c(contents.data(), 50));
+
+        lfp_digest_blocks(f, 0, 3, blocks, &n);
+        CHECK(n == 0);
+    }
+
+    SECTION("the gap is checksummed when it is read") {
+        lfp_seek(f, 200);
+        lfp_readinto(f, out, 100, nullptr);
+        lfp_seek(f, 20);
+        err = lfp_readinto(f, out, 200, nullptr);
+        CHECK(err == LFP_OK);
+
+        err = lfp_digest_file(f, &crc, &len);
+        CHECK(err == LFP_OKINCOMPLETE);
+        CHECK(len == 220);
+        CHECK(crc == reference_crc32c(contents.data(), 220));
+
+        lfp_digest_blocks(f, 0, 3, blocks, &n);
+        CHECK(n == 2);
+        CHECK(blocks[1] == reference_crc32c(contents.data() + 100, 100));
+
+        err = lfp_readinto(f, out, 200, nullptr);
+        CHECK(err == LFP_EOF);
+
+        err = lfp_digest_file(f, &crc, &len);
+        CHECK(err == LFP_OK);
+        CHECK(len == 300);
+        CHECK(crc == reference_crc32c(contents));
+
+        lfp_digest_blocks(f, 0, 3, blocks, &n);
+        CHECK(n == 3);
+        CHECK(blocks[2] == reference_crc32c(contents.data() + 200, 100));
+    }
+
+    SECTION("bytes read again are not checksummed twice") {
+        lfp_seek(f, 0);
+        err = lfp_readinto(f, out, 300, nullptr);
+        CHECK(err == LFP_OK);
+
+        lfp_seek(f, 10);
+        err = lfp_readinto(f, out, 300, nullptr);
+        CHECK(err == LFP_EOF);
+
+        err = lfp_digest_file(f, &crc, &len);
+        CHECK(err == LFP_OK);
+        CHECK(len == 300);
+        CHECK(crc == reference_crc32c(contents));
+    }
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Digest layers at different levels of the stack",
+    "[digest][tapeimage]") {
+    /* two records and a file mark */
+    tapeimage_file image;
+    image.push(0, 25);
+    image.push(0, 15);
+    image.push(1, 0);
+    const auto& file = image.file;
+    const auto& logical = image.expected;
+
+    auto* physical = lfp_digest_open(memopen(file).release(), 0);
+    auto* tif = lfp_tapeimage_open(physical);
+    REQUIRE(tif);
+    auto* f = lfp_digest_open(tif, 0);
+    REQUIRE(f);
+
+    auto out = std::vector< unsigned char >(50);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(f, out.data(), out.size(), &bytes_read);
+    CHECK(err == LFP_EOF);
+    CHECK(bytes_read == 40);
+
+    std::uint32_t crc = 0;
+    std::int64_t len = -1;
+    err = lfp_digest_file(f, &crc, &len);
+    CHECK(err == LFP_OK);
+    CHECK(len == 40);
+    CHECK(crc == reference_crc32c(logical));
+
+    /*
+     * The file mark ends the logical file, so the physical stream is read to
+     * the end, but never past it
+     */
+    err = lfp_digest_file(tif, &crc, &len);
+    CHECK(err == LFP_OKINCOMPLETE);
+    CHECK(len == std::int64_t(file.size()));
+    CHECK(crc == reference_crc32c(file));
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Digest starts at the position of the protocol it is opened on",
+    "[digest]") {
+    const auto contents = sequence(64);
+    auto mem = memopen(contents);
+    auto err = lfp_seek(mem.get(), 16);
+    REQUIRE(err == LFP_OK);
+
+    auto* f = lfp_digest_open(mem.release(), 32);
+    REQUIRE(f);
+
+    std::int64_t tell = -1;
+    lfp_tell(f, &tell);
+    CHECK(tell == 16);
+
+    unsigned char out[64];
+    std::int64_t bytes_read = -1;
+    err = lfp_readinto(f, out, sizeof(out), &bytes_read);
+    CHECK(err == LFP_EOF);
+    CHECK(bytes_read == 48);
+
+    std::uint32_t crc = 0;
+    std::int64_t len = -1;
+    err = lfp_digest_file(f, &crc, &len);
+    CHECK(err == LFP_OK);
+    CHECK(len == 48);
+    CHECK(crc == reference_crc32c(contents.data() + 16, 48));
+
+    /* blocks are counted from the start of the digest too */
+    std::uint32_t blocks[2];
+    std::int64_t n = -1;
+    err = lfp_digest_blocks(f, 0, 2, blocks, &n);
+    CHECK(err == LFP_OK);
+    CHECK(n == 2);
+    CHECK(blocks[0] == reference_crc32c(contents.data() + 16, 32));
+    CHECK(blocks[1] == reference_crc32c(contents.data() + 48, 16));
+
+    /* bytes before the start are never part of the digest */
+    lfp_seek(f, 0);
+    lfp_readinto(f, out, sizeof(out), nullptr);
+    err = lfp_digest_file(f, &crc, &len);
+    CHECK(err == LFP_OK);
+    CHECK(len == 48);
+    CHECK(crc == reference_crc32c(contents.data() + 16, 48));
+
+    lfp_close(f);
+}
+
+namespace {
+
+/* open a digest on inner, and record where it starts */
+lfp_protocol* digest_at(lfp_protocol* inner, void* userdata) {
+    auto* start = static_cast< std::int64_t* >(userdata);
+    lfp_tell(inner, start);
+    return lfp_digest_open(inner, 0);
+}
+
+}
+
+TEST_CASE(
+    "Digest inserted below a tapeimage after reads",
+    "[digest][tapeimage][insert]") {
+    tapeimage_file image;
+    image.push(0, 25);
+    image.push(0, 15);
+    image.push(0, 30);
+    image.push(1, 0);
+    const auto& file = image.file;
+    const auto& logical = image.expected;
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    auto out = std::vector< unsigned char >(logical.size() + 10);
+    auto err = lfp_readinto(tif, out.data(), 30, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t start = -1;
+    err = lfp_insert_below(tif, digest_at, &start);
+    REQUIRE(err == LFP_OK);
+    REQUIRE(start > 0);
+    REQUIRE(start < std::int64_t(file.size()));
+
+    std::int64_t bytes_read = -1;
+    err = lfp_readinto(tif, out.data() + 30, logical.size() - 20, &bytes_read);
+    CHECK(err == LFP_EOF);
+    CHECK(bytes_read == std::int64_t(logical.size()) - 30);
+    out.resize(logical.size());
+    CHECK_THAT(out, Equals(logical));
+
+    /*
+     * The digest covers the physical stream from where it was inserted, up to
+     * the file mark
+     */
+    std::uint32_t crc = 0;
+    std::int64_t len = -1;
+    err = lfp_digest_file(tif, &crc, &len);
+    CHECK(err == LFP_OKINCOMPLETE);
+    CHECK(len == std::int64_t(file.size()) - start);
+    CHECK(crc == reference_crc32c(file.data() + start, len));
+
+    lfp_close(tif);
+}
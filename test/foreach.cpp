@@ -0,0 +1,179 @@
+#include <atomic>
+#include <ciso646>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/memfile.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * A visible envelope with a mix of tiny, empty and max-size records, large
+ * enough for records to cross the read blocks of lfp_foreach_record()
+ */
+struct large_rp66 {
+    large_rp66() {
+        const int sizes[] = { 16, 0, 65000, 3, 20, 40000, 1 };
+        std::uint8_t x = 0;
+        for (int i = 0; this->expected.size() < (5 << 20); ++i) {
+            const auto n = sizes[i % 7];
+            const std::uint16_t len = n + 4;
+            this->file.push_back(len >> 8);
+            this->file.push_back(len & 0xFF);
+            this->file.push_back(0xFF);
+            this->file.push_back(0x01);
+            for (int k = 0; k < n; ++k) {
+                this->file.push_back(x);
+                this->expected.push_back(x);
+                x = (x * 7 + 3) % 251;
+            }
+            this->records += 1;
+        }
+
+        this->f = lfp_rp66_open(memopen(this->file).release());
+        REQUIRE(this->f);
+    }
+
+    ~large_rp66() {
+        lfp_close(this->f);
+    }
+
+    std::vector< unsigned char > file;
+    std::vector< unsigned char > expected;
+    std::int64_t records = 0;
+    lfp_protocol* f = nullptr;
+};
+
+struct visited {
+    const std::vector< unsigned char >* expected;
+    std::atomic< std::int64_t > visits { 0 };
+    std::atomic< std::int64_t > mismatches { 0 };
+    std::atomic< std::int64_t > bytes { 0 };
+    std::vector< std::int64_t > completed;
+    std::int64_t abort_at = -1;
+};
+
+int visit(const lfp_record* rec, const void* data, void* userdata) {
+    auto& v = *static_cast< visited* >(userdata);
+    const auto* expected = v.expected->data() + rec->logical;
+    if (rec->length > 0 and std::memcmp(data, expected, rec->length) != 0)
+        v.mismatches += 1;
+
+    v.visits += 1;
+    v.bytes += rec->length;
+
+    if (rec->logical == v.abort_at)
+        return 7;
+    return 0;
+}
+
+int complete(const lfp_record* rec, const void*, void* userdata) {
+    auto& v = *static_cast< visited* >(userdata);
+    v.completed.push_back(rec->logical);
+    return 0;
+}
+
+}
+
+TEST_CASE_METHOD(
+    large_rp66,
+    "Every record is visited once",
+    "[foreach][rp66]") {
+    const auto nthreads = GENERATE(0, 1, 4);
+
+    visited v;
+    v.expected = &expected;
+    const auto err = lfp_foreach_record(f, visit, complete, &v, nthreads);
+    CHECK(err == LFP_OK);
+    CHECK(v.visits == records);
+    CHECK(v.mismatches == 0);
+    CHECK(v.bytes == std::int64_t(expected.size()));
+
+    REQUIRE(v.completed.size() == std::size_t(records));
+    CHECK(std::is_sorted(v.completed.begin(), v.completed.end()));
+    CHECK(lfp_eof(f));
+}
+
+TEST_CASE_METHOD(
+    large_rp66,
+    "Records can be visited without completion",
+    "[foreach][rp66]") {
+    visited v;
+    v.expected = &expected;
+    const auto err = lfp_foreach_record(f, visit, nullptr, &v, 3);
+    CHECK(err == LFP_OK);
+    CHECK(v.visits == records);
+    CHECK(v.mismatches == 0);
+    CHECK(v.completed.empty());
+}
+
+TEST_CASE_METHOD(
+    large_rp66,
+    "Non-zero from the visitor stops the iteration",
+    "[foreach][rp66]") {
+    const auto nthreads = GENERATE(0, 2);
+
+    visited v;
+    v.expected = &expected;
+    v.abort_at = 16;
+    const auto err = lfp_foreach_record(f, visit, complete, &v, nthreads);
+    CHECK(err == 7);
+    CHECK(v.visits < records);
+}
+
+TEST_CASE(
+    "File marks are visited as records",
+    "[foreach][tapeimage]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+    };
+    const auto expected = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    };
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    visited v;
+    v.expected = &expected;
+    const auto err = lfp_foreach_record(tif, visit, complete, &v, 2);
+    CHECK(err == LFP_OK);
+    CHECK(v.visits == 2);
+    CHECK(v.mismatches == 0);
+    CHECK_THAT(v.completed, Equals(std::vector< std::int64_t > { 0, 8 }));
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Records can not be visited on protocols without index",
+    "[foreach]") {
+    const auto file = std::vector< unsigned char >(10, 0x01);
+    auto mem = memopen(file);
+
+    visited v;
+    v.expected = &file;
+    const auto err = lfp_foreach_record(mem.get(), visit, nullptr, &v, 0);
+    CHECK(err == LFP_NOTIMPLEMENTED);
+    CHECK(v.visits == 0);
+}
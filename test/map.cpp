@@ -0,0 +1,94 @@
+#include <ciso646>
+#include <cstdint>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/map.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+TEST_CASE(
+    "Map the logical stream of a tapeimage file",
+    "[map][tapeimage]") {
+    /*
+     * Records of varying size, so that pages span many records, and records
+     * span many pages
+     */
+    tapeimage_file image;
+    for (int i = 0; i < 300; ++i)
+        image.push(0, 20);
+    image.push(0, 0);
+    image.push(0, 150000);
+    for (int i = 0; i < 50; ++i)
+        image.push(0, 1000 + i);
+    image.push(1, 0);
+    const auto& expected = image.expected;
+
+    auto* tif = lfp_tapeimage_open(memopen(image.file).release());
+    REQUIRE(tif);
+
+    void* ptr = nullptr;
+    std::int64_t len = -1;
+    const auto err = lfp_map_logical(tif, &ptr, &len);
+    if (err == LFP_NOTSUPPORTED) {
+        WARN("userfaultfd not supported: " << lfp_errormsg(tif));
+        lfp_close(tif);
+        return;
+    }
+
+    REQUIRE(err == LFP_OK);
+    REQUIRE(ptr);
+    CHECK(len == std::int64_t(expected.size()));
+
+    const auto* p = static_cast< const unsigned char* >(ptr);
+
+    SECTION("random access") {
+        int mismatches = 0;
+        for (std::size_t i = 0; i < expected.size(); i += 997) {
+            const auto k = expected.size() - 1 - i;
+            if (p[k] != expected[k])
+                mismatches += 1;
+        }
+        CHECK(mismatches == 0);
+    }
+
+    SECTION("sequential access") {
+        const auto view = std::vector< unsigned char >(p, p + len);
+        CHECK_THAT(view, Equals(expected));
+    }
+
+    CHECK(lfp_unmap_logical(ptr) == LFP_OK);
+
+    /* the protocol is usable again after unmapping */
+    CHECK(lfp_seek(tif, 6000) == LFP_OK);
+    unsigned char byte;
+    CHECK(lfp_readinto(tif, &byte, 1, nullptr) == LFP_OK);
+    CHECK(byte == expected[6000]);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Map requires a record index",
+    "[map]") {
+    const auto contents = std::vector< unsigned char >(100, 0xFF);
+    auto mem = memopen(contents);
+
+    void* ptr = nullptr;
+    std::int64_t len = -1;
+    const auto err = lfp_map_logical(mem.get(), &ptr, &len);
+    CHECK((err == LFP_NOTIMPLEMENTED or err == LFP_NOTSUPPORTED));
+}
+
+TEST_CASE(
+    "Unmap rejects unknown pointers",
+    "[map]") {
+    int x = 0;
+    CHECK(lfp_unmap_logical(nullptr) == LFP_OK);
+    CHECK(lfp_unmap_logical(&x) == LFP_INVALID_ARGS);
+}
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <ciso646>
+#include <cstdint>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/protocol.hpp>
+#include <lfp/readahead.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * Pass-through protocol that records the reads that reach it
+ */
+class counting : public lfp_protocol {
+public:
+    explicit counting(lfp_protocol* f) : fp(f) {}
+
+    void close() noexcept (false) override {
+        if (this->fp) this->fp.close();
+    }
+
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+    noexcept (false) override {
+        this->reads.push_back(this->fp->tell());
+        this->lengths.push_back(len);
+        return this->fp->readinto(dst, len, bytes_read);
+    }
+
+    int eof() const noexcept (false) override {
+        return this->fp->eof();
+    }
+
+    void seek(std::int64_t n) noexcept (false) override {
+        this->fp->seek(n);
+    }
+
+    std::int64_t tell() const noexcept (false) override {
+        return this->fp->tell();
+    }
+
+    std::int64_t index_size() const noexcept (false) override {
+        return this->fp->index_size();
+    }
+
+    std::int64_t index_records(
+            std::int64_t first,
+            std::int64_t len,
+            lfp_record* dst)
+    const noexcept (false) override {
+        return this->fp->index_records(first, len, dst);
+    }
+
+    lfp_protocol* peel() noexcept (false) override {
+        return this->fp.release();
+    }
+
+    lfp_protocol* peek() const noexcept (false) override {
+        return this->fp.get();
+    }
+
+    /* offset and length of every read */
+    std::vector< std::int64_t > reads;
+    std::vector< std::int64_t > lengths;
+
+private:
+    lfp::unique_lfp fp;
+};
+
+}
+
+TEST_CASE(
+    "Readahead open rejects invalid arguments",
+    "[readahead]") {
+    CHECK(not lfp_readahead_open(nullptr, 0));
+
+    auto mem = memopen();
+    CHECK(not lfp_readahead_open(mem.get(), -1));
+}
+
+TEST_CASE(
+    "Small reads are served from the buffer",
+    "[readahead]") {
+    auto contents = std::vector< unsigned char >(1000);
+    std::uint8_t x = 0;
+    for (auto& c : contents)
+        c = x++;
+
+    auto* inner = new counting(memopen(contents).release());
+    auto* f = lfp_readahead_open(inner, 64);
+    REQUIRE(f);
+
+    auto out = std::vector< unsigned char >(contents.size());
+    std::int64_t pos = 0;
+    lfp_status err = LFP_OK;
+    while (err == LFP_OK) {
+        std::int64_t n = 0;
+        err = lfp_status(lfp_readinto(f, out.data() + pos, 10, &n));
+        pos += n;
+    }
+    CHECK(err == LFP_EOF);
+    CHECK(pos == 1000);
+    CHECK_THAT(out, Equals(contents));
+    CHECK(inner->lengths.size() == 16);
+    CHECK(lfp_eof(f));
+
+    SECTION("seeks within the buffer do not reach the underlying protocol") {
+        const auto reads = inner->reads.size();
+        lfp_seek(f, 970);
+        unsigned char byte;
+        err = lfp_status(lfp_readinto(f, &byte, 1, nullptr));
+        CHECK(err == LFP_OK);
+        CHECK(byte == contents[970]);
+        CHECK(inner->reads.size() == reads);
+
+        std::int64_t tell = -1;
+        lfp_tell(f, &tell);
+        CHECK(tell == 971);
+    }
+
+    SECTION("large reads bypass the buffer") {
+        inner->lengths.clear();
+        lfp_seek(f, 100);
+        err = lfp_status(lfp_readinto(f, out.data(), 500, nullptr));
+        CHECK(err == LFP_OK);
+        CHECK(inner->lengths == std::vector< std::int64_t >{ 500 });
+        CHECK(std::equal(out.begin(), out.begin() + 500,
+                         contents.begin() + 100));
+    }
+
+    SECTION("peel leaves the underlying protocol at the current position") {
+        lfp_seek(f, 10);
+        lfp_protocol* peeled = nullptr;
+        CHECK(lfp_peel(f, &peeled) == LFP_OK);
+        std::int64_t tell = -1;
+        lfp_tell(peeled, &tell);
+        CHECK(tell == 10);
+        lfp_close(peeled);
+    }
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Readahead gives the same bytes for any access pattern",
+    "[readahead][tapeimage]") {
+    tapeimage_file tif;
+    for (int i = 0; i < 100; ++i)
+        tif.push(0, 20 + (i % 7) * 13);
+    tif.push(1, 0);
+
+    const auto size = GENERATE(0, 1, 100, 100000);
+    auto* f = lfp_readahead_open(
+        lfp_tapeimage_open(memopen(tif.file).release()),
+        size
+    );
+    REQUIRE(f);
+
+    const auto& expected = tif.expected;
+    const auto total = std::int64_t(expected.size());
+    auto out = std::vector< unsigned char >(total);
+    int mismatches = 0;
+    std::int64_t at = 7;
+    for (int i = 0; i < 200; ++i) {
+        at = (at * 31 + 17) % total;
+        const auto len = (std::min)(std::int64_t(1 + (i * 11) % 300),
+                                    total - at);
+        REQUIRE(lfp_seek(f, at) == LFP_OK);
+        std::int64_t n = -1;
+        lfp_readinto(f, out.data(), len, &n);
+        if (n != len or not std::equal(out.begin(), out.begin() + len,
+                                       expected.begin() + at))
+            mismatches += 1;
+    }
+    CHECK(mismatches == 0);
+
+    lfp_seek(f, 0);
+    std::int64_t n = -1;
+    const auto err = lfp_readinto(f, out.data(), total, &n);
+    CHECK(err == LFP_OK);
+    CHECK(n == total);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "Adaptive readahead fills whole records",
+    "[readahead][tapeimage]") {
+    tapeimage_file tif;
+
+    SECTION("many small records per fill") {
+        for (int i = 0; i < 20000; ++i)
+            tif.push(0, 20);
+        tif.push(1, 0);
+
+        auto* inner = new counting(lfp_tapeimage_open(memopen(tif.file).release()));
+        auto* f = lfp_readahead_open(inner, 0);
+        REQUIRE(f);
+
+        auto out = std::vector< unsigned char >(tif.expected.size());
+        int failures = 0;
+        for (std::size_t i = 0; i < out.size(); i += 20) {
+            const auto err = lfp_readinto(f, out.data() + i, 20, nullptr);
+            if (err != LFP_OK)
+                failures += 1;
+        }
+        CHECK(failures == 0);
+        CHECK_THAT(out, Equals(tif.expected));
+
+        /* the first fill is sized before any record is indexed */
+        CHECK(inner->reads.size() <= 4);
+        for (std::size_t i = 1; i < inner->reads.size(); ++i) {
+            const auto end = inner->reads[i] + inner->lengths[i];
+            CHECK(end % 20 == 0);
+        }
+
+        lfp_close(f);
+    }
+
+    SECTION("exactly one large record per fill") {
+        for (int i = 0; i < 4; ++i)
+            tif.push(0, 1000000);
+        tif.push(1, 0);
+
+        auto* inner = new counting(lfp_tapeimage_open(memopen(tif.file).release()));
+        auto* f = lfp_readahead_open(inner, 0);
+        REQUIRE(f);
+
+        /* a sequential streak, to grow the fill size to the record size */
+        auto out = std::vector< unsigned char >(tif.expected.size());
+        int failures = 0;
+        for (std::size_t i = 0; i < out.size(); i += 1000) {
+            const auto err = lfp_readinto(f, out.data() + i, 1000, nullptr);
+            if (err != LFP_OK)
+                failures += 1;
+        }
+        CHECK(failures == 0);
+        CHECK_THAT(out, Equals(tif.expected));
+
+        const auto last = inner->reads.size() - 1;
+        CHECK(inner->reads[last] == 3000000);
+        CHECK(inner->lengths[last] == 1000000);
+
+        lfp_close(f);
+    }
+}
@@ -0,0 +1,216 @@
+#include <ciso646>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/rp66.h>
+#include <lfp/tapeimage.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+const auto tif = std::vector< unsigned char > {
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00,
+
+    0x01, 0x02, 0x03, 0x04,
+
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x20, 0x00, 0x00, 0x00,
+
+    0x05, 0x06, 0x07, 0x08,
+
+    0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00,
+    0x30, 0x00, 0x00, 0x00,
+
+    0x09, 0x0A, 0x0B, 0x0C,
+};
+
+/*
+ * The registry identifies files by inode, so the same file must be opened
+ * several times from disk
+ */
+struct registry_file : disk_file {
+    registry_file() : disk_file("lfp-registry") {
+        lfp_index_registry_clear();
+        lfp_index_registry_enable(1);
+        this->write(tif);
+    }
+
+    ~registry_file() {
+        lfp_index_registry_enable(0);
+        lfp_index_registry_clear();
+    }
+
+    lfp_protocol* open(std::int64_t zero = 0) {
+        std::FILE* fp = std::fopen(this->path.c_str(), "rb");
+        REQUIRE(fp);
+        auto* f = lfp_tapeimage_open(lfp_cfile_open_at_offset(fp, zero));
+        REQUIRE(f);
+        return f;
+    }
+
+    std::int64_t indexed(lfp_protocol* f) {
+        std::int64_t n = -1;
+        const auto err = lfp_index_size(f, &n);
+        REQUIRE(err == LFP_OK);
+        return n;
+    }
+};
+
+}
+
+TEST_CASE_METHOD(
+    registry_file,
+    "Closed handles share their index",
+    "[registry][tapeimage]") {
+    auto* first = open();
+    CHECK(indexed(first) == 0);
+    auto err = lfp_seek(first, 9);
+    CHECK(err == LFP_OK);
+    CHECK(indexed(first) == 3);
+    lfp_close(first);
+
+    auto* second = open();
+    CHECK(indexed(second) == 3);
+
+    auto out = std::vector< unsigned char >(12);
+    std::int64_t bytes_read = -1;
+    err = lfp_readinto(second, out.data(), 12, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 12);
+    CHECK(out[0] == 0x01);
+    CHECK(out[11] == 0x0C);
+
+    err = lfp_seek(second, 5);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(second, out.data(), 2, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x06);
+    CHECK(out[1] == 0x07);
+
+    lfp_close(second);
+}
+
+TEST_CASE_METHOD(
+    registry_file,
+    "Open handles pick up indices when seeking past their own",
+    "[registry][tapeimage]") {
+    auto* late = open();
+    auto* scanner = open();
+
+    /* index the whole file, which publishes it */
+    auto err = lfp_seek(scanner, 100);
+    CHECK(err == LFP_OK);
+    CHECK(lfp_eof(scanner));
+    CHECK(indexed(scanner) == 3);
+    CHECK(indexed(late) == 0);
+
+    err = lfp_seek(late, 1);
+    CHECK(err == LFP_OK);
+    CHECK(indexed(late) == 3);
+
+    std::int64_t tell = -1;
+    lfp_tell(late, &tell);
+    CHECK(tell == 1);
+
+    char x = 0;
+    err = lfp_readinto(late, &x, 1, nullptr);
+    CHECK(err == LFP_OK);
+    CHECK(x == 0x02);
+
+    lfp_close(scanner);
+    lfp_close(late);
+}
+
+TEST_CASE_METHOD(
+    registry_file,
+    "Indices are only shared by identical files and stacks",
+    "[registry][tapeimage]") {
+    auto* first = open();
+    lfp_seek(first, 100);
+    CHECK(indexed(first) == 3);
+    lfp_close(first);
+
+    SECTION( "different offset" ) {
+        auto* f = open(16);
+        CHECK(indexed(f) == 0);
+        lfp_close(f);
+    }
+
+    SECTION( "different protocol" ) {
+        std::FILE* fp = std::fopen(path.c_str(), "rb");
+        REQUIRE(fp);
+        auto* f = lfp_rp66_open(lfp_cfile(fp));
+        REQUIRE(f);
+        CHECK(indexed(f) == 0);
+        lfp_close(f);
+    }
+
+    SECTION( "modified file" ) {
+        auto modified = tif;
+        modified.resize(modified.size() - 2);
+        write(modified);
+        auto* f = open();
+        CHECK(indexed(f) == 0);
+        lfp_close(f);
+    }
+
+    SECTION( "disabled registry" ) {
+        lfp_index_registry_enable(0);
+        auto* f = open();
+        CHECK(indexed(f) == 0);
+        lfp_close(f);
+    }
+
+    SECTION( "cleared registry" ) {
+        lfp_index_registry_clear();
+        auto* f = open();
+        CHECK(indexed(f) == 0);
+        lfp_close(f);
+    }
+}
+
+TEST_CASE_METHOD(
+    registry_file,
+    "Lazy and regular cfiles share indices",
+    "[registry][tapeimage][lazy]") {
+    auto* first = open();
+    lfp_seek(first, 100);
+    lfp_close(first);
+
+    auto* lazy = lfp_tapeimage_open(lfp_cfile_open_lazy(path.c_str(), 0));
+    REQUIRE(lazy);
+    CHECK(indexed(lazy) == 3);
+    lfp_close(lazy);
+}
+
+TEST_CASE(
+    "Memfiles are not shared",
+    "[registry][tapeimage]") {
+    lfp_index_registry_enable(1);
+
+    auto* first = lfp_tapeimage_open(memopen(tif).release());
+    REQUIRE(first);
+    lfp_seek(first, 9);
+    lfp_close(first);
+
+    auto* second = lfp_tapeimage_open(memopen(tif).release());
+    REQUIRE(second);
+    std::int64_t n = -1;
+    lfp_index_size(second, &n);
+    CHECK(n == 0);
+    lfp_close(second);
+
+    lfp_index_registry_enable(0);
+}
@@ -0,0 +1,151 @@
+#include <ciso646>
+#include <cstdint>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/retry.h>
+#include <lfp/rp66.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+const auto plain = std::vector< unsigned char > {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+};
+
+}
+
+TEST_CASE(
+    "Retry continues a read that failed halfway",
+    "[retry]") {
+    auto* flaky = new flakyfile(plain, { 0, 1 });
+    auto* retry = lfp_retry_open(flaky, 2, 0);
+    REQUIRE(retry);
+
+    auto out = std::vector< unsigned char >(16, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(retry, out.data(), 16, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 16);
+    CHECK_THAT(out, Equals(plain));
+    CHECK(flaky->recoveries == 2);
+    CHECK(flaky->calls == 3);
+
+    lfp_close(retry);
+}
+
+TEST_CASE(
+    "Retry gives up after the configured attempts",
+    "[retry]") {
+    auto* flaky = new flakyfile(plain, { 0, 1, 2 });
+    auto* retry = lfp_retry_open(flaky, 2, 1);
+    REQUIRE(retry);
+
+    auto out = std::vector< unsigned char >(16, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(retry, out.data(), 16, &bytes_read);
+    CHECK(err == LFP_IOERROR);
+    CHECK(flaky->calls == 3);
+    CHECK_THAT(lfp_errormsg(retry), Contains("transient"));
+
+    SECTION( "and can be used after manual recovery" ) {
+        err = lfp_recover(retry);
+        CHECK(err == LFP_OK);
+
+        std::int64_t tell = -1;
+        lfp_tell(retry, &tell);
+        CHECK(tell == 14);
+
+        err = lfp_readinto(retry, out.data(), 2, &bytes_read);
+        CHECK(err == LFP_OK);
+        CHECK(out[0] == 0x0F);
+        CHECK(out[1] == 0x10);
+    }
+
+    lfp_close(retry);
+}
+
+TEST_CASE(
+    "Retry over rp66 keeps the index",
+    "[retry][rp66]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x0C,
+        0xFF, 0x01,
+
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+
+        0x00, 0x0C,
+        0xFF, 0x01,
+
+        0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+    };
+
+    auto* flaky = new flakyfile(file, { 1, 3 });
+    auto* rp66 = lfp_rp66_open(flaky);
+    REQUIRE(rp66);
+    auto* retry = lfp_retry_open(rp66, 3, 0);
+    REQUIRE(retry);
+
+    auto out = std::vector< unsigned char >(16, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(retry, out.data(), 16, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 16);
+    CHECK_THAT(out, Equals(plain));
+    CHECK(flaky->recoveries == 2);
+
+    std::int64_t records = -1;
+    err = lfp_index_size(retry, &records);
+    CHECK(err == LFP_OK);
+    CHECK(records == 2);
+
+    err = lfp_seek(retry, 6);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(retry, out.data(), 4, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x07);
+    CHECK(out[3] == 0x0A);
+
+    lfp_close(retry);
+}
+
+TEST_CASE(
+    "Retry does not retry protocol errors",
+    "[retry][rp66]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x0C,
+        0xFF, 0x02,
+
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    };
+
+    auto* flaky = new flakyfile(file, {});
+    auto* rp66 = lfp_rp66_open(flaky);
+    REQUIRE(rp66);
+    auto* retry = lfp_retry_open(rp66, 3, 0);
+    REQUIRE(retry);
+
+    auto out = std::vector< unsigned char >(8, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(retry, out.data(), 8, &bytes_read);
+    CHECK(err == LFP_PROTOCOL_FATAL_ERROR);
+    CHECK(flaky->recoveries == 0);
+    CHECK(flaky->calls == 1);
+
+    lfp_close(retry);
+}
+
+TEST_CASE(
+    "Retry rejects invalid arguments",
+    "[retry]") {
+    auto mem = memopen(plain);
+    CHECK(not lfp_retry_open(nullptr, 1, 0));
+    CHECK(not lfp_retry_open(mem.get(), -1, 0));
+    CHECK(not lfp_retry_open(mem.get(), 1, -1));
+}
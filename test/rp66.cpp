@@ -6,6 +6,7 @@
 
 #include <lfp/protocol.hpp>
 #include <lfp/memfile.h>
+#include <lfp/retry.h>
 #include <lfp/rp66.h>
 #include <lfp/tapeimage.h>
 #include <lfp/lfp.h>
@@ -1092,3 +1093,405 @@ TEST_CASE_METHOD(
     }
 
 }
+
+TEST_CASE(
+    "rp66 can be reopened on a different file",
+    "[visible envelope][rp66][reopen]") {
+    const auto file1 = std::vector< unsigned char > {
+        0x00, 0x0C,
+        0xFF, 0x01,
+
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    };
+
+    const auto file2 = std::vector< unsigned char > {
+        0x00, 0x08,
+        0xFF, 0x01,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x00, 0x08,
+        0xFF, 0x01,
+
+        0x15, 0x16, 0x17, 0x18,
+    };
+
+    const auto expected = std::vector< unsigned char > {
+        0x11, 0x12, 0x13, 0x14,
+        0x15, 0x16, 0x17, 0x18,
+    };
+
+    auto* rp66 = lfp_rp66_open(memopen(file1).release());
+    REQUIRE(rp66);
+
+    auto out = std::vector< unsigned char >(8, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(rp66, out.data(), 8, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 8);
+
+    auto mem = memopen(file2);
+    err = lfp_reopen(rp66, mem.get());
+    REQUIRE(err == LFP_OK);
+    mem.release();
+
+    std::int64_t tell = -1;
+    err = lfp_tell(rp66, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 0);
+
+    err = lfp_readinto(rp66, out.data(), 8, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 8);
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(rp66, 3);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(rp66, out.data(), 2, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x14);
+    CHECK(out[1] == 0x15);
+
+    lfp_close(rp66);
+}
+
+TEST_CASE(
+    "Layers inserted below rp66 keep the index and position",
+    "[visible envelope][rp66][insert_below]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x08,
+        0xFF, 0x01,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x00, 0x08,
+        0xFF, 0x01,
+
+        0x15, 0x16, 0x17, 0x18,
+
+        0x00, 0x08,
+        0xFF, 0x01,
+
+        0x19, 0x1A, 0x1B, 0x1C,
+    };
+
+    const auto expected = std::vector< unsigned char > {
+        0x11, 0x12, 0x13, 0x14,
+        0x15, 0x16, 0x17, 0x18,
+        0x19, 0x1A, 0x1B, 0x1C,
+    };
+
+    auto* rp66 = lfp_rp66_open(memopen(file).release());
+    REQUIRE(rp66);
+
+    auto out = std::vector< unsigned char >(12, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(rp66, out.data(), 5, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 5);
+
+    std::int64_t records = -1;
+    err = lfp_index_size(rp66, &records);
+    CHECK(err == LFP_OK);
+
+    const auto factory = [] (lfp_protocol* f, void*) {
+        return lfp_retry_open(f, 3, 0);
+    };
+    err = lfp_insert_below(rp66, factory, nullptr);
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(rp66, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 5);
+
+    std::int64_t after = -1;
+    err = lfp_index_size(rp66, &after);
+    CHECK(err == LFP_OK);
+    CHECK(after == records);
+
+    err = lfp_readinto(rp66, out.data() + 5, 7, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 7);
+    CHECK_THAT(out, Equals(expected));
+
+    lfp_close(rp66);
+}
+
+TEST_CASE_METHOD(
+    random_rp66,
+    "Visible Envelope: translate matches seek and ptell",
+    "[visible envelope][rp66][translate]") {
+    const auto real_size = size;
+    const auto records = GENERATE(1, 2, 3, 5, 8, 13);
+    make(records);
+
+    auto offsets = std::vector< std::int64_t >(real_size + 1);
+    for (int i = 0; i <= real_size; ++i)
+        offsets[i] = i;
+
+    auto physical = std::vector< std::int64_t >(offsets.size(), -1);
+    auto err = lfp_translate(f, offsets.data(), physical.data(), offsets.size());
+    REQUIRE(err == LFP_OK);
+
+    auto* ref = lfp_rp66_open(
+        lfp_memfile_openwith(bytes.data(), bytes.size())
+    );
+    REQUIRE(ref);
+
+    /* index the whole file first, like translate does */
+    lfp_seek(ref, real_size);
+    auto expected_physical = std::vector< std::int64_t >(offsets.size(), -1);
+    for (int i = 0; i < real_size; ++i) {
+        lfp_seek(ref, offsets[i]);
+        lfp_ptell(ref, &expected_physical[i]);
+    }
+    lfp_close(ref);
+
+    /*
+     * The memfile can not seek to its end, but the end of the file is right
+     * after the last byte
+     */
+    expected_physical.back() = expected_physical[real_size - 1] + 1;
+
+    CHECK_THAT(physical, Equals(expected_physical));
+
+    std::int64_t tell = -1;
+    err = lfp_tell(f, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 0);
+}
+
+TEST_CASE(
+    "Translate through rp66 on tapeimage matches seek and ptell",
+    "[visible envelope][rp66][tapeimage][translate]") {
+    /* Visible Records of 10 and 8 bytes */
+    const auto ve = std::vector< unsigned char > {
+        0x00, 0x0A,
+        0xFF, 0x01,
+
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+
+        0x00, 0x08,
+        0xFF, 0x01,
+
+        0x07, 0x08, 0x09, 0x0A,
+    };
+
+    /* tape image records of 5 bytes, so that the VE headers are split */
+    tapeimage_file image;
+    for (std::size_t i = 0; i < ve.size(); i += 5)
+        image.push(0, ve.data() + i, std::min< std::size_t >(5, ve.size() - i));
+    const auto& file = image.file;
+
+    auto* f = lfp_rp66_open(lfp_tapeimage_open(memopen(file).release()));
+    REQUIRE(f);
+
+    auto offsets = std::vector< std::int64_t >(11);
+    for (std::size_t i = 0; i < offsets.size(); ++i)
+        offsets[i] = i;
+
+    auto physical = offsets;
+    auto err = lfp_translate(f, physical.data(), physical.data(), 11);
+    REQUIRE(err == LFP_OK);
+
+    auto* ref = lfp_rp66_open(lfp_tapeimage_open(memopen(file).release()));
+    REQUIRE(ref);
+
+    /* index the whole file first, like translate does */
+    lfp_seek(ref, 10);
+    auto expected = std::vector< std::int64_t >(offsets.size(), -1);
+    for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+        lfp_seek(ref, offsets[i]);
+        lfp_ptell(ref, &expected[i]);
+    }
+    lfp_close(ref);
+
+    /* the end of the file is right after the last byte */
+    expected.back() = expected[9] + 1;
+
+    CHECK_THAT(physical, Equals(expected));
+
+    unsigned char out[10];
+    std::int64_t bytes_read = -1;
+    err = lfp_readinto(f, out, 10, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 10);
+    CHECK(out[0] == 0x01);
+    CHECK(out[9] == 0x0A);
+
+    lfp_close(f);
+}
+
+TEST_CASE(
+    "rp66 recovers from transient errors and keeps the index",
+    "[visible envelope][rp66][recover]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x0C,
+        0xFF, 0x01,
+
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+
+        0x00, 0x0C,
+        0xFF, 0x01,
+
+        0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+    };
+
+    const auto expected = std::vector< unsigned char > {
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+    };
+
+    /*
+     * The reads of the underlying file are header 1, body 1, header 2, body 2,
+     * so fail either in the middle of a header, or a body
+     */
+    const auto failing = GENERATE(2, 3);
+    auto* flaky = new flakyfile(file, { failing });
+    auto* rp66 = lfp_rp66_open(flaky);
+    REQUIRE(rp66);
+
+    auto out = std::vector< unsigned char >(16, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(rp66, out.data(), 16, &bytes_read);
+    CHECK(err == LFP_IOERROR);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(rp66, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 8);
+
+    err = lfp_recover(rp66);
+    CHECK(err == LFP_OK);
+    CHECK(flaky->recoveries == 1);
+
+    err = lfp_readinto(rp66, out.data() + 8, 8, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 8);
+    CHECK_THAT(out, Equals(expected));
+
+    std::int64_t records = -1;
+    lfp_index_size(rp66, &records);
+    CHECK(records == 2);
+    /* only the failed read is repeated, nothing is re-indexed */
+    CHECK(flaky->calls == 5);
+
+    lfp_close(rp66);
+}
+
+TEST_CASE(
+    "rp66 cold seek can be done in bounded steps",
+    "[visible envelope][rp66][seek_step]") {
+    std::vector< unsigned char > file;
+    for (int i = 0; i < 20; ++i) {
+        const auto vr = { 0x00, 0x08, 0xFF, 0x01 };
+        file.insert(file.end(), vr.begin(), vr.end());
+        for (int k = 0; k < 4; ++k)
+            file.push_back(4 * i + k);
+    }
+
+    auto* rp66 = lfp_rp66_open(memopen(file).release());
+    REQUIRE(rp66);
+
+    int steps = 0;
+    int err = LFP_OKINCOMPLETE;
+    while (err == LFP_OKINCOMPLETE) {
+        err = lfp_seek_step(rp66, 65, 4);
+        steps += 1;
+
+        std::int64_t tell = -1;
+        CHECK(lfp_tell(rp66, &tell) == LFP_OK);
+        CHECK(tell <= 65);
+    }
+
+    CHECK(err == LFP_OK);
+    CHECK(steps == 5);
+
+    std::int64_t size = -1;
+    lfp_index_size(rp66, &size);
+    CHECK(size == 17);
+
+    unsigned char x = 0;
+    err = lfp_readinto(rp66, &x, 1, nullptr);
+    CHECK(err == LFP_OK);
+    CHECK(x == 65);
+
+    lfp_close(rp66);
+}
+
+TEST_CASE(
+    "rp66 runs of empty and equally sized records",
+    "[visible envelope][rp66][runs]") {
+    const int sizes[] = { 8, 8, 0, 8, 3, 0, 20 };
+    const int repeat[] = { 4, 1, 2000, 7, 1, 300, 2 };
+
+    std::vector< unsigned char > file;
+    std::vector< unsigned char > expected;
+    std::vector< std::int64_t > lengths;
+    std::uint8_t x = 0;
+    for (int i = 0; i < 7; ++i) {
+        for (int k = 0; k < repeat[i]; ++k) {
+            const std::uint16_t len = sizes[i] + 4;
+            file.push_back(len >> 8);
+            file.push_back(len & 0xFF);
+            file.push_back(0xFF);
+            file.push_back(0x01);
+            for (int j = 0; j < sizes[i]; ++j) {
+                file.push_back(x);
+                expected.push_back(x);
+                x += 1;
+            }
+            lengths.push_back(sizes[i]);
+        }
+    }
+
+    auto* rp66 = lfp_rp66_open(memopen(file).release());
+    REQUIRE(rp66);
+
+    const auto readall = [&] {
+        auto out = std::vector< unsigned char >(expected.size() + 10);
+        std::int64_t bytes_read = -1;
+        const auto err = lfp_readinto(rp66, out.data(), out.size(), &bytes_read);
+        CHECK(err == LFP_EOF);
+        out.resize(bytes_read);
+        return out;
+    };
+
+    CHECK_THAT(readall(), Equals(expected));
+
+    std::int64_t size = -1;
+    lfp_index_size(rp66, &size);
+    REQUIRE(size == std::int64_t(lengths.size()));
+
+    auto records = std::vector< lfp_record >(size);
+    std::int64_t n = -1;
+    lfp_index_records(rp66, 0, size, records.data(), &n);
+    REQUIRE(n == size);
+    std::int64_t logical = 0;
+    for (std::int64_t i = 0; i < size; ++i) {
+        CHECK(records[i].length == lengths[i]);
+        CHECK(records[i].logical == logical);
+        CHECK(records[i].base == 4 * i + logical);
+        logical += lengths[i];
+    }
+
+    /* re-reading the file goes through the index */
+    auto err = lfp_seek(rp66, 0);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(readall(), Equals(expected));
+
+    for (std::int64_t pos = expected.size() - 1; pos >= 0; pos -= 3) {
+        err = lfp_seek(rp66, pos);
+        CHECK(err == LFP_OK);
+        std::int64_t tell = -1;
+        lfp_tell(rp66, &tell);
+        CHECK(tell == pos);
+
+        unsigned char b = 0;
+        err = lfp_readinto(rp66, &b, 1, nullptr);
+        CHECK(b == expected[pos]);
+    }
+
+    lfp_close(rp66);
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <ciso646>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include <lfp/lfp.h>
+#include <lfp/scheduler.h>
+
+#include "utils.hpp"
+
+using namespace Catch::Matchers;
+
+namespace {
+
+/*
+ * The scheduler is only used by the cfile leaves, so reads must go to disk.
+ * The file is larger than a few quanta, and not a multiple of the quantum.
+ */
+struct scheduled_file : disk_file {
+    scheduled_file() : disk_file("lfp-scheduler") {
+        this->contents.resize((1 << 20) + 17);
+        std::uint8_t x = 0;
+        for (auto& c : this->contents) {
+            c = x;
+            x = (x * 7 + 3) % 251;
+        }
+
+        this->write(this->contents);
+
+        REQUIRE(lfp_scheduler_enable(1) == LFP_OK);
+    }
+
+    ~scheduled_file() {
+        lfp_scheduler_enable(0);
+        lfp_scheduler_set_class(LFP_IOCLASS_INTERACTIVE);
+    }
+
+    lfp_protocol* open() {
+        std::FILE* fp = std::fopen(this->path.c_str(), "rb");
+        REQUIRE(fp);
+        auto* f = lfp_cfile(fp);
+        REQUIRE(f);
+        return f;
+    }
+
+    std::vector< unsigned char > contents;
+};
+
+}
+
+TEST_CASE(
+    "Scheduler rejects invalid arguments",
+    "[scheduler]") {
+    CHECK(lfp_scheduler_enable(-1) == LFP_INVALID_ARGS);
+    CHECK(lfp_scheduler_share(LFP_IOCLASS_BATCH, 0) == LFP_INVALID_ARGS);
+    CHECK(lfp_scheduler_share(-1, 1) == LFP_INVALID_ARGS);
+    CHECK(lfp_scheduler_share(2, 1) == LFP_INVALID_ARGS);
+    CHECK(lfp_scheduler_set_class(2) == LFP_INVALID_ARGS);
+    CHECK(lfp_scheduler_set_class(LFP_IOCLASS_INTERACTIVE) == LFP_OK);
+}
+
+TEST_CASE_METHOD(
+    scheduled_file,
+    "Scheduled reads are split in quanta",
+    "[scheduler][cfile]") {
+    auto* f = open();
+    auto out = std::vector< unsigned char >(contents.size() + 10);
+
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(f, out.data(), out.size(), &bytes_read);
+    CHECK(err == LFP_EOF);
+    CHECK(bytes_read == std::int64_t(contents.size()));
+    out.resize(bytes_read);
+    CHECK_THAT(out, Equals(contents));
+
+    err = lfp_seek(f, 5);
+    CHECK(err == LFP_OK);
+    unsigned char x[2];
+    err = lfp_readinto(f, x, 2, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 2);
+    CHECK(x[0] == contents[5]);
+    CHECK(x[1] == contents[6]);
+
+    lfp_close(f);
+}
+
+TEST_CASE_METHOD(
+    scheduled_file,
+    "Interactive and batch reads share the scheduler",
+    "[scheduler][cfile]") {
+    CHECK(lfp_scheduler_share(LFP_IOCLASS_BATCH, 2) == LFP_OK);
+
+    const auto slots = GENERATE(1, 3);
+    REQUIRE(lfp_scheduler_enable(slots) == LFP_OK);
+
+    auto scan = [this] (int ioclass, int* mismatches) {
+        /* Catch is not thread safe, so no REQUIRE in open() */
+        lfp_scheduler_set_class(ioclass);
+        auto* f = lfp_cfile(std::fopen(path.c_str(), "rb"));
+        auto out = std::vector< unsigned char >(contents.size());
+        for (int i = 0; i < 4; ++i) {
+            lfp_seek(f, 0);
+            std::int64_t n = 0;
+            lfp_readinto(f, out.data(), out.size(), &n);
+            if (out != contents)
+                *mismatches += 1;
+        }
+        lfp_close(f);
+    };
+
+    auto frames = [this] (int* mismatches) {
+        auto* f = open();
+        for (int i = 0; i < 200; ++i) {
+            const auto pos = (i * 4099) % (contents.size() - 8);
+            unsigned char frame[8];
+            lfp_seek(f, pos);
+            lfp_readinto(f, frame, 8, nullptr);
+            if (not std::equal(frame, frame + 8, contents.begin() + pos))
+                *mismatches += 1;
+        }
+        lfp_close(f);
+    };
+
+    int batch_mismatches[2] = {};
+    int interactive_mismatches = 0;
+    std::thread b1(scan, LFP_IOCLASS_BATCH, batch_mismatches + 0);
+    std::thread b2(scan, LFP_IOCLASS_BATCH, batch_mismatches + 1);
+    frames(&interactive_mismatches);
+    b1.join();
+    b2.join();
+
+    CHECK(batch_mismatches[0] == 0);
+    CHECK(batch_mismatches[1] == 0);
+    CHECK(interactive_mismatches == 0);
+
+    lfp_scheduler_share(LFP_IOCLASS_BATCH, 1);
+}
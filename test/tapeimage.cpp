@@ -1,5 +1,6 @@
 #include <ciso646>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <vector>
 
@@ -7,6 +8,7 @@
 
 #include <lfp/memfile.h>
 #include <lfp/protocol.hpp>
+#include <lfp/readahead.h>
 #include <lfp/tapeimage.h>
 #include <lfp/lfp.h>
 
@@ -1818,3 +1820,729 @@ TEST_CASE(
     lfp_close(tif);
 }
 #endif
+
+TEST_CASE(
+    "Tapeimage can be reopened on a different file",
+    "[tapeimage][reopen]") {
+    const auto file1 = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x14, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+    };
+
+    const auto file2 = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+
+        0x15, 0x16, 0x17, 0x18,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x2C, 0x00, 0x00, 0x00,
+    };
+
+    const auto expected = std::vector< unsigned char > {
+        0x11, 0x12, 0x13, 0x14,
+        0x15, 0x16, 0x17, 0x18,
+    };
+
+    auto* tif = lfp_tapeimage_open(memopen(file1).release());
+    REQUIRE(tif);
+
+    auto out = std::vector< unsigned char >(8, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(tif, out.data(), 6, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 6);
+
+    auto mem = memopen(file2);
+    err = lfp_reopen(tif, mem.get());
+    REQUIRE(err == LFP_OK);
+    mem.release();
+
+    std::int64_t tell = -1;
+    err = lfp_tell(tif, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 0);
+
+    err = lfp_readinto(tif, out.data(), 8, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 8);
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(tif, 2);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(tif, out.data(), 4, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x13);
+    CHECK(out[3] == 0x16);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Failed reopen does not take ownership",
+    "[tapeimage][reopen]") {
+    const auto file = std::vector< unsigned char > {
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x0C, 0x00, 0x00, 0x00,
+    };
+
+    auto outer = memopen(file);
+    auto inner = memopen(file);
+
+    auto err = lfp_reopen(outer.get(), inner.get());
+    CHECK(err == LFP_LEAF_PROTOCOL);
+
+    err = lfp_reopen(outer.get(), nullptr);
+    CHECK(err == LFP_INVALID_ARGS);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(inner.get(), &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 0);
+}
+
+namespace {
+
+/*
+ * A memfile that can not be closed, until it is allowed to
+ */
+class stubborn : public lfp_protocol {
+public:
+    explicit stubborn(lfp_protocol* f) : fp(f) {}
+
+    void close() noexcept (false) override {
+        if (not this->closable)
+            throw lfp::io_error("stubborn: unable to close");
+        if (this->fp) this->fp.close();
+    }
+
+    lfp_status readinto(void* dst, std::int64_t len, std::int64_t* bytes_read)
+    noexcept (false) override {
+        return this->fp->readinto(dst, len, bytes_read);
+    }
+
+    int eof() const noexcept (false) override {
+        return this->fp->eof();
+    }
+
+    void seek(std::int64_t n) noexcept (false) override {
+        this->fp->seek(n);
+    }
+
+    std::int64_t tell() const noexcept (false) override {
+        return this->fp->tell();
+    }
+
+    lfp_protocol* peel() noexcept (false) override {
+        return this->fp.release();
+    }
+
+    lfp_protocol* peek() const noexcept (false) override {
+        return this->fp.get();
+    }
+
+    bool closable = false;
+
+private:
+    lfp::unique_lfp fp;
+};
+
+}
+
+TEST_CASE(
+    "Failed reopen leaves tapeimage as it was",
+    "[tapeimage][reopen]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x1C, 0x00, 0x00, 0x00,
+    };
+
+    auto* old = new stubborn(memopen(file).release());
+    auto* tif = lfp_tapeimage_open(old);
+    REQUIRE(tif);
+
+    unsigned char out[2];
+    auto err = lfp_readinto(tif, out, 2, nullptr);
+    CHECK(err == LFP_OK);
+
+    auto inner = memopen(file);
+    err = lfp_reopen(tif, inner.get());
+    CHECK(err == LFP_IOERROR);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(tif, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 2);
+
+    err = lfp_readinto(tif, out, 2, nullptr);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x03);
+    CHECK(out[1] == 0x04);
+
+    old->closable = true;
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Index records clamps the number of records to copy",
+    "[tapeimage][index]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x01, 0x02, 0x03, 0x04,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x1C, 0x00, 0x00, 0x00,
+    };
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    unsigned char out[10];
+    auto err = lfp_readinto(tif, out, sizeof(out), nullptr);
+    CHECK(err == LFP_EOF);
+
+    std::int64_t size = -1;
+    lfp_index_size(tif, &size);
+    REQUIRE(size == 2);
+
+    /* first + len would overflow */
+    lfp_record records[2];
+    std::int64_t n = -1;
+    const auto huge = (std::numeric_limits< std::int64_t >::max)();
+    err = lfp_index_records(tif, 1, huge, records, &n);
+    CHECK(err == LFP_OK);
+    CHECK(n == 1);
+    CHECK(records[0].type == 1);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Layers inserted below tapeimage keep the index and position",
+    "[tapeimage][insert_below]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+
+        0x15, 0x16, 0x17, 0x18,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x30, 0x00, 0x00, 0x00,
+
+        0x19, 0x1A, 0x1B, 0x1C,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+        0x3C, 0x00, 0x00, 0x00,
+    };
+
+    const auto expected = std::vector< unsigned char > {
+        0x11, 0x12, 0x13, 0x14,
+        0x15, 0x16, 0x17, 0x18,
+        0x19, 0x1A, 0x1B, 0x1C,
+    };
+
+    auto* mem = memopen(file).release();
+    auto* tif = lfp_tapeimage_open(mem);
+    REQUIRE(tif);
+
+    auto out = std::vector< unsigned char >(12, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(tif, out.data(), 6, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 6);
+
+    std::int64_t records = -1;
+    err = lfp_index_size(tif, &records);
+    CHECK(err == LFP_OK);
+
+    int calls = 0;
+    const auto factory = [] (lfp_protocol* f, void* userdata) {
+        *static_cast< int* >(userdata) += 1;
+        return lfp_readahead_open(f, 64);
+    };
+    err = lfp_insert_below(tif, factory, &calls);
+    REQUIRE(err == LFP_OK);
+    CHECK(calls == 1);
+
+    lfp_protocol* inner = nullptr;
+    err = lfp_peek(tif, &inner);
+    CHECK(err == LFP_OK);
+    CHECK(inner != mem);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(tif, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 6);
+
+    std::int64_t after = -1;
+    err = lfp_index_size(tif, &after);
+    CHECK(err == LFP_OK);
+    CHECK(after == records);
+
+    err = lfp_readinto(tif, out.data() + 6, 6, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 6);
+    CHECK_THAT(out, Equals(expected));
+
+    err = lfp_seek(tif, 3);
+    CHECK(err == LFP_OK);
+    err = lfp_readinto(tif, out.data(), 2, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x14);
+    CHECK(out[1] == 0x15);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Failed insert_below leaves the protocol unchanged",
+    "[tapeimage][insert_below]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x1C, 0x00, 0x00, 0x00,
+    };
+
+    const auto none = [] (lfp_protocol*, void*) -> lfp_protocol* {
+        return nullptr;
+    };
+
+    SECTION("leaf protocols have nothing beneath them") {
+        auto mem = memopen(file);
+        const auto err = lfp_insert_below(mem.get(), none, nullptr);
+        CHECK(err == LFP_LEAF_PROTOCOL);
+    }
+
+    SECTION("the factory fails") {
+        auto* tif = lfp_tapeimage_open(memopen(file).release());
+        REQUIRE(tif);
+
+        auto err = lfp_insert_below(tif, nullptr, nullptr);
+        CHECK(err == LFP_INVALID_ARGS);
+
+        err = lfp_insert_below(tif, none, nullptr);
+        CHECK(err == LFP_RUNTIME_ERROR);
+
+        unsigned char out[4];
+        std::int64_t bytes_read = -1;
+        err = lfp_readinto(tif, out, 4, &bytes_read);
+        CHECK(err == LFP_OK);
+        CHECK(bytes_read == 4);
+        CHECK(out[0] == 0x11);
+        CHECK(out[3] == 0x14);
+
+        lfp_close(tif);
+    }
+}
+
+TEST_CASE_METHOD(
+    random_tapeimage,
+    "Translate matches seek and ptell",
+    "[tapeimage][translate]") {
+    const auto real_size = size;
+    const auto records = GENERATE(1, 2, 3, 5, 8, 13);
+    make(records);
+
+    auto offsets = std::vector< std::int64_t >(real_size + 1);
+    for (int i = 0; i <= real_size; ++i)
+        offsets[i] = i;
+
+    /* on a fresh handle, so that the headers must be read */
+    auto physical = std::vector< std::int64_t >(offsets.size(), -1);
+    auto err = lfp_translate(f, offsets.data(), physical.data(), offsets.size());
+    REQUIRE(err == LFP_OK);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(f, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 0);
+
+    auto* ref = lfp_tapeimage_open(
+        lfp_memfile_openwith(tape.data(), tape.size())
+    );
+    REQUIRE(ref);
+
+    /* index the whole file first, like translate does */
+    lfp_seek(ref, real_size);
+    auto expected_physical = std::vector< std::int64_t >(offsets.size(), -1);
+    for (std::size_t i = 0; i < offsets.size(); ++i) {
+        lfp_seek(ref, offsets[i]);
+        lfp_ptell(ref, &expected_physical[i]);
+    }
+    lfp_close(ref);
+
+    CHECK_THAT(physical, Equals(expected_physical));
+
+    std::int64_t nread = 0;
+    err = lfp_readinto(f, out.data(), out.size(), &nread);
+    CHECK(err == LFP_OK);
+    CHECK(nread == real_size);
+    CHECK_THAT(out, Equals(expected));
+}
+
+TEST_CASE(
+    "Translate does not move the read head",
+    "[tapeimage][translate]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+
+        0x15, 0x16, 0x17, 0x18,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x2C, 0x00, 0x00, 0x00,
+    };
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    unsigned char out[4];
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(tif, out, 3, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 3);
+
+    SECTION("offsets past the index are indexed") {
+        const std::int64_t logical[] = { 1, 4, 6, 8 };
+        std::int64_t physical[4];
+        err = lfp_translate(tif, logical, physical, 4);
+        CHECK(err == LFP_OK);
+        CHECK(physical[0] == 13);
+        CHECK(physical[1] == 28);
+        CHECK(physical[2] == 30);
+        CHECK(physical[3] == 32);
+    }
+
+    SECTION("offsets past end-of-file are rejected") {
+        const std::int64_t logical[] = { 1, 9 };
+        std::int64_t physical[2];
+        err = lfp_translate(tif, logical, physical, 2);
+        CHECK(err == LFP_INVALID_ARGS);
+    }
+
+    SECTION("offsets must be sorted") {
+        const std::int64_t logical[] = { 2, 1 };
+        std::int64_t physical[2];
+        err = lfp_translate(tif, logical, physical, 2);
+        CHECK(err == LFP_INVALID_ARGS);
+    }
+
+    std::int64_t tell = -1;
+    err = lfp_tell(tif, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 3);
+
+    /* the underlying file is put back too */
+    std::int64_t ptell = -1;
+    err = lfp_ptell(tif, &ptell);
+    CHECK(err == LFP_OK);
+    CHECK(ptell == 15);
+
+    err = lfp_readinto(tif, out, 2, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 2);
+    CHECK(out[0] == 0x14);
+    CHECK(out[1] == 0x15);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Translate reports errors from reading headers",
+    "[tapeimage][translate]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        /* next < prev */
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x15, 0x16, 0x17, 0x18,
+    };
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    unsigned char out[4];
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(tif, out, 3, &bytes_read);
+    CHECK(err == LFP_OK);
+
+    const std::int64_t logical[] = { 1, 6 };
+    std::int64_t physical[2];
+    err = lfp_translate(tif, logical, physical, 2);
+    CHECK(err == LFP_PROTOCOL_FATAL_ERROR);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(tif, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 3);
+
+    err = lfp_readinto(tif, out, 1, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(out[0] == 0x14);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Tapeimage recovers from transient errors and keeps the index",
+    "[tapeimage][recover]") {
+    const auto file = std::vector< unsigned char > {
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+
+        0x11, 0x12, 0x13, 0x14,
+
+        0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        0x20, 0x00, 0x00, 0x00,
+
+        0x15, 0x16, 0x17, 0x18,
+
+        0x01, 0x00, 0x00, 0x00,
+        0x10, 0x00, 0x00, 0x00,
+        0x2C, 0x00, 0x00, 0x00,
+    };
+
+    const auto expected = std::vector< unsigned char > {
+        0x11, 0x12, 0x13, 0x14,
+        0x15, 0x16, 0x17, 0x18,
+    };
+
+    /*
+     * The reads of the underlying file are header 1, body 1, header 2, body 2,
+     * so fail either in the middle of a header, or a body
+     */
+    const auto failing = GENERATE(2, 3);
+    auto* flaky = new flakyfile(file, { failing });
+    auto* tif = lfp_tapeimage_open(flaky);
+    REQUIRE(tif);
+
+    auto out = std::vector< unsigned char >(8, 0xFF);
+    std::int64_t bytes_read = -1;
+    auto err = lfp_readinto(tif, out.data(), 8, &bytes_read);
+    CHECK(err == LFP_IOERROR);
+
+    std::int64_t tell = -1;
+    err = lfp_tell(tif, &tell);
+    CHECK(err == LFP_OK);
+    CHECK(tell == 4);
+
+    err = lfp_recover(tif);
+    CHECK(err == LFP_OK);
+    CHECK(flaky->recoveries == 1);
+
+    err = lfp_readinto(tif, out.data() + 4, 4, &bytes_read);
+    CHECK(err == LFP_OK);
+    CHECK(bytes_read == 4);
+    CHECK_THAT(out, Equals(expected));
+
+    std::int64_t records = -1;
+    lfp_index_size(tif, &records);
+    CHECK(records == 2);
+    /* only the failed read is repeated, nothing is re-indexed */
+    CHECK(flaky->calls == 5);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Cold seek can be done in bounded steps",
+    "[tapeimage][seek_step]") {
+    std::vector< unsigned char > file;
+    const auto records = 20;
+    for (int i = 0; i < records + 1; ++i) {
+        const std::uint32_t type = (i == records) ? 1 : 0;
+        const std::uint32_t prev = (i == 0) ? 0 : 16 * (i - 1);
+        const std::uint32_t next = (i == records) ? 16 * i + 12 : 16 * (i + 1);
+        for (const auto x : { type, prev, next }) {
+            file.push_back(x & 0xFF);
+            file.push_back((x >> 8) & 0xFF);
+            file.push_back((x >> 16) & 0xFF);
+            file.push_back((x >> 24) & 0xFF);
+        }
+
+        if (i == records) break;
+        for (int k = 0; k < 4; ++k)
+            file.push_back(4 * i + k);
+    }
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    CHECK(lfp_seek_step(tif, 10, 0) == LFP_INVALID_ARGS);
+    CHECK(lfp_seek_step(tif, -1, 1) == LFP_INVALID_ARGS);
+
+    int steps = 0;
+    std::int64_t indexed = 0;
+    int err = LFP_OKINCOMPLETE;
+    while (err == LFP_OKINCOMPLETE) {
+        err = lfp_seek_step(tif, 70, 3);
+        steps += 1;
+
+        std::int64_t size = -1;
+        lfp_index_size(tif, &size);
+        CHECK(size - indexed <= 3);
+        indexed = size;
+
+        std::int64_t tell = -1;
+        CHECK(lfp_tell(tif, &tell) == LFP_OK);
+        CHECK(tell <= 70);
+    }
+
+    CHECK(err == LFP_OK);
+    CHECK(steps == 6);
+
+    std::int64_t tell = -1;
+    lfp_tell(tif, &tell);
+    CHECK(tell == 70);
+
+    unsigned char x = 0;
+    err = lfp_readinto(tif, &x, 1, nullptr);
+    CHECK(err == LFP_OK);
+    CHECK(x == 70);
+
+    /* within the index, the seek is done in a single step */
+    CHECK(lfp_seek_step(tif, 3, 1) == LFP_OK);
+    lfp_readinto(tif, &x, 1, nullptr);
+    CHECK(x == 3);
+
+    lfp_close(tif);
+}
+
+TEST_CASE(
+    "Runs of empty and equally sized records",
+    "[tapeimage][runs]") {
+    /*
+     * Runs of data records, separated by long runs of empty records, and
+     * ending with a file mark
+     */
+    const int sizes[] = { 4, 4, 4, 0, 4, 7, 0, 4, 4, 1 };
+    const int repeat[] = { 3, 1, 1, 1000, 5, 1, 500, 2, 1, 1 };
+
+    tapeimage_file image;
+    std::vector< std::int64_t > lengths;
+    for (int i = 0; i < 10; ++i) {
+        for (int k = 0; k < repeat[i]; ++k) {
+            image.push(0, sizes[i]);
+            lengths.push_back(sizes[i]);
+        }
+    }
+    image.push(1, 0);
+    lengths.push_back(0);
+    const auto& file = image.file;
+    const auto& expected = image.expected;
+
+    auto* tif = lfp_tapeimage_open(memopen(file).release());
+    REQUIRE(tif);
+
+    const auto readall = [&] {
+        auto out = std::vector< unsigned char >(expected.size() + 10);
+        std::int64_t bytes_read = -1;
+        const auto err = lfp_readinto(tif, out.data(), out.size(), &bytes_read);
+        CHECK(err == LFP_EOF);
+        out.resize(bytes_read);
+        return out;
+    };
+
+    CHECK_THAT(readall(), Equals(expected));
+
+    std::int64_t size = -1;
+    lfp_index_size(tif, &size);
+    REQUIRE(size == std::int64_t(lengths.size()));
+
+    auto records = std::vector< lfp_record >(size);
+    std::int64_t n = -1;
+    lfp_index_records(tif, 0, size, records.data(), &n);
+    REQUIRE(n == size);
+    std::int64_t logical = 0;
+    for (std::int64_t i = 0; i < size; ++i) {
+        CHECK(records[i].length == lengths[i]);
+        CHECK(records[i].logical == logical);
+        logical += lengths[i];
+    }
+    CHECK(records.back().type == 1);
+
+    /* re-reading the file goes through the index */
+    auto err = lfp_seek(tif, 0);
+    CHECK(err == LFP_OK);
+    CHECK_THAT(readall(), Equals(expected));
+
+    /* the underlying file is read past the file mark, like the first time */
+    std::int64_t ptell = -1;
+    err = lfp_ptell(tif, &ptell);
+    CHECK(err == LFP_OK);
+    CHECK(ptell == std::int64_t(file.size()));
+
+    for (std::int64_t pos = expected.size() - 1; pos >= 0; pos -= 3) {
+        err = lfp_seek(tif, pos);
+        CHECK(err == LFP_OK);
+        std::int64_t tell = -1;
+        lfp_tell(tif, &tell);
+        CHECK(tell == pos);
+
+        unsigned char b = 0;
+        err = lfp_readinto(tif, &b, 1, nullptr);
+        CHECK(b == expected[pos]);
+    }
+
+    lfp_close(tif);
+}
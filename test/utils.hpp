@@ -1,8 +1,20 @@
 #ifndef LFP_TEST_UTILS_HPP
 #define LFP_TEST_UTILS_HPP
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <memory>
 #include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
 
 #include <catch2/catch.hpp>
 
@@ -77,6 +89,101 @@ struct random_memfile {
 
 }
 
+namespace {
+
+/*
+ * An empty file with a unique name in the temporary directory. Tests that
+ * need files on disk must not use fixed names, or parallel test runs write
+ * to the same files.
+ */
+std::string temp_path(const std::string& prefix) {
+#if defined(_WIN32)
+    char* name = _tempnam(nullptr, prefix.c_str());
+    REQUIRE(name);
+    const auto path = std::string(name);
+    std::free(name);
+    std::FILE* fp = std::fopen(path.c_str(), "wb");
+    REQUIRE(fp);
+    std::fclose(fp);
+    return path;
+#else
+    const char* dir = std::getenv("TMPDIR");
+    auto tmpl = std::string(dir and *dir ? dir : "/tmp");
+    tmpl += "/" + prefix + "-XXXXXX";
+
+    auto name = std::vector< char >(tmpl.begin(), tmpl.end());
+    name.push_back('\0');
+    const int fd = ::mkstemp(name.data());
+    REQUIRE(fd != -1);
+    ::close(fd);
+    return std::string(name.data());
+#endif
+}
+
+/*
+ * Fixture for the protocols that open files by path, or identify them by
+ * inode, so that the contents must be written to an actual file. The file is
+ * removed when the fixture goes out of scope.
+ */
+struct disk_file {
+    explicit disk_file(const std::string& prefix) : path(temp_path(prefix)) {}
+
+    ~disk_file() {
+        std::remove(this->path.c_str());
+    }
+
+    void write(const std::vector< unsigned char >& contents) const {
+        std::FILE* fp = std::fopen(this->path.c_str(), "wb");
+        REQUIRE(fp);
+        std::fwrite(contents.data(), 1, contents.size(), fp);
+        std::fclose(fp);
+    }
+
+    std::string path;
+};
+
+/*
+ * Builder for tape image files. Every record is a 12-byte header of the
+ * record type and the offsets of the previous and next header, followed by
+ * the record body. The bodies are also appended to expected, which is then
+ * the logical stream of the file.
+ */
+struct tapeimage_file {
+    /*
+     * Push a record of len generated bytes. The bytes do not repeat with a
+     * short period, so that misplaced reads are noticed.
+     */
+    void push(std::uint32_t type, std::size_t len) {
+        auto body = std::vector< unsigned char >(len);
+        for (auto& c : body) {
+            this->x = this->x * 1103515245 + 12345;
+            c = (this->x >> 16) & 0xFF;
+        }
+        this->push(type, body.data(), body.size());
+    }
+
+    void push(std::uint32_t type, const unsigned char* body, std::size_t len) {
+        const std::uint32_t pos  = this->file.size();
+        const std::uint32_t next = pos + 12 + len;
+        for (const auto v : { type, this->prev, next }) {
+            this->file.push_back(v & 0xFF);
+            this->file.push_back((v >> 8) & 0xFF);
+            this->file.push_back((v >> 16) & 0xFF);
+            this->file.push_back((v >> 24) & 0xFF);
+        }
+        this->file.insert(this->file.end(), body, body + len);
+        this->expected.insert(this->expected.end(), body, body + len);
+        this->prev = pos;
+    }
+
+    std::vector< unsigned char > file;
+    std::vector< unsigned char > expected;
+    std::uint32_t prev = 0;
+    std::uint32_t x = 1;
+};
+
+}
+
 namespace {
 lfp_protocol* create_cfile_handle_with_0 (std::vector< unsigned char > contents,
                                           std::int64_t zero) {
@@ -360,4 +467,72 @@ namespace {
     };
 }
 
+namespace {
+    /*
+     * A file that fails reads with a (transient) io_error. The reads numbered
+     * in failing, counting from 0, read half the requested bytes and then
+     * fail, like a network file that times out in the middle of a read.
+     */
+    class flakyfile : public lfp_protocol
+    {
+      public:
+        flakyfile(std::vector< unsigned char > d, std::vector< int > failing) :
+            data(d),
+            failing(failing)
+        {}
+
+        void close() noexcept(true) override {}
+        lfp_status readinto(
+            void *dst,
+            std::int64_t len,
+            std::int64_t *bytes_read) noexcept(false) override
+        {
+            const auto call = this->calls++;
+            const auto fail = std::find(this->failing.begin(),
+                                        this->failing.end(),
+                                        call) != this->failing.end();
+
+            const auto left = std::int64_t(this->data.size()) - this->pos;
+            auto read = std::min(fail ? len / 2 : len, left);
+            std::memcpy(dst, this->data.data() + this->pos, read);
+            this->pos += read;
+            this->at_eof = read < len and not fail;
+            *bytes_read = read;
+
+            if (fail)
+                throw lfp::io_error("flakyfile: transient error");
+
+            return read == len ? LFP_OK : LFP_EOF;
+        }
+
+        int eof() const noexcept(true) override { return this->at_eof; }
+
+        void seek(std::int64_t n) noexcept (false) override {
+            assert(n <= std::int64_t(this->data.size()));
+            this->pos = n;
+            this->at_eof = false;
+        }
+
+        std::int64_t tell() const noexcept (false) override {
+            return this->pos;
+        }
+
+        void recover() noexcept (true) override {
+            this->recoveries += 1;
+        }
+
+        lfp_protocol* peel() noexcept (false) override { throw; }
+        lfp_protocol* peek() const noexcept (false) override { throw; }
+
+        int calls = 0;
+        int recoveries = 0;
+
+      private:
+        std::int64_t pos = 0;
+        bool at_eof = false;
+        std::vector< unsigned char > data;
+        std::vector< int > failing;
+    };
+}
+
 #endif //LFP_TEST_UTILS_HPP